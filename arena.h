@@ -0,0 +1,209 @@
+/* Region (arena) allocation on top of an allocator with the `FirstFit`
+ * interface, for memory that is freed all at once, such as everything a
+ * server allocates for one request.
+ *
+ * An `Arena` takes chunks from the allocator and bump-allocates in them.
+ * Freeing a single block does nothing; `Reset` (or the destructor) gives each
+ * chunk back with one `Free`, so freeing everything costs O(chunks) rather
+ * than O(blocks).  A large allocation gets a chunk of its own, so that it
+ * doesn't waste the rest of the current one.
+ *
+ * Arenas nest: a child arena (a subpool, say for one phase of a request)
+ * takes its own chunks from the same allocator, and can be reset on its own,
+ * but resetting or destroying its parent resets it too.
+ *
+ * `ArenaSimulator` adds arenas to a `Simulator`: an arena dies at a given
+ * tick, along with its children, and plain blocks die one at a time as
+ * before.
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "block_layout.h"
+#include "simulator.h"
+
+template <class Allocator>
+class Arena {
+ public:
+  static constexpr size_t kDefaultChunkSize = 64 << 10;
+
+  explicit Arena(Allocator& allocator,
+                 size_t chunk_size = kDefaultChunkSize)
+      :_allocator(allocator), _chunk_size(chunk_size) {
+    assert(chunk_size > 0);
+  }
+
+  // A child of `parent`, with the same allocator and chunk size.
+  explicit Arena(Arena& parent)
+      :_allocator(parent._allocator), _chunk_size(parent._chunk_size),
+       _parent(&parent) {
+    parent._children.push_back(this);
+  }
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  ~Arena() {
+    Reset();
+    for (Arena* child : _children) child->_parent = nullptr;
+    if (_parent) {
+      auto& siblings = _parent->_children;
+      siblings.erase(std::find(siblings.begin(), siblings.end(), this));
+    }
+  }
+
+  Block Alloc(size_t size) {
+    assert(size > 0);
+    _used_bytes += size;
+    if (size > _chunk_size / 4) {
+      // Its own chunk, leaving the current one to bump in.
+      Block chunk = _allocator.Alloc(size);
+      _chunks.push_back(chunk);
+      _reserved_bytes += size;
+      return chunk;
+    }
+    if (_next + size > _limit) {
+      Block chunk = _allocator.Alloc(_chunk_size);
+      _chunks.push_back(chunk);
+      _reserved_bytes += _chunk_size;
+      _next = chunk.start();
+      _limit = chunk.end();
+    }
+    Block block(_next, size);
+    _next += size;
+    return block;
+  }
+
+  // Blocks are only freed by `Reset`.
+  void Free(Block) {}
+
+  // Frees everything allocated in this arena and its children, one `Free`
+  // per chunk.  The children stay, empty.
+  void Reset() {
+    for (Arena* child : _children) child->Reset();
+    for (const Block& chunk : _chunks) _allocator.Free(chunk);
+    _chunks.clear();
+    _next = _limit = 0;
+    _used_bytes = _reserved_bytes = 0;
+  }
+
+  // The bytes handed out, and the bytes of the chunks they came from, in
+  // this arena and its children.
+  size_t UsedBytes() const {
+    size_t bytes = _used_bytes;
+    for (const Arena* child : _children) bytes += child->UsedBytes();
+    return bytes;
+  }
+  size_t ReservedBytes() const {
+    size_t bytes = _reserved_bytes;
+    for (const Arena* child : _children) bytes += child->ReservedBytes();
+    return bytes;
+  }
+  // The chunks of this arena alone.
+  size_t Chunks() const { return _chunks.size(); }
+
+ private:
+  Allocator& _allocator;
+  size_t _chunk_size;
+  // Null for a top-level arena, or once the parent is gone.
+  Arena* _parent = nullptr;
+  std::vector<Arena*> _children;
+  std::vector<Block> _chunks;
+  // The free part of the current chunk.
+  size_t _next = 0;
+  size_t _limit = 0;
+  size_t _used_bytes = 0;
+  size_t _reserved_bytes = 0;
+};
+
+template <class Allocator>
+class ArenaSimulator {
+ public:
+  static constexpr size_t kNoParent = SIZE_MAX;
+
+  explicit ArenaSimulator(
+      Allocator& allocator,
+      size_t chunk_size = Arena<Allocator>::kDefaultChunkSize)
+      :_allocator(allocator), _chunk_size(chunk_size), _blocks(allocator) {}
+
+  uint64_t Now() const { return _blocks.Now(); }
+
+  // The bytes handed out and not yet freed, in plain blocks and in arenas.
+  size_t LiveBytes() const { return _blocks.LiveBytes() + _arena_bytes; }
+  size_t LiveArenas() const { return _deaths.size(); }
+
+  // Moves the clock forward to `time`, freeing every block and resetting
+  // every arena that dies by then.
+  void AdvanceTo(uint64_t time) {
+    _blocks.AdvanceTo(time);
+    while (!_deaths.empty() && _deaths.MinKey() <= time) {
+      size_t id = _deaths.Pop().second;
+      // A child may already have been reset with its parent, at the same
+      // tick.
+      _arena_bytes -= _arenas[id]->UsedBytes();
+      _arenas[id].reset();
+      _free_ids.push_back(id);
+    }
+  }
+
+  // Opens an arena, as a child of arena `parent` if given, which is reset
+  // `lifetime` ticks from now (or when its parent is, if that's sooner).
+  // Returns its id, which is reused once it dies.
+  size_t Open(uint64_t lifetime, size_t parent = kNoParent) {
+    uint64_t death = Now() + lifetime;
+    size_t id;
+    if (_free_ids.empty()) {
+      id = _arenas.size();
+      _arenas.emplace_back();
+      _death_times.push_back(0);
+    } else {
+      id = _free_ids.back();
+      _free_ids.pop_back();
+    }
+    if (parent == kNoParent) {
+      _arenas[id] = std::make_unique<Arena<Allocator>>(_allocator,
+                                                       _chunk_size);
+    } else {
+      assert(_arenas[parent]);
+      _arenas[id] = std::make_unique<Arena<Allocator>>(*_arenas[parent]);
+      death = std::min(death, _death_times[parent]);
+    }
+    _death_times[id] = death;
+    _deaths.Push(death, id);
+    return id;
+  }
+
+  // Allocates `size` bytes in arena `id`, which must be open.
+  Block AllocateIn(size_t id, size_t size) {
+    assert(id < _arenas.size() && _arenas[id]);
+    _arena_bytes += size;
+    return _arenas[id]->Alloc(size);
+  }
+
+  // Allocates a plain block of `size` bytes, to die `lifetime` ticks from
+  // now.
+  Block Allocate(size_t size, uint64_t lifetime) {
+    return _blocks.Allocate(size, lifetime);
+  }
+
+ private:
+  Allocator& _allocator;
+  size_t _chunk_size;
+  Simulator<Allocator> _blocks;
+  // By id: the open arenas (null for free ids), and when each dies.
+  std::vector<std::unique_ptr<Arena<Allocator>>> _arenas;
+  std::vector<uint64_t> _death_times;
+  std::vector<size_t> _free_ids;
+  RadixHeap<size_t> _deaths;
+  size_t _arena_bytes = 0;
+};
+
+#endif  // ARENA_H_
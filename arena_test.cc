@@ -0,0 +1,179 @@
+#include "arena.h"
+
+#include "first_fit.h"
+
+#include <memory>
+#include <random>
+#include <vector>
+
+// `FirstFit`, counting the calls.
+class CountingFirstFit {
+ public:
+  Block Alloc(size_t size) {
+    ++_allocs;
+    return _ff.Alloc(size);
+  }
+  void Free(Block block) {
+    ++_frees;
+    _ff.Free(block);
+  }
+  size_t Allocs() const { return _allocs; }
+  size_t Frees() const { return _frees; }
+  size_t Pages() const { return _ff.get_residency().pages.Pages(); }
+
+ private:
+  FirstFit _ff;
+  size_t _allocs = 0;
+  size_t _frees = 0;
+};
+
+static void ArenaTest() {
+  CountingFirstFit ff;
+  Arena<CountingFirstFit> arena(ff, 1000);
+  // Bump allocation, ten to a chunk.
+  std::vector<Block> blocks;
+  for (size_t i = 0; i < 25; ++i) blocks.push_back(arena.Alloc(100));
+  assert(blocks[0].start() == 0);
+  assert(blocks[9].start() == 900);
+  assert(blocks[10].start() == 1000);
+  assert(ff.Allocs() == 3);
+  // A large block gets its own chunk, and bumping goes on in the last one.
+  Block large = arena.Alloc(600);
+  assert(large.start() == 3000);
+  assert(arena.Alloc(100).start() == 2500);
+  assert(arena.Chunks() == 4);
+  assert(arena.UsedBytes() == 26 * 100 + 600);
+  assert(arena.ReservedBytes() == 3 * 1000 + 600);
+  // Freeing a block does nothing, and `Reset` frees a chunk at a time.
+  arena.Free(blocks[0]);
+  assert(ff.Frees() == 0);
+  arena.Reset();
+  assert(ff.Frees() == 4);
+  assert(ff.Pages() == 0);
+  assert(arena.UsedBytes() == 0);
+  // And it can be used again.
+  assert(arena.Alloc(10).start() == 0);
+}
+
+static void NestedTest() {
+  CountingFirstFit ff;
+  {
+    Arena<CountingFirstFit> parent(ff, 1000);
+    parent.Alloc(10);
+    Arena<CountingFirstFit> child(parent);
+    Block a = child.Alloc(10);
+    // The child has a chunk of its own.
+    assert(a.start() == 1000);
+    assert(parent.UsedBytes() == 20);
+    assert(parent.ReservedBytes() == 2000);
+    child.Reset();
+    assert(ff.Frees() == 1);
+    assert(parent.UsedBytes() == 10);
+    child.Alloc(10);
+    // Resetting the parent resets the child.
+    parent.Reset();
+    assert(ff.Frees() == 3);
+    assert(child.UsedBytes() == 0);
+    {
+      Arena<CountingFirstFit> grandchild(child);
+      grandchild.Alloc(10);
+      assert(parent.UsedBytes() == 10);
+    }
+    // The grandchild freed its chunk and left.
+    assert(ff.Frees() == 4);
+    assert(parent.UsedBytes() == 0);
+    parent.Alloc(10);
+    child.Alloc(10);
+  }
+  // The child was destroyed first, then the parent.
+  assert(ff.Frees() == 6);
+  assert(ff.Pages() == 0);
+  // The parent goes first, and the child outlives it, empty.
+  auto parent = std::make_unique<Arena<CountingFirstFit>>(ff, 1000);
+  Arena<CountingFirstFit> child(*parent);
+  child.Alloc(10);
+  parent.reset();
+  assert(ff.Pages() == 0);
+  assert(child.UsedBytes() == 0);
+}
+
+// Request arenas, each with phase arenas inside, alongside plain blocks: the
+// live bytes add up, and when everything has died the heap is empty.
+static void ArenaSimulatorTest() {
+  FirstFit ff;
+  ArenaSimulator<FirstFit> simulator(ff, 4096);
+  std::default_random_engine engine(1);
+  std::uniform_int_distribution<size_t> size(1, 2000);
+  std::uniform_int_distribution<uint64_t> lifetime(0, 500);
+  // The arenas that are open, and when they die.
+  struct Open {
+    size_t id;
+    uint64_t death;
+  };
+  std::vector<Open> open;
+  // The bytes in each arena itself (by id), and the plain blocks.
+  std::vector<size_t> arena_bytes;
+  std::vector<std::pair<uint64_t, size_t>> plain;
+  size_t plain_bytes = 0;
+  for (uint64_t now = 0; now < 20'000; ++now) {
+    simulator.AdvanceTo(now);
+    // Forget what died: plain blocks, then arenas (children along with their
+    // parents).
+    std::erase_if(plain, [&](const std::pair<uint64_t, size_t>& p) {
+      if (p.first > now) return false;
+      plain_bytes -= p.second;
+      return true;
+    });
+    std::erase_if(open, [&](const Open& a) {
+      if (a.death > now) return false;
+      arena_bytes[a.id] = 0;
+      return true;
+    });
+    size_t expected = plain_bytes;
+    for (const Open& a : open) expected += arena_bytes[a.id];
+    assert(simulator.LiveBytes() == expected);
+    assert(simulator.LiveArenas() == open.size());
+    switch (engine() % 4) {
+      case 0: {
+        // A request, or a phase of one.
+        size_t parent = ArenaSimulator<FirstFit>::kNoParent;
+        uint64_t death = now + lifetime(engine);
+        if (!open.empty() && engine() % 2) {
+          const Open& p = open[engine() % open.size()];
+          parent = p.id;
+          death = std::min(death, p.death);
+        }
+        size_t id = simulator.Open(death - now, parent);
+        if (id >= arena_bytes.size()) arena_bytes.resize(id + 1);
+        arena_bytes[id] = 0;
+        open.push_back({id, death});
+        break;
+      }
+      case 1: {
+        uint64_t life = lifetime(engine);
+        size_t n = size(engine);
+        simulator.Allocate(n, life);
+        plain.emplace_back(now + life, n);
+        plain_bytes += n;
+        break;
+      }
+      default:
+        if (!open.empty()) {
+          size_t id = open[engine() % open.size()].id;
+          size_t n = size(engine);
+          simulator.AllocateIn(id, n);
+          arena_bytes[id] += n;
+        }
+    }
+  }
+  simulator.AdvanceTo(UINT64_MAX);
+  assert(simulator.LiveBytes() == 0);
+  assert(simulator.LiveArenas() == 0);
+  assert(ff.get_residency().pages.Pages() == 0);
+}
+
+int main() {
+  ArenaTest();
+  NestedTest();
+  ArenaSimulatorTest();
+}
@@ -0,0 +1,540 @@
+/* The layout of the allocated blocks of an address space, for the allocators
+ * in `first_fit.h`.
+ *
+ * The blocks are kept in a treap, in address order.  A node doesn't store its
+ * block's address: it stores the size of the gap between the previous block
+ * (or address 0) and its block, along with the block's size.  Addresses are
+ * found by adding up gaps and sizes on the way down.  Each subtree also
+ * records its total span and its largest gap, so the lowest or highest hole
+ * that fits a block is found in O(log n) expected time, and the number and
+ * total size of its blocks, so the blocks below any address are summarized
+ * in O(log n) expected time too.
+ *
+ * Since nothing stores an absolute address, moving a run of blocks (a region)
+ * only changes the gap in front of the region and the gap after it, wherever
+ * the region goes.  So `MoveRegion` takes O(log n) expected time, no matter
+ * how many blocks are in the region.  That's what makes compaction cheap.
+ */
+
+#ifndef BLOCK_LAYOUT_H_
+#define BLOCK_LAYOUT_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <span>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "checkpoint.h"
+
+class Block {
+ public:
+  Block(size_t start, size_t size) :_start(start), _size(size) {}
+  size_t start() const { return _start; }
+  size_t size() const { return _size; }
+  size_t end() const { return _start + _size; }
+
+ private:
+  size_t _start;
+  size_t _size;
+};
+
+inline bool operator<(Block a, Block b) {
+  if (a.start() == b.start()) assert(a.size() == b.size());
+  return a.start() < b.start();
+}
+
+inline bool operator==(Block a, Block b) {
+  if (a.start() == b.start()) assert(a.size() == b.size());
+  return a.start() == b.start();
+}
+
+inline std::ostream& operator<<(std::ostream& os, Block b) {
+  return os << "{" << b.start() << ", " << b.size() << "}";
+}
+
+class BlockLayout {
+ public:
+  // A block along with the free space right below it, `[hole_start, start)`.
+  struct Hole {
+    size_t hole_start;
+    size_t start;
+  };
+
+  // Where the blocks next to a block are: the end of the one below it (zero
+  // if there is none), and the start of the one above it (`SIZE_MAX` if there
+  // is none).
+  struct Neighbors {
+    size_t below_end;
+    size_t above_start;
+  };
+
+  // Adds `block`, which must be in free space, and returns its neighbors.
+  Neighbors Insert(Block block) {
+    auto [below, above] = Split(std::move(_root), block.start(), 0);
+    size_t prev_end = Span(below);
+    assert(prev_end <= block.start());
+    auto node = std::make_unique<Node>(_uniform_distribution(_engine),
+                                       block.start() - prev_end, block.size());
+    Neighbors neighbors{prev_end, SIZE_MAX};
+    if (above) {
+      size_t gap = FirstGap(above);
+      assert(prev_end + gap >= block.end());
+      neighbors.above_start = prev_end + gap;
+      SetFirstGap(above.get(), prev_end + gap - block.end());
+    }
+    _root = Merge(Merge(std::move(below), std::move(node)), std::move(above));
+    return neighbors;
+  }
+
+  // Removes `block`, which must be allocated, and returns its neighbors.
+  Neighbors Erase(Block block) {
+    auto [below, rest] = Split(std::move(_root), block.start(), 0);
+    auto [node, above] = Split(std::move(rest), block.start() + 1,
+                               Span(below));
+    assert(node && !node->_left && !node->_right);
+    assert(Span(below) + node->_gap == block.start());
+    assert(node->_size == block.size());
+    Neighbors neighbors{Span(below), SIZE_MAX};
+    if (above) {
+      neighbors.above_start = block.end() + FirstGap(above);
+      SetFirstGap(above.get(), FirstGap(above) + Span(node));
+    }
+    _root = Merge(std::move(below), std::move(above));
+    return neighbors;
+  }
+
+  // Removes `blocks`, which must be allocated and sorted by address, in one
+  // pass over the tree that only visits the paths to them: O(k log(n / k))
+  // expected time for k blocks, rather than O(k log n) for k `Erase`s.
+  // Returns, for each block, the nearest blocks that are left below and
+  // above it.
+  std::vector<Neighbors> EraseBatch(std::span<const Block> blocks) {
+    assert(std::is_sorted(blocks.begin(), blocks.end()));
+    BatchState state{blocks, std::vector<Neighbors>(blocks.size()), 0, 0};
+    _root = EraseBatchIn(std::move(_root), 0, blocks.size(), 0, 0,
+                         state).first;
+    for (size_t i = state.pending; i < blocks.size(); ++i) {
+      state.neighbors[i].above_start = SIZE_MAX;
+    }
+    return std::move(state.neighbors);
+  }
+
+  // The end of the highest block (zero if there are no blocks).
+  size_t End() const { return Span(_root); }
+
+  // The total size of the blocks.
+  size_t Bytes() const { return _root ? _root->_bytes : 0; }
+
+  // The number of blocks.
+  size_t Count() const { return Count(_root); }
+
+  // What lies below an address (see `PrefixBelow`).
+  struct Prefix {
+    // The number and total size of the blocks that start below it.
+    size_t blocks;
+    size_t block_bytes;
+    // The allocated bytes below it, counting only the part of a block that
+    // straddles it.
+    size_t allocated;
+  };
+
+  // Summarizes the blocks below `address`, in O(log n) expected time, so the
+  // blocks in a range are summarized by two calls however many there are.
+  Prefix PrefixBelow(size_t address) const {
+    Prefix prefix{0, 0, 0};
+    const Node* node = _root.get();
+    size_t base = 0;
+    while (node) {
+      size_t start = base + Span(node->_left) + node->_gap;
+      if (address <= start) {
+        node = node->_left.get();
+        continue;
+      }
+      size_t left_bytes = node->_left ? node->_left->_bytes : 0;
+      prefix.blocks += Count(node->_left) + 1;
+      prefix.block_bytes += left_bytes + node->_size;
+      prefix.allocated +=
+          left_bytes + std::min(node->_size, address - start);
+      if (address <= start + node->_size) break;
+      base = start + node->_size;
+      node = node->_right.get();
+    }
+    return prefix;
+  }
+
+  // Returns the start of the lowest hole that fits `size`, or `std::nullopt`
+  // if no hole below `End()` does.
+  std::optional<size_t> LowestFit(size_t size) const {
+    auto found = FirstGapAtLeast(size, 0);
+    if (!found) return std::nullopt;
+    return found->hole_start;
+  }
+
+  // Returns the address that puts a block of `size` at the high end of the
+  // highest hole that fits it, or `std::nullopt` if no hole below `End()`
+  // does.
+  std::optional<size_t> HighestFit(size_t size) const {
+    auto found = LastGapAtLeast(size);
+    if (!found) return std::nullopt;
+    return found->start - size;
+  }
+
+  // Returns the first block that starts at or above `from` and has a hole
+  // of at least `size` right below it.
+  std::optional<Hole> FirstGapAtLeast(size_t size, size_t from) const {
+    assert(size > 0);
+    return FirstGapAtLeastIn(_root.get(), size, from, 0);
+  }
+
+  // Returns the last block with a hole of at least `size` right below it.
+  std::optional<Hole> LastGapAtLeast(size_t size) const {
+    assert(size > 0);
+    if (!_root || _root->_max_gap < size) return std::nullopt;
+    const Node* node = _root.get();
+    size_t base = 0;
+    while (true) {
+      size_t start = base + Span(node->_left) + node->_gap;
+      if (node->_right && node->_right->_max_gap >= size) {
+        base = start + node->_size;
+        node = node->_right.get();
+      } else if (node->_gap >= size) {
+        return Hole{start - node->_gap, start};
+      } else {
+        node = node->_left.get();
+      }
+    }
+  }
+
+  // Returns the block that starts at `start`, if there is one.
+  std::optional<Block> Find(size_t start) const {
+    const Node* node = _root.get();
+    size_t base = 0;
+    while (node) {
+      size_t node_start = base + Span(node->_left) + node->_gap;
+      if (start < node_start) {
+        node = node->_left.get();
+      } else if (start > node_start) {
+        base = node_start + node->_size;
+        node = node->_right.get();
+      } else {
+        return Block(node_start, node->_size);
+      }
+    }
+    return std::nullopt;
+  }
+
+  // The highest block, if any.
+  std::optional<Block> Last() const {
+    const Node* node = _root.get();
+    if (!node) return std::nullopt;
+    while (node->_right) node = node->_right.get();
+    return Block(End() - node->_size, node->_size);
+  }
+
+  // Moves the blocks in `[start, end)` so that they start at `new_start`,
+  // keeping their order and spacing.  `start` must be the start of a block,
+  // and `end` must be at or above the end of the last block in the range and
+  // no higher than the start of the next one.  The destination must be free,
+  // apart from the region's own old place.  Takes O(log n) expected time.
+  void MoveRegion(size_t start, size_t end, size_t new_start) {
+    assert(start < end);
+    if (new_start == start) return;
+    auto [below, rest] = Split(std::move(_root), start, 0);
+    auto [region, above] = Split(std::move(rest), end, Span(below));
+    assert(region && Span(below) + FirstGap(region) == start);
+    // The region's span, not counting the gap below it.
+    size_t span = Span(region) - FirstGap(region);
+    assert(start + span <= end);
+    if (above) {
+      SetFirstGap(above.get(), FirstGap(above) + Span(region));
+    }
+    auto [new_below, new_above] =
+        Split(Merge(std::move(below), std::move(above)), new_start, 0);
+    size_t prev_end = Span(new_below);
+    assert(prev_end <= new_start);
+    SetFirstGap(region.get(), new_start - prev_end);
+    if (new_above) {
+      size_t gap = FirstGap(new_above);
+      assert(prev_end + gap >= new_start + span);
+      SetFirstGap(new_above.get(), prev_end + gap - (new_start + span));
+    }
+    _root = Merge(Merge(std::move(new_below), std::move(region)),
+                  std::move(new_above));
+  }
+
+  // Applies `fun` to every block, in address order.
+  template <class Fun>
+  void ForAll(Fun fun) const {
+    ForAll(_root.get(), 0, fun);
+  }
+
+  // Writes the blocks to `writer`: the count, then the gap below and the size
+  // of each block, in address order.
+  void Save(CheckpointWriter& writer) const {
+    writer.Write(Count());
+    size_t end = 0;
+    ForAll([&](Block block) {
+      writer.Write(block.start() - end);
+      writer.Write(block.size());
+      end = block.end();
+    });
+  }
+
+  // Replaces the blocks with those saved by `Save`.  Stops early if `reader`
+  // fails.
+  void Restore(CheckpointReader& reader) {
+    _root.reset();
+    size_t count = reader.Read();
+    size_t end = 0;
+    for (size_t i = 0; i < count; ++i) {
+      size_t start = end + reader.Read();
+      size_t size = reader.Read();
+      if (!reader.Ok()) return;
+      Insert({start, size});
+      end = start + size;
+    }
+  }
+
+  // Checks the heap order and the subtree summaries.
+  void Validate() const {
+    Validate(_root.get(), SIZE_MAX);
+  }
+
+ private:
+  struct Node;
+  using Ptr = std::unique_ptr<Node>;
+
+  struct Node {
+    Node(size_t priority, size_t gap, size_t size)
+        :_priority(priority), _gap(gap), _size(size),
+         _span(gap + size), _max_gap(gap), _bytes(size), _count(1) {}
+    size_t _priority;
+    // The free space between the previous block and this one.
+    size_t _gap;
+    size_t _size;
+    // The sum of the gaps and sizes in this subtree.
+    size_t _span;
+    // The largest gap in this subtree.
+    size_t _max_gap;
+    // The sum of the sizes in this subtree.
+    size_t _bytes;
+    // The number of blocks in this subtree.
+    size_t _count;
+    Ptr _left;
+    Ptr _right;
+  };
+
+  static size_t Span(const Ptr& node) { return node ? node->_span : 0; }
+  static size_t Count(const Ptr& node) { return node ? node->_count : 0; }
+
+  static void Update(Node* node) {
+    node->_span = node->_gap + node->_size;
+    node->_max_gap = node->_gap;
+    node->_bytes = node->_size;
+    node->_count = 1;
+    for (const Ptr* child : {&node->_left, &node->_right}) {
+      if (*child) {
+        node->_span += (*child)->_span;
+        node->_max_gap = std::max(node->_max_gap, (*child)->_max_gap);
+        node->_bytes += (*child)->_bytes;
+        node->_count += (*child)->_count;
+      }
+    }
+  }
+
+  // Splits `node` (whose span begins at `base`) into the blocks that start
+  // below `address`, and the rest.  The first gap of the rest is still
+  // measured from the end of the first part.
+  static std::pair<Ptr, Ptr> Split(Ptr node, size_t address, size_t base) {
+    if (!node) return {};
+    size_t start = base + Span(node->_left) + node->_gap;
+    if (start < address) {
+      auto [left, right] = Split(std::move(node->_right), address,
+                                 start + node->_size);
+      node->_right = std::move(left);
+      Update(node.get());
+      return {std::move(node), std::move(right)};
+    } else {
+      auto [left, right] = Split(std::move(node->_left), address, base);
+      node->_left = std::move(right);
+      Update(node.get());
+      return {std::move(left), std::move(node)};
+    }
+  }
+
+  // The progress of `EraseBatch` through the blocks, in address order.
+  struct BatchState {
+    std::span<const Block> blocks;
+    std::vector<Neighbors> neighbors;
+    // The end of the last block seen that stays.
+    size_t prev_end;
+    // The blocks from here on don't know what stays above them yet.
+    size_t pending;
+  };
+
+  // Tells the pending blocks that a block that stays starts at `start`.
+  static void SeenStaying(BatchState& state, size_t start, size_t end,
+                          size_t next) {
+    for (; state.pending < next; ++state.pending) {
+      state.neighbors[state.pending].above_start = start;
+    }
+    state.prev_end = end;
+  }
+
+  // Erases `state.blocks[first, last)` from `node`, whose span begins at
+  // `base`, and adds `carry` to the gap of its first block that stays.
+  // Returns the new subtree, and how much to add to the gap of the block
+  // after it (`carry` and the space of erased blocks at its end).
+  static std::pair<Ptr, size_t> EraseBatchIn(Ptr node, size_t first,
+                                             size_t last, size_t base,
+                                             size_t carry, BatchState& state) {
+    if (!node) {
+      assert(first == last);
+      return {nullptr, carry};
+    }
+    if (first == last) {
+      SeenStaying(state, base + FirstGap(node), base + node->_span, first);
+      if (carry > 0) SetFirstGap(node.get(), FirstGap(node) + carry);
+      return {std::move(node), 0};
+    }
+    size_t start = base + Span(node->_left) + node->_gap;
+    size_t end = start + node->_size;
+    const Block* blocks = state.blocks.data();
+    size_t middle = static_cast<size_t>(
+        std::lower_bound(blocks + first, blocks + last, Block(start, 0),
+                         [](Block a, Block b) {
+                           return a.start() < b.start();
+                         }) - blocks);
+    bool erased = middle < last && blocks[middle].start() == start;
+    assert(!erased || blocks[middle].size() == node->_size);
+    auto [left, left_carry] = EraseBatchIn(std::move(node->_left), first,
+                                           middle, base, carry, state);
+    size_t right_first = middle;
+    if (erased) {
+      state.neighbors[middle].below_end = state.prev_end;
+      left_carry += node->_gap + node->_size;
+      ++right_first;
+    } else {
+      SeenStaying(state, start, end, middle);
+      node->_gap += left_carry;
+      left_carry = 0;
+    }
+    auto [right, right_carry] = EraseBatchIn(std::move(node->_right),
+                                             right_first, last, end,
+                                             left_carry, state);
+    if (erased) {
+      return {Merge(std::move(left), std::move(right)), right_carry};
+    }
+    node->_left = std::move(left);
+    node->_right = std::move(right);
+    Update(node.get());
+    return {std::move(node), right_carry};
+  }
+
+  // Concatenates `a` and `b`.
+  static Ptr Merge(Ptr a, Ptr b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->_priority > b->_priority) {
+      a->_right = Merge(std::move(a->_right), std::move(b));
+      Update(a.get());
+      return a;
+    } else {
+      b->_left = Merge(std::move(a), std::move(b->_left));
+      Update(b.get());
+      return b;
+    }
+  }
+
+  // The gap below the first block of `node`.
+  static size_t FirstGap(const Ptr& node) {
+    const Node* first = node.get();
+    while (first->_left) first = first->_left.get();
+    return first->_gap;
+  }
+
+  static void SetFirstGap(Node* node, size_t gap) {
+    if (node->_left) {
+      SetFirstGap(node->_left.get(), gap);
+    } else {
+      node->_gap = gap;
+    }
+    Update(node);
+  }
+
+  // `FirstGapAtLeast` for the subtree `node`, whose span begins at `base`.
+  // Only the subtrees that straddle `from` can fail after being searched, so
+  // this takes O(log n) expected time.
+  static std::optional<Hole> FirstGapAtLeastIn(const Node* node, size_t size,
+                                               size_t from, size_t base) {
+    while (node && node->_max_gap >= size) {
+      size_t start = base + Span(node->_left) + node->_gap;
+      if (start < from) {
+        base = start + node->_size;
+        node = node->_right.get();
+      } else if (node->_left && node->_left->_max_gap >= size &&
+                 base + node->_left->_span > from) {
+        if (auto found = FirstGapAtLeastIn(node->_left.get(), size, from,
+                                           base)) {
+          return found;
+        }
+        if (node->_gap >= size) return Hole{start - node->_gap, start};
+        base = start + node->_size;
+        node = node->_right.get();
+      } else if (node->_gap >= size) {
+        return Hole{start - node->_gap, start};
+      } else {
+        base = start + node->_size;
+        node = node->_right.get();
+      }
+    }
+    return std::nullopt;
+  }
+
+  template <class Fun>
+  static size_t ForAll(const Node* node, size_t base, Fun& fun) {
+    while (node) {
+      base = ForAll(node->_left.get(), base, fun);
+      base += node->_gap;
+      fun(Block(base, node->_size));
+      base += node->_size;
+      node = node->_right.get();
+    }
+    return base;
+  }
+
+  static void Validate(const Node* node, size_t max_priority) {
+    if (!node) return;
+    assert(node->_priority <= max_priority);
+    Validate(node->_left.get(), node->_priority);
+    Validate(node->_right.get(), node->_priority);
+    Node expected(node->_priority, node->_gap, node->_size);
+    for (const Ptr* child : {&node->_left, &node->_right}) {
+      if (*child) {
+        expected._span += (*child)->_span;
+        expected._max_gap = std::max(expected._max_gap, (*child)->_max_gap);
+        expected._bytes += (*child)->_bytes;
+        expected._count += (*child)->_count;
+      }
+    }
+    assert(node->_span == expected._span);
+    assert(node->_max_gap == expected._max_gap);
+    assert(node->_bytes == expected._bytes);
+    assert(node->_count == expected._count);
+  }
+
+  Ptr _root;
+  std::random_device _device;
+  std::default_random_engine _engine{_device()};
+  std::uniform_int_distribution<size_t> _uniform_distribution;
+};
+
+#endif  // BLOCK_LAYOUT_H_
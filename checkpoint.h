@@ -0,0 +1,172 @@
+/* Checkpoint files, so that a simulation that runs for hours can be restarted
+ * where it left off.
+ *
+ * A checkpoint is a stream of unsigned LEB128 varints (and raw doubles),
+ * written and read sequentially through a 64KiB buffer and a `FILE*`, so
+ * saving never builds the whole image in memory.  Whatever is saved writes
+ * its own fields; the file has no schema beyond a magic number and a
+ * version, and is read back by the same code in the same order.  Most of
+ * what's saved is small numbers (gaps, sizes and time differences), which
+ * take a byte or two each.
+ *
+ * Errors (a failed write, a short or corrupt file) make the writer or reader
+ * not `Ok()`, and the reader then returns zeros.  The caller checks once at
+ * the end.  `WriteCheckpointFile` writes to a temporary file and renames it,
+ * so a crash while checkpointing leaves the previous checkpoint intact.
+ */
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <unistd.h>
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+class CheckpointWriter {
+ public:
+  explicit CheckpointWriter(FILE* file) :_file(file) {
+    WriteRaw(kMagic);
+    Write(kVersion);
+  }
+
+  CheckpointWriter(const CheckpointWriter&) = delete;
+  CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+  ~CheckpointWriter() { Flush(); }
+
+  void Write(uint64_t value) {
+    if (_used + kMaxVarint > kBufferSize) Flush();
+    while (value >= 0x80) {
+      _buffer[_used++] = static_cast<unsigned char>(value | 0x80);
+      value >>= 7;
+    }
+    _buffer[_used++] = static_cast<unsigned char>(value);
+  }
+
+  void WriteDouble(double value) { WriteRaw(std::bit_cast<uint64_t>(value)); }
+
+  // Hands what's buffered to the `FILE*`.
+  void Flush() {
+    if (_used > 0 && std::fwrite(_buffer, 1, _used, _file) != _used) {
+      _ok = false;
+    }
+    _used = 0;
+  }
+
+  // Whether everything so far was written (after a `Flush`).
+  bool Ok() const { return _ok && !std::ferror(_file); }
+
+ private:
+  friend class CheckpointReader;
+  static constexpr uint64_t kMagic = 0x544e494f50464646;  // "FFFPOINT"
+  static constexpr uint64_t kVersion = 5;
+  static constexpr size_t kBufferSize = 1 << 16;
+  static constexpr size_t kMaxVarint = 10;
+
+  // Little-endian, whatever the machine.
+  void WriteRaw(uint64_t value) {
+    if (_used + 8 > kBufferSize) Flush();
+    for (int i = 0; i < 8; ++i) {
+      _buffer[_used++] = static_cast<unsigned char>(value);
+      value >>= 8;
+    }
+  }
+
+  FILE* _file;
+  bool _ok = true;
+  size_t _used = 0;
+  unsigned char _buffer[kBufferSize];
+};
+
+class CheckpointReader {
+ public:
+  explicit CheckpointReader(FILE* file) :_file(file) {
+    if (ReadRaw() != CheckpointWriter::kMagic ||
+        Read() != CheckpointWriter::kVersion) {
+      _ok = false;
+    }
+  }
+
+  CheckpointReader(const CheckpointReader&) = delete;
+  CheckpointReader& operator=(const CheckpointReader&) = delete;
+
+  uint64_t Read() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint64_t byte = Byte();
+      value |= (byte & 0x7f) << shift;
+      if (byte < 0x80) return value;
+    }
+    _ok = false;
+    return 0;
+  }
+
+  double ReadDouble() { return std::bit_cast<double>(ReadRaw()); }
+
+  bool Ok() const { return _ok; }
+
+ private:
+  uint64_t Byte() {
+    if (_next == _end) {
+      _next = 0;
+      _end = _ok ? std::fread(_buffer, 1, sizeof(_buffer), _file) : 0;
+      if (_end == 0) {
+        _ok = false;
+        return 0;
+      }
+    }
+    return _buffer[_next++];
+  }
+
+  uint64_t ReadRaw() {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) value |= Byte() << (8 * i);
+    return value;
+  }
+
+  FILE* _file;
+  bool _ok = true;
+  size_t _next = 0;
+  size_t _end = 0;
+  unsigned char _buffer[CheckpointWriter::kBufferSize];
+};
+
+// Writes a checkpoint to `path` with `save(writer)`, atomically: the new file
+// replaces the old one only once it's complete and on disk.  Returns false
+// (leaving any old checkpoint alone) on failure.
+template <class Save>
+bool WriteCheckpointFile(const std::string& path, Save save) {
+  std::string temporary = path + ".tmp";
+  FILE* file = std::fopen(temporary.c_str(), "wb");
+  if (!file) return false;
+  // On the heap, since it holds a buffer.
+  auto writer = std::make_unique<CheckpointWriter>(file);
+  save(*writer);
+  writer->Flush();
+  bool ok = writer->Ok() && std::fflush(file) == 0 &&
+            fsync(fileno(file)) == 0;
+  ok = std::fclose(file) == 0 && ok;
+  if (ok) ok = std::rename(temporary.c_str(), path.c_str()) == 0;
+  if (!ok) std::remove(temporary.c_str());
+  return ok;
+}
+
+// Reads the checkpoint at `path` with `restore(reader)`.  Returns false if
+// there's no such file, or it's short or corrupt.
+template <class Restore>
+bool ReadCheckpointFile(const std::string& path, Restore restore) {
+  FILE* file = std::fopen(path.c_str(), "rb");
+  if (!file) return false;
+  auto reader = std::make_unique<CheckpointReader>(file);
+  if (reader->Ok()) restore(*reader);
+  bool ok = reader->Ok();
+  std::fclose(file);
+  return ok;
+}
+
+#endif  // CHECKPOINT_H_
@@ -0,0 +1,175 @@
+#include "checkpoint.h"
+
+#include "first_fit.h"
+#include "long_run.h"
+#include "simulator.h"
+
+#include <cassert>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Returns what `save(writer)` writes.
+template <class Save>
+static std::string Saved(Save save) {
+  FILE* file = std::tmpfile();
+  assert(file);
+  {
+    CheckpointWriter writer(file);
+    save(writer);
+    assert(writer.Ok());
+  }
+  std::string result(static_cast<size_t>(std::ftell(file)), '\0');
+  std::rewind(file);
+  assert(std::fread(result.data(), 1, result.size(), file) == result.size());
+  std::fclose(file);
+  return result;
+}
+
+// Calls `restore(reader)` on `bytes`, and returns whether the reader is ok.
+template <class Restore>
+static bool Restored(const std::string& bytes, Restore restore) {
+  FILE* file = std::tmpfile();
+  assert(file);
+  std::fwrite(bytes.data(), 1, bytes.size(), file);
+  std::rewind(file);
+  CheckpointReader reader(file);
+  restore(reader);
+  bool ok = reader.Ok();
+  std::fclose(file);
+  return ok;
+}
+
+static void VarintTest() {
+  const std::vector<uint64_t> values = {0, 1, 127, 128, 300, 1ul << 36,
+                                        UINT64_MAX};
+  std::string bytes = Saved([&](CheckpointWriter& writer) {
+    for (uint64_t value : values) writer.Write(value);
+    writer.WriteDouble(-0.125);
+  });
+  // The magic number and version, then 1 + 1 + 1 + 2 + 2 + 6 + 10 bytes,
+  // then the double.
+  assert(bytes.size() == 9 + 23 + 8);
+  assert(Restored(bytes, [&](CheckpointReader& reader) {
+    for (uint64_t value : values) assert(reader.Read() == value);
+    assert(reader.ReadDouble() == -0.125);
+  }));
+  // A short file fails, and so does one that isn't a checkpoint.
+  assert(!Restored(bytes.substr(0, bytes.size() - 1),
+                   [&](CheckpointReader& reader) {
+                     for (size_t i = 0; i < values.size(); ++i) reader.Read();
+                     reader.ReadDouble();
+                   }));
+  assert(!Restored("not a checkpoint", [](CheckpointReader&) {}));
+}
+
+static void WorkloadStreamSeekTest() {
+  WorkloadStream stream({0.9, 100, 10'000}, 1'000, 1);
+  std::vector<Request> requests;
+  for (size_t i = 0; i < 3 * WorkloadStream::kBatch; ++i) {
+    assert(stream.Position() == i);
+    requests.push_back(stream.Next());
+  }
+  for (size_t position : {size_t(0), size_t(1), WorkloadStream::kBatch - 1,
+                          WorkloadStream::kBatch, size_t(10'000)}) {
+    stream.Seek(position);
+    assert(stream.Position() == position);
+    Request request = stream.Next();
+    assert(request.size == requests[position].size);
+    assert(request.lifetime == requests[position].lifetime);
+  }
+}
+
+// A run restored from a checkpoint ends up the same as one that never
+// stopped.
+static void LongRunTest() {
+  constexpr size_t kEvents = 30'000;
+  auto make = []() {
+    return std::make_unique<LongRun>(Hyperexponential{0.9, 100, 10'000},
+                                     1'000, 7);
+  };
+  auto straight = make();
+  for (size_t i = 0; i < kEvents; ++i) straight->Step();
+
+  std::unique_ptr<LongRun> run = make();
+  for (size_t stop : {size_t(5'000), size_t(12'345), size_t(20'000)}) {
+    while (run->Events() < stop) run->Step();
+    std::string checkpoint =
+        Saved([&](CheckpointWriter& writer) { run->Save(writer); });
+    std::unique_ptr<LongRun> restored;
+    assert(Restored(checkpoint, [&](CheckpointReader& reader) {
+      restored = LongRun::Restore(reader);
+    }));
+    assert(restored && restored->Events() == stop);
+    run = std::move(restored);
+  }
+  while (run->Events() < kEvents) run->Step();
+
+  auto allocator = [](const LongRun& r) {
+    return Saved([&](CheckpointWriter& writer) {
+      r.Allocator().Save(writer);
+    });
+  };
+  assert(allocator(*run) == allocator(*straight));
+  assert(run->MaxLive() == straight->MaxLive());
+  assert(run->MeanLive() == straight->MeanLive());
+  // The sketches flip the same coins, apart from the timings.
+  for (double q : {0.1, 0.5, 0.9, 0.99}) {
+    assert(run->BlockSizes().Quantile(q) == straight->BlockSizes().Quantile(q));
+    assert(run->HoleSizes().Quantile(q) == straight->HoleSizes().Quantile(q));
+  }
+  assert(run->StepTimes().Count() == kEvents);
+  // A truncated checkpoint is rejected.
+  std::string checkpoint =
+      Saved([&](CheckpointWriter& writer) { run->Save(writer); });
+  assert(!Restored(checkpoint.substr(0, checkpoint.size() / 2),
+                   [](CheckpointReader& reader) {
+                     assert(!LongRun::Restore(reader));
+                   }));
+}
+
+// With batched frees, where a batch ends among the blocks that die at one
+// tick decides which holes the next allocation sees, so a restored simulation
+// must free them in the same order as the original.
+static void BatchedFreeTest() {
+  constexpr size_t kEvents = 20'000;
+  auto step = [](Simulator<FirstFit>& simulator, size_t i) {
+    simulator.AdvanceTo(i);
+    // Short random lifetimes, so that several blocks often die at one tick.
+    uint64_t hash = (i + 1) * 0x9e3779b97f4a7c15;
+    hash ^= hash >> 29;
+    return simulator.Allocate(16 + hash % 500, 1 + (hash >> 20) % 30).start();
+  };
+  FirstFit straight_ff(7);
+  Simulator<FirstFit> straight(straight_ff);
+  std::vector<size_t> starts;
+  for (size_t i = 0; i < kEvents; ++i) starts.push_back(step(straight, i));
+
+  auto ff = std::make_unique<FirstFit>(7);
+  auto simulator = std::make_unique<Simulator<FirstFit>>(*ff);
+  size_t i = 0;
+  for (size_t stop : {size_t(3'001), size_t(9'995), size_t(15'000), kEvents}) {
+    for (; i < stop; ++i) assert(step(*simulator, i) == starts[i]);
+    std::string checkpoint = Saved([&](CheckpointWriter& writer) {
+      ff->Save(writer);
+      simulator->Save(writer);
+    });
+    auto restored_ff = std::make_unique<FirstFit>(7);
+    auto restored = std::make_unique<Simulator<FirstFit>>(*restored_ff);
+    assert(Restored(checkpoint, [&](CheckpointReader& reader) {
+      restored_ff->Restore(reader);
+      restored->Restore(reader);
+    }));
+    simulator = std::move(restored);
+    ff = std::move(restored_ff);
+  }
+  assert(ff->get_high_water() == straight_ff.get_high_water());
+}
+
+int main() {
+  VarintTest();
+  WorkloadStreamSeekTest();
+  LongRunTest();
+  BatchedFreeTest();
+}
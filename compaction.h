@@ -0,0 +1,107 @@
+/* Compaction of a `BlockLayout`: moves blocks to lower addresses, to measure
+ * how much memory a compacting collector would get back and how many bytes it
+ * would have to copy to do so.
+ *
+ * Blocks are moved a region at a time, where a region is a run of blocks with
+ * no free space between them.  Moving a region takes O(log n) expected time
+ * however many blocks are in it (see `BlockLayout::MoveRegion`), so a pass
+ * costs O(log n) per region moved.  The caller gets the moves as a list of
+ * `Relocation`s to apply to its own pointers.
+ */
+
+#ifndef COMPACTION_H_
+#define COMPACTION_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "block_layout.h"
+
+enum class CompactionMode {
+  // Slides every region down against the one below it, so no free space is
+  // left (as in a mark-compact collector).
+  kSliding,
+  // Like `kSliding`, but only for the regions that are inside the window
+  // `[window_start, window_end)`, which slide no lower than `window_start`.
+  kWindowed,
+  // Repeatedly moves the highest region into the lowest hole that fits it,
+  // or if none does, moves just the highest block.  Stops when the highest
+  // block doesn't fit any lower hole.  This only moves what's at the top, so
+  // it copies less than sliding, but may leave holes.
+  kHoleTargeted,
+};
+
+struct CompactionOptions {
+  CompactionMode mode = CompactionMode::kSliding;
+  // For `kWindowed`.
+  size_t window_start = 0;
+  size_t window_end = SIZE_MAX;
+};
+
+// The bytes at `[old_start, old_start + size)` were moved to `new_start`.
+struct Relocation {
+  size_t old_start;
+  size_t new_start;
+  size_t size;
+};
+
+struct CompactionResult {
+  // The moves, which must be applied in order: a later one may move bytes
+  // that an earlier one moved.
+  std::vector<Relocation> relocations;
+  size_t bytes_moved = 0;
+  // `End()` before and after.
+  size_t end_before = 0;
+  size_t end_after = 0;
+};
+
+inline CompactionResult Compact(BlockLayout& blocks,
+                                const CompactionOptions& options) {
+  CompactionResult result;
+  result.end_before = blocks.End();
+  auto move = [&](size_t start, size_t end, size_t new_start) {
+    blocks.MoveRegion(start, end, new_start);
+    result.relocations.push_back({start, new_start, end - start});
+    result.bytes_moved += end - start;
+  };
+  if (options.mode == CompactionMode::kHoleTargeted) {
+    // `top` is the first block of the highest region.
+    while (auto top = blocks.LastGapAtLeast(1)) {
+      size_t end = blocks.End();
+      if (auto hole = blocks.LowestFit(end - top->start)) {
+        move(top->start, end, *hole);
+        continue;
+      }
+      Block last = *blocks.Last();
+      std::optional<size_t> hole = blocks.LowestFit(last.size());
+      if (!hole) break;
+      move(last.start(), last.end(), *hole);
+    }
+  } else {
+    bool windowed = options.mode == CompactionMode::kWindowed;
+    size_t window_start = windowed ? options.window_start : 0;
+    size_t window_end = windowed ? options.window_end : SIZE_MAX;
+    assert(window_start <= window_end);
+    // Everything below `from` is done.
+    size_t from = window_start;
+    while (auto hole = blocks.FirstGapAtLeast(1, from)) {
+      if (hole->start >= window_end) break;
+      auto next = blocks.FirstGapAtLeast(1, hole->start + 1);
+      size_t end = next ? next->hole_start : blocks.End();
+      if (end > window_end) break;
+      size_t new_start = std::max(hole->hole_start, window_start);
+      if (new_start < hole->start) {
+        move(hole->start, end, new_start);
+      }
+      from = new_start + (end - hole->start);
+    }
+  }
+  result.end_after = blocks.End();
+  return result;
+}
+
+#endif  // COMPACTION_H_
@@ -0,0 +1,120 @@
+#include "compaction.h"
+
+#include <map>
+#include <random>
+#include <vector>
+
+// Returns the blocks of `layout`, as a map from start to size.
+static std::map<size_t, size_t> Contents(const BlockLayout& layout) {
+  std::map<size_t, size_t> result;
+  layout.ForAll([&](Block block) { result[block.start()] = block.size(); });
+  return result;
+}
+
+// Applies `relocations` to `blocks` (a map from start to size), the way a
+// caller would update its pointers.
+static void Apply(const std::vector<Relocation>& relocations,
+                  std::map<size_t, size_t>& blocks) {
+  for (const Relocation& r : relocations) {
+    std::vector<std::pair<size_t, size_t>> moved;
+    auto it = blocks.lower_bound(r.old_start);
+    while (it != blocks.end() && it->first < r.old_start + r.size) {
+      assert(it->first + it->second <= r.old_start + r.size);
+      moved.emplace_back(it->first - r.old_start + r.new_start, it->second);
+      it = blocks.erase(it);
+    }
+    assert(!moved.empty());
+    for (const auto& [start, size] : moved) {
+      assert(blocks.insert({start, size}).second);
+    }
+  }
+}
+
+static void MoveRegionTest() {
+  BlockLayout layout;
+  layout.Insert({10, 5});
+  layout.Insert({15, 5});
+  layout.Insert({40, 10});
+  layout.Insert({60, 1});
+  assert(layout.End() == 61);
+  assert(layout.Bytes() == 21);
+  // Slide [10, 20) down to 0, and [40, 50) into the hole below 60.
+  layout.MoveRegion(10, 20, 0);
+  layout.MoveRegion(40, 50, 50);
+  assert((Contents(layout) ==
+          std::map<size_t, size_t>{{0, 5}, {5, 5}, {50, 10}, {60, 1}}));
+  // Move the top block into the lowest hole.
+  layout.MoveRegion(60, 61, 10);
+  assert((Contents(layout) ==
+          std::map<size_t, size_t>{{0, 5}, {5, 5}, {10, 1}, {50, 10}}));
+  assert(layout.End() == 60);
+  assert(layout.LowestFit(39).value() == 11);
+  assert(!layout.LowestFit(40));
+  assert(layout.HighestFit(2).value() == 48);
+  layout.Validate();
+}
+
+static void CompactTest() {
+  std::default_random_engine engine(3);
+  std::uniform_int_distribution<size_t> size_distribution(1, 50);
+  for (CompactionMode mode : {CompactionMode::kSliding,
+                              CompactionMode::kWindowed,
+                              CompactionMode::kHoleTargeted}) {
+    for (int trial = 0; trial < 50; ++trial) {
+      // Allocate blocks end to end and free about half of them.
+      BlockLayout layout;
+      std::map<size_t, size_t> expected;
+      size_t end = 0;
+      for (int i = 0; i < 200; ++i) {
+        size_t size = size_distribution(engine);
+        if (engine() % 2) {
+          layout.Insert({end, size});
+          expected[end] = size;
+        }
+        end += size;
+      }
+      CompactionOptions options;
+      options.mode = mode;
+      if (mode == CompactionMode::kWindowed) {
+        options.window_start = end / 4;
+        options.window_end = end / 2;
+      }
+      CompactionResult result = Compact(layout, options);
+      layout.Validate();
+      std::map<size_t, size_t> before = expected;
+      Apply(result.relocations, expected);
+      assert(Contents(layout) == expected);
+      size_t bytes_moved = 0;
+      for (const Relocation& r : result.relocations) bytes_moved += r.size;
+      assert(result.bytes_moved == bytes_moved);
+      assert(result.end_after == layout.End());
+      assert(result.end_after <= result.end_before);
+      switch (mode) {
+        case CompactionMode::kSliding:
+          assert(layout.End() == layout.Bytes());
+          break;
+        case CompactionMode::kWindowed:
+          // Nothing outside the window moved.
+          for (const auto& [start, size] : before) {
+            if (start + size <= options.window_start ||
+                start >= options.window_end) {
+              assert(expected.count(start) && expected[start] == size);
+            }
+          }
+          break;
+        case CompactionMode::kHoleTargeted: {
+          // The highest block doesn't fit lower down.
+          Block last = layout.Last().value();
+          auto hole = layout.LowestFit(last.size());
+          assert(!hole || *hole >= last.start());
+          break;
+        }
+      }
+    }
+  }
+}
+
+int main() {
+  MoveRegionTest();
+  CompactTest();
+}
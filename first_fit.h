@@ -0,0 +1,197 @@
+/* Allocators for the fitness experiments.  They only do the bookkeeping of
+ * where blocks go: addresses are offsets into an unbounded address space, and
+ * the figure of merit is the high-water mark.
+ *
+ * `FirstFit` puts each block at the lowest address where it fits.
+ * `TwoEndedFit` tests Shore's conjecture that first fit does well because
+ * large blocks drift to high addresses: it puts small blocks first fit, and
+ * large blocks (or any block the caller says to, for example because it will
+ * live long) at the high end of the highest hole that fits ("last fit").
+ *
+ * The allocated blocks are kept in a `BlockLayout`, so the lowest and the
+ * highest hole that fits are both found in O(log n) expected time, and the
+ * blocks can be compacted (see `compaction.h`).  Both also count the pages
+ * and huge pages that hold live bytes (see `residency.h`).
+ */
+
+#ifndef FIRST_FIT_H_
+#define FIRST_FIT_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "block_layout.h"
+#include "compaction.h"
+#include "residency.h"
+
+class FirstFit {
+ public:
+  // With a `free_batch` above 1, frees are deferred: they are kept in a
+  // buffer, and every `free_batch` of them are sorted by address and taken
+  // out of the layout in one pass (`BlockLayout::EraseBatch`).  Until then
+  // their space can't be reused, which is what that costs.
+  explicit FirstFit(size_t free_batch = 1) :_free_batch(free_batch) {
+    assert(free_batch > 0);
+  }
+
+  // Places a block of `size` (which must be positive: a zero-size block has
+  // no address of its own in the layout) in the lowest hole that fits it.
+  Block Alloc(size_t size) {
+    assert(size > 0);
+    Block block{_blocks.LowestFit(size).value_or(_blocks.End()), size};
+    _residency.Insert(block, _blocks.Insert(block));
+    _high_water = std::max(_high_water, block.end());
+    return block;
+  }
+  void Free(Block block) {
+    if (_free_batch == 1) {
+      _residency.Erase(block, _blocks.Erase(block));
+      return;
+    }
+    _pending_frees.push_back(block);
+    if (_pending_frees.size() == _free_batch) FlushFrees();
+  }
+  // Applies the deferred frees now.
+  void FlushFrees() {
+    if (_pending_frees.empty()) return;
+    std::sort(_pending_frees.begin(), _pending_frees.end());
+    _residency.EraseBatch(_pending_frees, _blocks.EraseBatch(_pending_frees));
+    _pending_frees.clear();
+  }
+  size_t get_high_water() const {
+    return _high_water;
+  }
+  // The pages and huge pages that hold live bytes (counting deferred frees),
+  // now and at most.
+  const Residency& get_residency() const {
+    return _residency;
+  }
+  // The allocated blocks (not counting deferred frees as freed).
+  const BlockLayout& get_blocks() const {
+    return _blocks;
+  }
+  // Compacts the blocks (see `Compact`), and lowers the high-water mark to
+  // the new end, as if the memory above it had been given back.
+  CompactionResult Compact(const CompactionOptions& options) {
+    FlushFrees();
+    CompactionResult result = ::Compact(_blocks, options);
+    _high_water = result.end_after;
+    _residency.Recount(_blocks);
+    return result;
+  }
+  // Applies `fun(size)` to the size of every hole below the high-water mark,
+  // in address order, in O(n) time.
+  template <class Fun>
+  void ForAllHoles(Fun fun) const {
+    size_t end = 0;
+    _blocks.ForAll([&](Block block) {
+      if (block.start() > end) fun(block.start() - end);
+      end = block.end();
+    });
+    if (_high_water > end) fun(_high_water - end);
+  }
+  // Saves or restores the blocks, the high-water mark, the page counts and
+  // the deferred frees.  The batch size isn't saved.
+  void Save(CheckpointWriter& writer) const {
+    writer.Write(_high_water);
+    _residency.Save(writer);
+    _blocks.Save(writer);
+    writer.Write(_pending_frees.size());
+    for (const Block& block : _pending_frees) {
+      writer.Write(block.start());
+      writer.Write(block.size());
+    }
+  }
+  void Restore(CheckpointReader& reader) {
+    _high_water = reader.Read();
+    _residency.Restore(reader);
+    _blocks.Restore(reader);
+    _pending_frees.clear();
+    size_t count = reader.Read();
+    for (size_t i = 0; i < count; ++i) {
+      size_t start = reader.Read();
+      size_t size = reader.Read();
+      if (!reader.Ok()) return;
+      _pending_frees.emplace_back(start, size);
+    }
+  }
+ private:
+  BlockLayout _blocks;
+  size_t _free_batch;
+  std::vector<Block> _pending_frees;
+  size_t _high_water = 0;
+  Residency _residency;
+};
+
+class TwoEndedFit {
+ public:
+  // Which end of the free space a block goes to.
+  enum class End { kLow, kHigh };
+
+  // Blocks of at least `size_threshold` go to the high end (unless the caller
+  // says otherwise).
+  explicit TwoEndedFit(size_t size_threshold = SIZE_MAX)
+      :_size_threshold(size_threshold) {}
+
+  Block Alloc(size_t size) {
+    return Alloc(size, size >= _size_threshold ? End::kHigh : End::kLow);
+  }
+
+  // Puts the block at the given `end`, for a caller who knows better than the
+  // size threshold (for example from a lifetime hint).  Like
+  // `FirstFit::Alloc`, `size` must be positive.
+  Block Alloc(size_t size, End end) {
+    assert(size > 0);
+    std::optional<size_t> start = end == End::kLow ? _blocks.LowestFit(size)
+                                                   : _blocks.HighestFit(size);
+    Block block{start.value_or(_blocks.End()), size};
+    _residency.Insert(block, _blocks.Insert(block));
+    _high_water = std::max(_high_water, block.end());
+    return block;
+  }
+
+  void Free(Block block) {
+    _residency.Erase(block, _blocks.Erase(block));
+  }
+  size_t get_high_water() const {
+    return _high_water;
+  }
+  // The pages and huge pages that hold live bytes, now and at most.
+  const Residency& get_residency() const {
+    return _residency;
+  }
+  const BlockLayout& get_blocks() const {
+    return _blocks;
+  }
+  // Like `FirstFit::Compact`.
+  CompactionResult Compact(const CompactionOptions& options) {
+    CompactionResult result = ::Compact(_blocks, options);
+    _high_water = result.end_after;
+    _residency.Recount(_blocks);
+    return result;
+  }
+  // Like `FirstFit::Save` and `FirstFit::Restore`.  The size threshold isn't
+  // saved: it's up to the caller to construct with the same one.
+  void Save(CheckpointWriter& writer) const {
+    writer.Write(_high_water);
+    _residency.Save(writer);
+    _blocks.Save(writer);
+  }
+  void Restore(CheckpointReader& reader) {
+    _high_water = reader.Read();
+    _residency.Restore(reader);
+    _blocks.Restore(reader);
+  }
+
+ private:
+  BlockLayout _blocks;
+  size_t _size_threshold;
+  size_t _high_water = 0;
+  Residency _residency;
+};
+
+#endif  // FIRST_FIT_H_
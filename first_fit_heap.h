@@ -0,0 +1,157 @@
+/* A real first-fit heap: `FirstFit` placement over a region of address space
+ * reserved with `mmap`.
+ *
+ * The free space is indexed by a `BlockLayout`, which lives in ordinary
+ * memory (allocated with `new`), not in the managed region, so a block has no
+ * header and the region holds nothing but user data.  Freeing a large block
+ * gives its pages back with `madvise`, so the resident set tracks what first
+ * fit actually uses.
+ *
+ * `FirstFitHeap` isn't thread safe.  `first_fit_malloc.cc` wraps one in a lock
+ * to provide `malloc` and friends.
+ */
+
+#ifndef FIRST_FIT_HEAP_H_
+#define FIRST_FIT_HEAP_H_
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <optional>
+
+#include "block_layout.h"
+
+class FirstFitHeap {
+ public:
+  // Every block is aligned to (and a multiple of) this.
+  static constexpr size_t kAlignment = 16;
+  // Freeing a block of at least this many bytes releases its pages.
+  static constexpr size_t kReleaseThreshold = 64 << 10;
+
+  // Reserves `reserve` bytes of address space.  If that fails, `Allocate`
+  // always returns null.
+  explicit FirstFitHeap(size_t reserve) :_reserve(reserve) {
+    void* base = mmap(nullptr, reserve, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+      _reserve = 0;
+    } else {
+      _base = static_cast<char*>(base);
+    }
+  }
+
+  FirstFitHeap(const FirstFitHeap&) = delete;
+  FirstFitHeap& operator=(const FirstFitHeap&) = delete;
+
+  ~FirstFitHeap() {
+    if (_base) munmap(_base, _reserve);
+  }
+
+  // Returns true if `p` points into the region.
+  bool Contains(const void* p) const {
+    const char* c = static_cast<const char*>(p);
+    return _base && std::greater_equal<>()(c, _base) &&
+           std::less<>()(c, _base + _reserve);
+  }
+
+  // Returns `size` bytes (at least one) aligned to `alignment`, which must be
+  // a power of two.  Returns null if the region is full.
+  void* Allocate(size_t size, size_t alignment = kAlignment) {
+    if (size > _reserve) return nullptr;
+    size = RoundUp(std::max(size, size_t(1)), kAlignment);
+    alignment = std::max(alignment, kAlignment);
+    size_t start;
+    if (alignment == kAlignment) {
+      start = _blocks.LowestFit(size).value_or(_blocks.End());
+    } else {
+      // Any hole with room for `alignment - kAlignment` bytes of padding
+      // fits.  That may pass over a smaller hole that happens to be aligned.
+      auto hole = _blocks.FirstGapAtLeast(size + alignment - kAlignment, 0);
+      start = AlignOffset(hole ? hole->hole_start : _blocks.End(), alignment);
+    }
+    if (start + size > _reserve) return nullptr;
+    _blocks.Insert({start, size});
+    return _base + start;
+  }
+
+  // Frees `p`, which must have come from `Allocate` (or be null).
+  void Free(void* p) {
+    if (!p) return;
+    Block block = Find(p);
+    _blocks.Erase(block);
+    if (block.size() >= kReleaseThreshold) {
+      Release(block);
+    }
+  }
+
+  // Like `realloc`: resizes `p` (which may be null) to `size` bytes, moving
+  // it if need be.  Shrinks in place.  Returns null (leaving `p` alone) if
+  // the region is full.
+  void* Reallocate(void* p, size_t size) {
+    if (!p) return Allocate(size);
+    Block block = Find(p);
+    size_t new_size = RoundUp(std::max(size, size_t(1)), kAlignment);
+    if (new_size <= block.size()) {
+      _blocks.Erase(block);
+      _blocks.Insert({block.start(), new_size});
+      return p;
+    }
+    void* result = Allocate(size);
+    if (!result) return nullptr;
+    std::memcpy(result, p, block.size());
+    Free(p);
+    return result;
+  }
+
+  // The number of bytes usable at `p`, which must have come from `Allocate`.
+  size_t UsableSize(const void* p) const {
+    return Find(p).size();
+  }
+
+  // The end of the highest block, relative to the start of the region.
+  size_t End() const { return _blocks.End(); }
+
+  // The total size of the allocated blocks.
+  size_t Bytes() const { return _blocks.Bytes(); }
+
+ private:
+  static size_t RoundUp(size_t n, size_t alignment) {
+    return (n + alignment - 1) & ~(alignment - 1);
+  }
+
+  // Rounds the offset `start` up so that the address is aligned.
+  size_t AlignOffset(size_t start, size_t alignment) const {
+    uintptr_t address = reinterpret_cast<uintptr_t>(_base) + start;
+    return start + (RoundUp(address, alignment) - address);
+  }
+
+  Block Find(const void* p) const {
+    assert(Contains(p));
+    size_t start = static_cast<size_t>(static_cast<const char*>(p) - _base);
+    std::optional<Block> block = _blocks.Find(start);
+    assert(block);
+    return *block;
+  }
+
+  // Gives back the pages that are entirely inside `block`.
+  void Release(Block block) {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t begin = AlignOffset(block.start(), page);
+    size_t end = AlignOffset(block.end() - page + 1, page);
+    if (begin < end) {
+      madvise(_base + begin, end - begin, MADV_DONTNEED);
+    }
+  }
+
+  BlockLayout _blocks;
+  char* _base = nullptr;
+  size_t _reserve;
+};
+
+#endif  // FIRST_FIT_HEAP_H_
@@ -0,0 +1,78 @@
+#include "first_fit_heap.h"
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <random>
+#include <vector>
+
+static void Test1() {
+  FirstFitHeap heap(size_t(1) << 30);
+  char* a = static_cast<char*>(heap.Allocate(10));
+  char* b = static_cast<char*>(heap.Allocate(100));
+  char* c = static_cast<char*>(heap.Allocate(10));
+  assert(a && b && c);
+  assert(heap.UsableSize(a) == 16);
+  assert(b == a + 16 && c == b + 112);
+  std::memset(b, 'x', 100);
+  heap.Free(b);
+  // First fit: the hole left by `b` is reused.
+  char* d = static_cast<char*>(heap.Allocate(50));
+  assert(d == b);
+  // Shrinking stays in place, growing moves and keeps the contents.
+  assert(heap.Reallocate(d, 20) == d);
+  assert(heap.UsableSize(d) == 32);
+  char* e = static_cast<char*>(heap.Reallocate(d, 1000));
+  assert(e != d && e[0] == 'x' && e[19] == 'x');
+  assert(heap.Bytes() == 16 + 16 + 1008);
+  // Aligned allocations.
+  void* f = heap.Allocate(10, 4096);
+  assert(reinterpret_cast<uintptr_t>(f) % 4096 == 0);
+  heap.Free(f);
+  heap.Free(a);
+  heap.Free(c);
+  heap.Free(e);
+  assert(heap.Bytes() == 0 && heap.End() == 0);
+  // The region can fill up.
+  assert(!heap.Allocate(size_t(2) << 30));
+}
+
+// Random allocations, checking that they don't overlap, keep their contents,
+// and are aligned.
+static void RandomizedTest() {
+  FirstFitHeap heap(size_t(1) << 32);
+  std::default_random_engine engine(4);
+  std::uniform_int_distribution<size_t> size_distribution(1, 1000);
+  std::map<char*, size_t> live;
+  for (size_t i = 0; i < 20'000; ++i) {
+    if (!live.empty() && engine() % 2) {
+      auto it = live.begin();
+      std::advance(it, engine() % std::min(live.size(), size_t(10)));
+      char fill = static_cast<char>(reinterpret_cast<uintptr_t>(it->first));
+      for (size_t j = 0; j < it->second; ++j) assert(it->first[j] == fill);
+      heap.Free(it->first);
+      live.erase(it);
+    } else {
+      size_t size = size_distribution(engine);
+      // Sometimes huge, so that pages are released.
+      if (engine() % 100 == 0) size *= 1000;
+      size_t alignment = size_t(1) << (engine() % 13);
+      char* p = static_cast<char*>(heap.Allocate(size, alignment));
+      assert(reinterpret_cast<uintptr_t>(p) % alignment == 0);
+      assert(heap.UsableSize(p) >= size);
+      auto next = live.lower_bound(p);
+      assert(next == live.end() || p + size <= next->first);
+      if (next != live.begin()) {
+        --next;
+        assert(next->first + next->second <= p);
+      }
+      std::memset(p, static_cast<char>(reinterpret_cast<uintptr_t>(p)), size);
+      live[p] = size;
+    }
+  }
+}
+
+int main() {
+  Test1();
+  RandomizedTest();
+}
@@ -0,0 +1,267 @@
+// `malloc` and friends on a `FirstFitHeap`, for running real programs on a
+// first-fit heap:
+//
+//   make libfirstfit.so
+//   LD_PRELOAD=./libfirstfit.so some_program
+//
+// One lock protects the heap (and is held across `fork`).  The heap's index
+// (the `BlockLayout` nodes) is allocated with `new`, which calls back into
+// `malloc`.  A thread-local flag notices that, and those allocations are
+// served from a separate metadata arena, so the index never lives in the
+// managed region.
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include "first_fit_heap.h"
+
+namespace {
+
+// The heap reserves 64GiB of address space, and the metadata arena 16GiB.
+constexpr size_t kHeapReserve = size_t(64) << 30;
+constexpr size_t kMetadataReserve = size_t(16) << 30;
+
+// A simple allocator for the heap's own data structures: power-of-two size
+// classes with free lists, over a bump pointer.  Each allocation has a
+// header holding its size class.  Only used while holding the heap lock.
+class MetadataArena {
+ public:
+  MetadataArena() {
+    void* base = mmap(nullptr, kMetadataReserve, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base != MAP_FAILED) {
+      _base = _next = static_cast<char*>(base);
+    }
+  }
+
+  bool Contains(const void* p) const {
+    const char* c = static_cast<const char*>(p);
+    return _base && std::greater_equal<>()(c, _base) &&
+           std::less<>()(c, _base + kMetadataReserve);
+  }
+
+  void* Allocate(size_t size) {
+    size_t size_class = 0;
+    while ((kMinSize << size_class) < size + kHeader) ++size_class;
+    if (size_class >= kClasses) return nullptr;
+    char* chunk;
+    if (_free[size_class]) {
+      chunk = static_cast<char*>(_free[size_class]);
+      std::memcpy(&_free[size_class], chunk, sizeof(void*));
+    } else {
+      size_t chunk_size = kMinSize << size_class;
+      if (!_base || _next + chunk_size > _base + kMetadataReserve) {
+        return nullptr;
+      }
+      chunk = _next;
+      _next += chunk_size;
+    }
+    std::memcpy(chunk, &size_class, sizeof(size_class));
+    return chunk + kHeader;
+  }
+
+  void Free(void* p) {
+    char* chunk = static_cast<char*>(p) - kHeader;
+    size_t size_class;
+    std::memcpy(&size_class, chunk, sizeof(size_class));
+    std::memcpy(chunk, &_free[size_class], sizeof(void*));
+    _free[size_class] = chunk;
+  }
+
+  size_t UsableSize(const void* p) const {
+    size_t size_class;
+    std::memcpy(&size_class, static_cast<const char*>(p) - kHeader,
+                sizeof(size_class));
+    return (kMinSize << size_class) - kHeader;
+  }
+
+ private:
+  static constexpr size_t kHeader = FirstFitHeap::kAlignment;
+  static constexpr size_t kMinSize = 32;
+  static constexpr size_t kClasses = 30;
+  char* _base = nullptr;
+  char* _next = nullptr;
+  void* _free[kClasses] = {};
+};
+
+std::mutex heap_mutex;
+// True while this thread is inside the heap (and so holds `heap_mutex`).
+__attribute__((tls_model("initial-exec"))) thread_local bool in_heap = false;
+
+// Constructed on first use and never destroyed, since programs can call
+// `free` after static destructors have run.
+alignas(FirstFitHeap) unsigned char heap_storage[sizeof(FirstFitHeap)];
+alignas(MetadataArena) unsigned char metadata_storage[sizeof(MetadataArena)];
+FirstFitHeap* heap = nullptr;
+MetadataArena* metadata = nullptr;
+
+// Calls `fun(heap)` holding the lock, with the metadata arena serving any
+// allocations the heap makes.  If this thread is already in the heap, calls
+// `metadata_fun(metadata)` instead.
+template <class Fun, class MetadataFun>
+auto WithHeap(Fun fun, MetadataFun metadata_fun) {
+  if (in_heap) {
+    return metadata_fun(*metadata);
+  }
+  std::lock_guard<std::mutex> lock(heap_mutex);
+  in_heap = true;
+  if (!heap) {
+    metadata = new (metadata_storage) MetadataArena();
+    heap = new (heap_storage) FirstFitHeap(kHeapReserve);
+    // Hold the lock across `fork`, so the child doesn't inherit it locked
+    // by a thread that doesn't exist there.
+    pthread_atfork([]() { heap_mutex.lock(); },
+                   []() { heap_mutex.unlock(); },
+                   []() { heap_mutex.unlock(); });
+  }
+  auto result = fun(*heap);
+  in_heap = false;
+  return result;
+}
+
+void* Allocate(size_t size, size_t alignment) {
+  void* result = WithHeap(
+      [=](FirstFitHeap& h) { return h.Allocate(size, alignment); },
+      [=](MetadataArena& m) {
+        return alignment <= FirstFitHeap::kAlignment ? m.Allocate(size)
+                                                     : nullptr;
+      });
+  if (!result) errno = ENOMEM;
+  return result;
+}
+
+bool IsPowerOfTwo(size_t n) { return n != 0 && (n & (n - 1)) == 0; }
+
+// True if `p` is in the heap or the metadata arena, so that we know its size.
+bool Owns(void* p) {
+  return WithHeap(
+      [=](FirstFitHeap& h) { return h.Contains(p) || metadata->Contains(p); },
+      [=](MetadataArena& m) { return m.Contains(p); });
+}
+
+// Writes `message` to stderr without allocating, and aborts.
+[[noreturn]] void Die(const char* message) {
+  ssize_t ignored = write(STDERR_FILENO, message, std::strlen(message));
+  (void)ignored;
+  std::abort();
+}
+
+}  // namespace
+
+extern "C" {
+
+void* malloc(size_t size) noexcept {
+  return Allocate(size, FirstFitHeap::kAlignment);
+}
+
+void free(void* p) noexcept {
+  if (!p) return;
+  WithHeap(
+      [=](FirstFitHeap& h) {
+        // Pointers from before we were loaded (such as the dynamic linker's)
+        // belong to nobody, and are leaked.
+        if (h.Contains(p)) h.Free(p);
+        else if (metadata->Contains(p)) metadata->Free(p);
+        return 0;
+      },
+      [=](MetadataArena& m) {
+        if (m.Contains(p)) m.Free(p);
+        return 0;
+      });
+}
+
+void* calloc(size_t count, size_t size) noexcept {
+  size_t bytes;
+  if (__builtin_mul_overflow(count, size, &bytes)) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  void* result = malloc(bytes);
+  if (result) std::memset(result, 0, bytes);
+  return result;
+}
+
+void* realloc(void* p, size_t size) noexcept {
+  if (!p) return malloc(size);
+  if (size == 0) {
+    free(p);
+    return nullptr;
+  }
+  void* result = WithHeap(
+      [=](FirstFitHeap& h) -> void* {
+        if (h.Contains(p)) return h.Reallocate(p, size);
+        return nullptr;
+      },
+      [](MetadataArena&) -> void* { return nullptr; });
+  if (result) return result;
+  // Pointers from before we were loaded belong to nobody, so we can't tell
+  // how much of them to copy.
+  if (!Owns(p)) {
+    Die("libfirstfit: realloc of a pointer it didn't allocate\n");
+  }
+  // The heap couldn't grow the block in place or move it, or `p` is in the
+  // metadata arena: copy it.
+  size_t old_size = malloc_usable_size(p);
+  result = malloc(size);
+  if (!result) return nullptr;
+  std::memcpy(result, p, std::min(old_size, size));
+  free(p);
+  return result;
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+  if (!IsPowerOfTwo(alignment)) {
+    errno = EINVAL;
+    return nullptr;
+  }
+  return Allocate(size, alignment);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void** result, size_t alignment, size_t size) noexcept {
+  if (!IsPowerOfTwo(alignment) || alignment % sizeof(void*) != 0) {
+    return EINVAL;
+  }
+  void* p = Allocate(size, alignment);
+  if (!p) return ENOMEM;
+  *result = p;
+  return 0;
+}
+
+void* valloc(size_t size) noexcept {
+  return memalign(static_cast<size_t>(sysconf(_SC_PAGESIZE)), size);
+}
+
+void* pvalloc(size_t size) noexcept {
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return memalign(page, (size + page - 1) / page * page);
+}
+
+size_t malloc_usable_size(void* p) noexcept {
+  if (!p) return 0;
+  return WithHeap(
+      [=](FirstFitHeap& h) -> size_t {
+        if (h.Contains(p)) return h.UsableSize(p);
+        if (metadata->Contains(p)) return metadata->UsableSize(p);
+        return 0;
+      },
+      [=](MetadataArena& m) -> size_t {
+        return m.Contains(p) ? m.UsableSize(p) : 0;
+      });
+}
+
+}  // extern "C"
@@ -0,0 +1,294 @@
+#include "first_fit.h"
+
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <random>
+#include <set>
+#include <vector>
+
+// A simple test.  Do we reuse allocations?
+static void Test1() {
+  FirstFit ff;
+  Block a = ff.Alloc(10);
+  std::cout << "Allocated " << a << std::endl;
+  ff.Free(a);
+  Block b = ff.Alloc(10);
+  std::cout << "Allocated " << a << std::endl;
+  std::cout << "High-water = " << ff.get_high_water() << std::endl;
+  assert(ff.get_high_water() < 20);
+  assert(a == b);
+}
+
+static void Test2() {
+  FirstFit ff;
+  /*Block a = */ff.Alloc(10);
+  Block b = ff.Alloc(15);
+  /*Block c = */ff.Alloc(20);
+  Block d = ff.Alloc(25);
+  /*Block e = */ff.Alloc(30);
+  ff.Free(b);
+  ff.Free(d);
+  Block f = ff.Alloc(21);
+  assert(f.start() == 10 + 15 + 20);
+  Block g = ff.Alloc(14);
+  assert(g.start() == 10);
+  Block h = ff.Alloc(2);
+  assert(h.start() == 10 + 15 + 20 + 21);
+  assert(ff.get_high_water() == 10 + 15 + 20 + 25 + 30);
+}
+
+// The linear-time first fit (and last fit) that `BlockLayout` replaces.
+class ScanFit {
+ public:
+  Block Alloc(size_t size, bool high) {
+    std::optional<size_t> start;
+    size_t prev_end = 0;
+    for (const Block& block : _blocks) {
+      if (block.start() - prev_end >= size) {
+        start = high ? block.start() - size : prev_end;
+        if (!high) break;
+      }
+      prev_end = block.end();
+    }
+    Block block{start.value_or(prev_end), size};
+    _blocks.insert(block);
+    return block;
+  }
+  void Free(Block block) {
+    _blocks.erase(block);
+  }
+ private:
+  std::set<Block> _blocks;
+};
+
+// Checks both ends of `TwoEndedFit` against `ScanFit`, on random sizes.
+static void RandomizedTest() {
+  std::default_random_engine engine(1);
+  std::uniform_int_distribution<size_t> size_distribution(1, 100);
+  std::bernoulli_distribution coin;
+  TwoEndedFit fit;
+  ScanFit scan;
+  std::vector<Block> blocks;
+  for (size_t i = 0; i < 20'000; ++i) {
+    if (blocks.size() > 100 || (!blocks.empty() && coin(engine))) {
+      size_t j = std::uniform_int_distribution<size_t>(
+          0, blocks.size() - 1)(engine);
+      fit.Free(blocks[j]);
+      scan.Free(blocks[j]);
+      blocks[j] = blocks.back();
+      blocks.pop_back();
+    } else {
+      size_t size = size_distribution(engine);
+      bool high = coin(engine);
+      Block block = fit.Alloc(size, high ? TwoEndedFit::End::kHigh
+                                         : TwoEndedFit::End::kLow);
+      Block expected = scan.Alloc(size, high);
+      assert(block.start() == expected.start());
+      assert(block.size() == size);
+      blocks.push_back(block);
+    }
+  }
+}
+
+static void TwoEndedFitTest() {
+  // Blocks of 20 and up go to the high end.
+  TwoEndedFit fit(20);
+  Block a = fit.Alloc(10);
+  Block b = fit.Alloc(30);
+  Block c = fit.Alloc(10);
+  Block d = fit.Alloc(30);
+  Block e = fit.Alloc(10);
+  assert(a.start() == 0 && b.start() == 10 && c.start() == 40);
+  assert(d.start() == 50 && e.start() == 80);
+  fit.Free(b);
+  fit.Free(d);
+  // The highest hole is [50, 80): a large block goes at its top, and a small
+  // one at the bottom of the lowest hole.
+  Block f = fit.Alloc(25);
+  assert(f.start() == 55);
+  Block g = fit.Alloc(5);
+  assert(g.start() == 10);
+  // A hint overrides the size.
+  Block h = fit.Alloc(5, TwoEndedFit::End::kHigh);
+  assert(h.start() == 50);
+  Block i = fit.Alloc(20, TwoEndedFit::End::kLow);
+  assert(i.start() == 15);
+  // Nothing fits: the block goes at the end.
+  Block j = fit.Alloc(40);
+  assert(j.start() == 90);
+  assert(fit.get_high_water() == 130);
+}
+
+// The number of pages of `page_size` that hold bytes of `blocks`.
+static size_t CountPages(const std::set<Block>& blocks, size_t page_size) {
+  std::set<size_t> pages;
+  for (const Block& block : blocks) {
+    for (size_t page = block.start() / page_size;
+         page <= (block.end() - 1) / page_size; ++page) {
+      pages.insert(page);
+    }
+  }
+  return pages.size();
+}
+
+// Checks the page counts against a count from scratch, with blocks of up to
+// a few pages (using small pages, so they're often shared), through frees,
+// allocations at both ends and compaction.
+static void ResidencyTest() {
+  std::default_random_engine engine(2);
+  std::uniform_int_distribution<size_t> size_distribution(1, 300);
+  std::bernoulli_distribution coin;
+  TwoEndedFit fit;
+  std::set<Block> blocks;
+  std::vector<Block> order;
+  size_t peak = 0;
+  for (size_t i = 0; i < 10'000; ++i) {
+    if (order.size() > 200 || (!order.empty() && coin(engine))) {
+      size_t j = std::uniform_int_distribution<size_t>(
+          0, order.size() - 1)(engine);
+      fit.Free(order[j]);
+      blocks.erase(order[j]);
+      order[j] = order.back();
+      order.pop_back();
+    } else {
+      Block block = fit.Alloc(size_distribution(engine),
+                              coin(engine) ? TwoEndedFit::End::kHigh
+                                           : TwoEndedFit::End::kLow);
+      blocks.insert(block);
+      order.push_back(block);
+    }
+    if (i % 2'500 == 2'499) {
+      // Compaction moves everything, so start over.
+      CompactionResult result = fit.Compact({});
+      for (const Relocation& r : result.relocations) {
+        for (Block& block : order) {
+          if (block.start() >= r.old_start &&
+              block.start() < r.old_start + r.size) {
+            block = Block(block.start() - r.old_start + r.new_start,
+                          block.size());
+          }
+        }
+      }
+      blocks.clear();
+      blocks.insert(order.begin(), order.end());
+      peak = CountPages(blocks, 4096);
+    }
+    const Residency& residency = fit.get_residency();
+    assert(residency.pages.Pages() == CountPages(blocks, 4096));
+    assert(residency.huge_pages.Pages() == CountPages(blocks, 2 << 20));
+    peak = std::max(peak, residency.pages.Pages());
+    assert(residency.pages.PeakPages() == peak);
+  }
+  // Small pages, so that blocks share them on both sides.
+  PageCounter counter(16);
+  BlockLayout layout;
+  std::set<Block> small;
+  for (size_t start = 0; start < 1'000; start += 13) {
+    Block block(start, 1 + start % 7);
+    counter.Insert(block, layout.Insert(block));
+    small.insert(block);
+    assert(counter.Pages() == CountPages(small, 16));
+  }
+  for (size_t start = 0; start < 1'000; start += 26) {
+    Block block(start, 1 + start % 7);
+    counter.Erase(block, layout.Erase(block));
+    small.erase(block);
+    assert(counter.Pages() == CountPages(small, 16));
+  }
+  PageCounter recounted(16);
+  recounted.Recount(layout);
+  assert(recounted.Pages() == counter.Pages());
+}
+
+// The blocks of `layout`, in address order.
+static std::vector<Block> Blocks(const BlockLayout& layout) {
+  std::vector<Block> blocks;
+  layout.ForAll([&](Block block) { blocks.push_back(block); });
+  return blocks;
+}
+
+// `EraseBatch` leaves the same layout as erasing the blocks one at a time,
+// returns the nearest blocks that stay, and the page counts follow it; and
+// deferred frees in `FirstFit` keep the page counts right.
+static void DeferredFreeTest() {
+  std::default_random_engine engine(3);
+  std::uniform_int_distribution<size_t> size_distribution(1, 40);
+  for (size_t round = 0; round < 100; ++round) {
+    BlockLayout batched, one_at_a_time;
+    PageCounter counter(16);
+    std::set<Block> blocks;
+    size_t end = 0;
+    for (size_t i = 0; i < 200; ++i) {
+      // Often adjacent, so that erased blocks run together.
+      Block block(end + engine() % 3 * size_distribution(engine),
+                  size_distribution(engine));
+      counter.Insert(block, batched.Insert(block));
+      one_at_a_time.Insert(block);
+      blocks.insert(block);
+      end = block.end();
+    }
+    std::vector<Block> erased;
+    for (const Block& block : blocks) {
+      if (engine() % (round % 4 + 2) == 0) erased.push_back(block);
+    }
+    std::vector<BlockLayout::Neighbors> neighbors =
+        batched.EraseBatch(erased);
+    counter.EraseBatch(erased, neighbors);
+    for (const Block& block : erased) {
+      one_at_a_time.Erase(block);
+      blocks.erase(block);
+    }
+    assert(Blocks(batched) == Blocks(one_at_a_time));
+    assert(batched.End() == one_at_a_time.End());
+    assert(batched.Bytes() == one_at_a_time.Bytes());
+    for (size_t size = 1; size < 200; size += 7) {
+      assert(batched.LowestFit(size) == one_at_a_time.LowestFit(size));
+      assert(batched.HighestFit(size) == one_at_a_time.HighestFit(size));
+    }
+    for (size_t i = 0; i < erased.size(); ++i) {
+      auto above = blocks.upper_bound(erased[i]);
+      size_t below_end =
+          above == blocks.begin() ? 0 : std::prev(above)->end();
+      size_t above_start = above == blocks.end() ? SIZE_MAX : above->start();
+      assert(neighbors[i].below_end == below_end);
+      assert(neighbors[i].above_start == above_start);
+    }
+    assert(counter.Pages() == CountPages(blocks, 16));
+  }
+  FirstFit ff(16);
+  std::set<Block> live;
+  std::vector<Block> order;
+  size_t frees = 0;
+  for (size_t i = 0; i < 10'000; ++i) {
+    if (order.size() > 200 || (!order.empty() && engine() % 2)) {
+      size_t j = engine() % order.size();
+      ff.Free(order[j]);
+      order[j] = order.back();
+      order.pop_back();
+      if (++frees % 16 == 0) {
+        // The batch was just applied.
+        live = std::set<Block>(order.begin(), order.end());
+      }
+    } else {
+      Block block = ff.Alloc(size_distribution(engine) * 200);
+      // Not on top of a block whose free is deferred.
+      assert(!live.contains(block));
+      live.insert(block);
+      order.push_back(block);
+    }
+    assert(ff.get_residency().pages.Pages() == CountPages(live, 4096));
+  }
+  ff.FlushFrees();
+  assert(ff.get_residency().pages.Pages() ==
+         CountPages(std::set<Block>(order.begin(), order.end()), 4096));
+}
+
+int main() {
+  Test1();
+  Test2();
+  RandomizedTest();
+  TwoEndedFitTest();
+  ResidencyTest();
+  DeferredFreeTest();
+}
@@ -1,110 +1,315 @@
-#include <cassert>
-#include <cstddef>
-#include <iostream>
-#include <set>
+// Compares the fragmentation of placement policies, in the style of Shore's
+// experiments: blocks with random sizes and exponentially distributed
+// lifetimes, in a steady state.  The figure of merit is the high-water mark,
+// relative to the most bytes that were ever live at once, along with the
+// pages and huge pages that hold live bytes (what the memory really costs).
+// Last, first fit under request-scoped arenas (see `arena.h`).
+// Run with `make fitness && ./fitness`.
 
-class FirstFit;
+#include "arena.h"
+#include "first_fit.h"
+#include "simulator.h"
+#include "workload.h"
 
-class Block {
- public:
-  Block(size_t start, size_t size) :_start(start), _size(size) {}
-  size_t start() const { return _start; }
-  size_t size() const { return _size; }
+#include <cstdio>
+#include <map>
+#include <utility>
+#include <vector>
 
- private:
-  size_t _start;
-  size_t _size;
-};
+namespace {
 
-bool operator<(Block a, Block b) {
-  if (a.start() == b.start()) assert(a.size() == b.size());
-  return a.start() < b.start();
+std::vector<Request> MakeTrace(size_t n, Hyperexponential sizes,
+                               double mean_lifetime, unsigned seed) {
+  WorkloadStream stream(sizes, mean_lifetime, seed);
+  std::vector<Request> trace;
+  for (size_t i = 0; i < n; ++i) {
+    trace.push_back(stream.Next());
+  }
+  return trace;
 }
 
-bool operator==(Block a, Block b) {
-  if (a.start() == b.start()) assert(a.size() == b.size());
-  return a.start() == b.start();
+// Runs `trace`, allocating each request with `alloc(allocator, request)`, and
+// returns the high-water mark.  The i'th allocation happens at tick i, after
+// freeing the blocks that died by then.  If `max_live` is not null, it gets
+// the most bytes that were live at once.
+template <class Allocator, class AllocFun>
+size_t Run(const std::vector<Request>& trace, Allocator& allocator,
+           AllocFun alloc, size_t* max_live = nullptr) {
+  Simulator<Allocator> simulator(allocator);
+  for (size_t i = 0; i < trace.size(); ++i) {
+    simulator.AdvanceTo(i);
+    simulator.Schedule(alloc(allocator, trace[i]),
+                       LifetimeTicks(trace[i].lifetime));
+    if (max_live) *max_live = std::max(*max_live, simulator.LiveBytes());
+  }
+  return allocator.get_high_water();
 }
 
-std::ostream& operator<<(std::ostream& os, Block b) {
-  return os << "{" << b.start() << ", " << b.size() << "}";
+// The most bytes live at once in `trace`: a lower bound for any policy.
+size_t MaxLive(const std::vector<Request>& trace) {
+  FirstFit ff;
+  size_t max_live = 0;
+  Run(trace, ff, [](FirstFit& a, Request r) { return a.Alloc(r.size); },
+      &max_live);
+  return max_live;
 }
 
-class FirstFit {
- private:
- public:
-  Block Alloc(size_t size);
-  void Free(Block address);
-  size_t get_high_water() const {
-    return _high_water;
+void Compare(const char* name, Hyperexponential sizes) {
+  constexpr size_t kAllocations = 200'000;
+  constexpr double kMeanLifetime = 1'000;
+  constexpr unsigned kSeeds = 3;
+  double mean_size = sizes.Mean();
+  // The ratio of the high-water mark to the max live bytes, summed over seeds.
+  double first_fit = 0, size_1x = 0, size_4x = 0, lifetime = 0;
+  for (unsigned seed = 1; seed <= kSeeds; ++seed) {
+    std::vector<Request> trace =
+        MakeTrace(kAllocations, sizes, kMeanLifetime, seed);
+    double max_live = static_cast<double>(MaxLive(trace));
+    auto ratio = [max_live](size_t high_water) {
+      return static_cast<double>(high_water) / max_live;
+    };
+    {
+      FirstFit ff;
+      first_fit += ratio(Run(trace, ff, [](FirstFit& a, Request r) {
+        return a.Alloc(r.size);
+      }));
+    }
+    auto by_size = [](TwoEndedFit& a, Request r) { return a.Alloc(r.size); };
+    {
+      TwoEndedFit fit(static_cast<size_t>(mean_size));
+      size_1x += ratio(Run(trace, fit, by_size));
+    }
+    {
+      TwoEndedFit fit(static_cast<size_t>(4 * mean_size));
+      size_4x += ratio(Run(trace, fit, by_size));
+    }
+    {
+      // Blocks that will outlive the average go to the high end.
+      TwoEndedFit fit;
+      lifetime += ratio(Run(trace, fit, [=](TwoEndedFit& a, Request r) {
+        return a.Alloc(r.size, r.lifetime > kMeanLifetime
+                                   ? TwoEndedFit::End::kHigh
+                                   : TwoEndedFit::End::kLow);
+      }));
+    }
   }
- private:
-  std::set<Block> _allocated_blocks;
-  size_t _high_water = 0;
-};
+  std::printf("%-28s %10.3f %10.3f %10.3f %10.3f\n", name,
+              first_fit / kSeeds, size_1x / kSeeds, size_4x / kSeeds,
+              lifetime / kSeeds);
+}
 
-Block FirstFit::Alloc(size_t size) {
-  size_t prev_end = 0;
-  for (const Block& block : _allocated_blocks) {
-    assert(block.start() >= prev_end);
-    if (block.start() - prev_end >= size) {
-      Block block{prev_end, size};
-      _allocated_blocks.insert(block);
-      return block;
-    }
-    prev_end = block.start() + block.size();
+// Compares the placement policies of `Compare` by what they'd really cost:
+// the most 4KiB pages and 2MiB huge pages that held live bytes at once,
+// relative to the max live bytes, next to the high-water mark.  Uses more
+// live bytes than `Compare`, so there are enough huge pages to tell apart.
+void CompareResidency(const char* name, Hyperexponential sizes) {
+  constexpr size_t kAllocations = 500'000;
+  constexpr double kMeanLifetime = 50'000;
+  double mean_size = sizes.Mean();
+  std::vector<Request> trace = MakeTrace(kAllocations, sizes, kMeanLifetime, 1);
+  double max_live = static_cast<double>(MaxLive(trace));
+  std::printf("%s\n", name);
+  auto print = [max_live](const char* policy, size_t high_water,
+                          const Residency& residency) {
+    auto peak_bytes = [](const PageCounter& counter) {
+      return static_cast<double>(counter.PeakPages() * counter.PageSize());
+    };
+    std::printf("  %-12s %10.3f %10.3f %10.3f\n", policy,
+                static_cast<double>(high_water) / max_live,
+                peak_bytes(residency.pages) / max_live,
+                peak_bytes(residency.huge_pages) / max_live);
+  };
+  {
+    FirstFit ff;
+    size_t high_water = Run(trace, ff, [](FirstFit& a, Request r) {
+      return a.Alloc(r.size);
+    });
+    print("first fit", high_water, ff.get_residency());
+  }
+  auto by_size = [](TwoEndedFit& a, Request r) { return a.Alloc(r.size); };
+  {
+    TwoEndedFit fit(static_cast<size_t>(mean_size));
+    print("size>=1x", Run(trace, fit, by_size), fit.get_residency());
+  }
+  {
+    TwoEndedFit fit(static_cast<size_t>(4 * mean_size));
+    print("size>=4x", Run(trace, fit, by_size), fit.get_residency());
   }
-  size_t end = 0;
-  if (!_allocated_blocks.empty()) {
-    auto it = _allocated_blocks.end();
-    --it;
-    end = it->start() + it->size();
+  {
+    TwoEndedFit fit;
+    size_t high_water = Run(trace, fit, [=](TwoEndedFit& a, Request r) {
+      return a.Alloc(r.size, r.lifetime > kMeanLifetime
+                                 ? TwoEndedFit::End::kHigh
+                                 : TwoEndedFit::End::kLow);
+    });
+    print("long life", high_water, fit.get_residency());
   }
-  _high_water = std::max(_high_water, end + size);
-  Block block{end, size};
-  _allocated_blocks.insert(block);
-  return block;
 }
 
-void FirstFit::Free(Block block) {
-  auto it = _allocated_blocks.find(block);
-  assert(it != _allocated_blocks.end());
-  assert(*it == block);
-  _allocated_blocks.erase(it);
+// Runs `trace` with first fit, compacting with `options` every `period`
+// allocations (and never if `period` is zero).  A window from `options` is
+// taken as fractions of 1000 of the current end.  Sets `peak` to the most
+// memory in use (the high-water mark, which compaction lowers), and
+// `bytes_moved` to the total moved by compaction.
+void RunWithCompaction(const std::vector<Request>& trace,
+                       CompactionOptions options, size_t period,
+                       size_t& peak, size_t& bytes_moved) {
+  FirstFit ff;
+  // The live objects, by index in `trace`, and the index of each address.
+  std::vector<Block> objects;
+  std::map<size_t, size_t> by_address;
+  // The deaths, by index in `trace`.
+  RadixHeap<size_t> deaths;
+  peak = 0;
+  bytes_moved = 0;
+  for (size_t i = 0; i < trace.size(); ++i) {
+    while (!deaths.empty() && deaths.MinKey() <= i) {
+      Block block = objects[deaths.Pop().second];
+      ff.Free(block);
+      by_address.erase(block.start());
+    }
+    if (period != 0 && i % period == period - 1) {
+      peak = std::max(peak, ff.get_high_water());
+      CompactionOptions window = options;
+      size_t end = ff.get_high_water();
+      window.window_start = end / 1000 * options.window_start;
+      window.window_end = end / 1000 * options.window_end;
+      CompactionResult result = ff.Compact(window);
+      bytes_moved += result.bytes_moved;
+      for (const Relocation& r : result.relocations) {
+        auto it = by_address.lower_bound(r.old_start);
+        std::vector<size_t> moved;
+        while (it != by_address.end() && it->first < r.old_start + r.size) {
+          moved.push_back(it->second);
+          it = by_address.erase(it);
+        }
+        for (size_t object : moved) {
+          Block& block = objects[object];
+          block = Block(block.start() - r.old_start + r.new_start,
+                        block.size());
+          by_address[block.start()] = object;
+        }
+      }
+    }
+    Block block = ff.Alloc(trace[i].size);
+    objects.push_back(block);
+    by_address[block.start()] = i;
+    deaths.Push(i + LifetimeTicks(trace[i].lifetime), i);
+  }
+  peak = std::max(peak, ff.get_high_water());
 }
 
-// A simple test.  Do we reuse allocations?
-void Test1() {
-  FirstFit ff;
-  Block a = ff.Alloc(10);
-  std::cout << "Allocated " << a << std::endl;
-  ff.Free(a);
-  Block b = ff.Alloc(10);
-  std::cout << "Allocated " << a << std::endl;
-  std::cout << "High-water = " << ff.get_high_water() << std::endl;
-  assert(ff.get_high_water() < 20);
-  assert(a == b);
+// Compares compaction modes: the peak memory relative to the max live bytes,
+// and the bytes moved per byte allocated.
+void CompareCompaction(const char* name, Hyperexponential sizes) {
+  constexpr size_t kAllocations = 200'000;
+  constexpr double kMeanLifetime = 1'000;
+  constexpr size_t kPeriod = 1'000;
+  std::vector<Request> trace = MakeTrace(kAllocations, sizes, kMeanLifetime, 1);
+  double max_live = static_cast<double>(MaxLive(trace));
+  double allocated = 0;
+  for (const Request& request : trace) {
+    allocated += static_cast<double>(request.size);
+  }
+  std::printf("%s\n", name);
+  struct Config {
+    const char* name;
+    CompactionOptions options;
+    size_t period;
+  };
+  const Config configs[] = {
+      {"none", {}, 0},
+      {"sliding", {CompactionMode::kSliding, 0, 1000}, kPeriod},
+      {"windowed, top half", {CompactionMode::kWindowed, 500, 1000}, kPeriod},
+      {"hole-targeted", {CompactionMode::kHoleTargeted, 0, 1000}, kPeriod},
+  };
+  for (const Config& config : configs) {
+    size_t peak, bytes_moved;
+    RunWithCompaction(trace, config.options, config.period, peak, bytes_moved);
+    std::printf("  %-24s peak / max live %6.3f   moved / allocated %6.3f\n",
+                config.name, static_cast<double>(peak) / max_live,
+                static_cast<double>(bytes_moved) / allocated);
+  }
 }
 
-void Test2() {
+// Runs `trace` with a fraction `in_arenas` of the allocations going to
+// request-scoped arenas with chunks of `chunk_size`, and the rest freed one at
+// a time.  A request arena lives as long as the allocation that opens it says,
+// and takes every allocation in its scope for `kPerRequest` ticks (or until
+// it dies); within it, a phase arena lives a quarter as long and is replaced
+// every `kPerPhase` ticks.  Half of a request's allocations go to its current
+// phase.  Returns the high-water mark relative to the most bytes that were
+// live at once (counting a block in an arena as live until the arena dies).
+double RunArenas(const std::vector<Request>& trace, double in_arenas,
+                 size_t chunk_size) {
+  constexpr size_t kPerRequest = 100;
+  constexpr size_t kPerPhase = 10;
+  constexpr size_t kNone = ArenaSimulator<FirstFit>::kNoParent;
   FirstFit ff;
-  /*Block a = */ff.Alloc(10);
-  Block b = ff.Alloc(15);
-  /*Block c = */ff.Alloc(20);
-  Block d = ff.Alloc(25);
-  /*Block e = */ff.Alloc(30);
-  ff.Free(b);
-  ff.Free(d);
-  Block f = ff.Alloc(21);
-  assert(f.start() == 10 + 15 + 20);
-  Block g = ff.Alloc(14);
-  assert(g.start() == 10);
-  Block h = ff.Alloc(2);
-  assert(h.start() == 10 + 15 + 20 + 21);
-  assert(ff.get_high_water() == 10 + 15 + 20 + 25 + 30);
+  ArenaSimulator<FirstFit> simulator(ff, chunk_size);
+  CounterRng rng(1);
+  size_t request = kNone, phase = kNone;
+  uint64_t request_death = 0, phase_death = 0;
+  size_t max_live = 0;
+  for (size_t i = 0; i < trace.size(); ++i) {
+    simulator.AdvanceTo(i);
+    uint64_t lifetime = LifetimeTicks(trace[i].lifetime);
+    if (request == kNone || request_death <= i || i % kPerRequest == 0) {
+      request = simulator.Open(lifetime);
+      request_death = i + lifetime;
+      phase = kNone;
+    }
+    if (phase == kNone || phase_death <= i || i % kPerPhase == 0) {
+      phase = simulator.Open(lifetime / 4, request);
+      phase_death = std::min(i + lifetime / 4, request_death);
+    }
+    uint64_t bits = rng(i);
+    if (UnitInterval(bits) < in_arenas) {
+      simulator.AllocateIn(bits & 1 ? phase : request, trace[i].size);
+    } else {
+      simulator.Allocate(trace[i].size, lifetime);
+    }
+    max_live = std::max(max_live, simulator.LiveBytes());
+  }
+  return static_cast<double>(ff.get_high_water()) /
+         static_cast<double>(max_live);
+}
+
+// Compares first fit under arena-heavy workloads: high water / max live, by
+// the fraction of allocations in arenas and the chunk size.
+void CompareArenas(const char* name, Hyperexponential sizes) {
+  constexpr size_t kAllocations = 500'000;
+  constexpr double kMeanLifetime = 10'000;
+  std::vector<Request> trace = MakeTrace(kAllocations, sizes, kMeanLifetime, 1);
+  std::printf("%-28s %10.3f", name, RunArenas(trace, 0, 4 << 10));
+  for (double in_arenas : {0.5, 0.9}) {
+    for (size_t chunk_size : {4u << 10, 64u << 10}) {
+      std::printf(" %10.3f", RunArenas(trace, in_arenas, chunk_size));
+    }
+  }
+  std::printf("\n");
 }
 
+}  // namespace
+
 int main() {
-  Test1();
-  Test2();
+  std::printf("high water / max live      %10s %10s %10s %10s\n",
+              "first fit", "size>=1x", "size>=4x", "long life");
+  Compare("exponential", {1, 1'000, 1'000});
+  Compare("hyperexp 90% 100 / 10000", {0.9, 100, 10'000});
+  Compare("hyperexp 99% 100 / 100000", {0.99, 100, 100'000});
+  Compare("hyperexp 50% 10 / 10000", {0.5, 10, 10'000});
+  std::printf("\npeak memory / max live      %10s %10s %10s\n",
+              "high water", "4KiB pages", "2MiB pages");
+  CompareResidency("hyperexp 90% 1000 / 100000", {0.9, 1'000, 100'000});
+  CompareResidency("hyperexp 99% 1000 / 1000000", {0.99, 1'000, 1'000'000});
+  std::printf("\nfirst fit, compacting every 1000 allocations\n");
+  CompareCompaction("exponential", {1, 1'000, 1'000});
+  CompareCompaction("hyperexp 90% 100 / 10000", {0.9, 100, 10'000});
+  CompareCompaction("hyperexp 99% 100 / 100000", {0.99, 100, 100'000});
+  std::printf("\n%-28s %10s %10s %10s %10s %10s\n", "first fit with arenas",
+              "no arenas", "50% 4KiB", "50% 64KiB", "90% 4KiB", "90% 64KiB");
+  CompareArenas("exponential", {1, 1'000, 1'000});
+  CompareArenas("hyperexp 90% 100 / 10000", {0.9, 100, 10'000});
+  CompareArenas("hyperexp 99% 100 / 100000", {0.99, 100, 100'000});
 }
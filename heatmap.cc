@@ -0,0 +1,76 @@
+// Draws where first fit puts blocks over time: a Shore-style steady state,
+// with a heatmap row every `events / rows` allocations across the high-water
+// mark at the end.  Writes `prefix_occupancy.pgm`, `prefix_mean_size.pgm` and
+// `prefix.csv`.  Run with `make heatmap && ./heatmap prefix [events [width]]`.
+
+#include "heatmap.h"
+
+#include "first_fit.h"
+#include "simulator.h"
+#include "workload.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "usage: %s prefix [events [width]]\n", argv[0]);
+    return 1;
+  }
+  std::string prefix = argv[1];
+  size_t events = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2'000'000;
+  size_t width = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1024;
+  if (events == 0 || width == 0) {
+    std::fprintf(stderr, "%s: events and width must be positive\n", argv[0]);
+    return 1;
+  }
+  constexpr size_t kRows = 512;
+  // The trace is run twice: once to find the high-water mark, which the
+  // heatmap spans, and once to draw it.
+  auto run = [&](auto on_row) {
+    FirstFit ff;
+    Simulator<FirstFit> simulator(ff);
+    WorkloadStream stream({0.9, 100, 10'000}, 100'000, 1);
+    for (size_t i = 0; i < events; ++i) {
+      simulator.AdvanceTo(i);
+      Request request = stream.Next();
+      simulator.Allocate(request.size, LifetimeTicks(request.lifetime));
+      if ((i + 1) % std::max(events / kRows, size_t(1)) == 0) on_row(ff);
+    }
+    return ff.get_high_water();
+  };
+  size_t high_water = run([](const FirstFit&) {});
+  // A column is at least a byte wide.
+  width = std::min(width, high_water);
+  Heatmap heatmap(0, high_water, width);
+  double seconds = 0;
+  run([&](const FirstFit& ff) {
+    auto start = std::chrono::steady_clock::now();
+    heatmap.AddRow(ff.get_blocks());
+    seconds += std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start).count();
+  });
+  std::printf("%zu rows of %zu columns over %zu bytes, %.1f us per row\n",
+              heatmap.Rows(), width, high_water,
+              seconds / static_cast<double>(heatmap.Rows()) * 1e6);
+  auto write = [&](const std::string& name, auto fun) {
+    FILE* file = std::fopen(name.c_str(), "wb");
+    if (!file) {
+      std::perror(name.c_str());
+      std::exit(1);
+    }
+    fun(file);
+    std::fclose(file);
+  };
+  write(prefix + "_occupancy.pgm", [&](FILE* file) {
+    heatmap.WritePgm(file, Heatmap::Channel::kOccupancy);
+  });
+  write(prefix + "_mean_size.pgm", [&](FILE* file) {
+    heatmap.WritePgm(file, Heatmap::Channel::kMeanBlockSize);
+  });
+  write(prefix + ".csv", [&](FILE* file) { heatmap.WriteCsv(file); });
+}
@@ -0,0 +1,120 @@
+/* Downsampled pictures of where the blocks sit in the address space, to see
+ * at a glance whether large blocks drift to high addresses (Shore's
+ * intuition about first fit).
+ *
+ * A row of a heatmap cuts a range of addresses into `width` equal columns,
+ * and records for each how much of it is allocated, and the mean size of the
+ * blocks that start in it.  Each column takes one `BlockLayout::PrefixBelow`
+ * at its boundary, so a row costs O(width log n) whatever the number of
+ * blocks.  Rows taken over the course of a simulation stack up into an
+ * image, with time going down.
+ *
+ * `WriteCsv` writes the numbers, and `WritePgm` an 8-bit greyscale image (a
+ * binary PGM, which needs no library to write and most viewers can read):
+ * occupancy from black (empty) to white (full), or the mean block size on a
+ * log scale from black (no blocks, or one byte) to white (the largest mean in
+ * the heatmap).
+ */
+
+#ifndef HEATMAP_H_
+#define HEATMAP_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "block_layout.h"
+
+struct HeatmapCell {
+  // The fraction of the column that is allocated.
+  double occupancy;
+  // The mean size of the blocks that start in the column (zero if none do).
+  double mean_block_size;
+};
+
+class Heatmap {
+ public:
+  // Rows cover `[begin, end)` in `width` columns, of at least one byte.
+  Heatmap(size_t begin, size_t end, size_t width)
+      :_begin(begin), _end(end), _width(width) {
+    assert(0 < width && width <= end - begin);
+  }
+
+  size_t Width() const { return _width; }
+  size_t Rows() const { return _cells.size() / _width; }
+  const HeatmapCell& At(size_t row, size_t column) const {
+    return _cells[row * _width + column];
+  }
+
+  // Adds a row for `blocks` as they are now.
+  void AddRow(const BlockLayout& blocks) {
+    BlockLayout::Prefix below = blocks.PrefixBelow(ColumnStart(0));
+    for (size_t column = 0; column < _width; ++column) {
+      BlockLayout::Prefix next = blocks.PrefixBelow(ColumnStart(column + 1));
+      size_t count = next.blocks - below.blocks;
+      _cells.push_back(HeatmapCell{
+          static_cast<double>(next.allocated - below.allocated) /
+              static_cast<double>(ColumnStart(column + 1) -
+                                  ColumnStart(column)),
+          count == 0 ? 0
+                     : static_cast<double>(next.block_bytes -
+                                           below.block_bytes) /
+                           static_cast<double>(count)});
+      below = next;
+    }
+  }
+
+  // One line per cell: row, column, the column's first address, occupancy,
+  // and mean block size.
+  void WriteCsv(FILE* file) const {
+    std::fprintf(file, "row,column,address,occupancy,mean_block_size\n");
+    for (size_t row = 0; row < Rows(); ++row) {
+      for (size_t column = 0; column < _width; ++column) {
+        const HeatmapCell& cell = At(row, column);
+        std::fprintf(file, "%zu,%zu,%zu,%.4f,%.1f\n", row, column,
+                     ColumnStart(column), cell.occupancy,
+                     cell.mean_block_size);
+      }
+    }
+  }
+
+  enum class Channel { kOccupancy, kMeanBlockSize };
+
+  void WritePgm(FILE* file, Channel channel) const {
+    std::fprintf(file, "P5\n%zu %zu\n255\n", _width, Rows());
+    double max_log = 0;
+    for (const HeatmapCell& cell : _cells) {
+      max_log = std::max(max_log, Log(cell.mean_block_size));
+    }
+    std::vector<unsigned char> pixels;
+    pixels.reserve(_cells.size());
+    for (const HeatmapCell& cell : _cells) {
+      double shade = channel == Channel::kOccupancy
+                         ? cell.occupancy
+                         : max_log == 0 ? 0
+                                        : Log(cell.mean_block_size) / max_log;
+      pixels.push_back(static_cast<unsigned char>(std::lround(255 * shade)));
+    }
+    std::fwrite(pixels.data(), 1, pixels.size(), file);
+  }
+
+ private:
+  // Columns split the range as evenly as integers allow.
+  size_t ColumnStart(size_t column) const {
+    auto length = static_cast<unsigned __int128>(_end - _begin);
+    return _begin + static_cast<size_t>(length * column / _width);
+  }
+  static double Log(double size) { return size > 1 ? std::log(size) : 0; }
+
+  size_t _begin;
+  size_t _end;
+  size_t _width;
+  // Row by row.
+  std::vector<HeatmapCell> _cells;
+};
+
+#endif  // HEATMAP_H_
@@ -0,0 +1,71 @@
+#include "heatmap.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// `PrefixBelow` and the heatmap's cells, against adding up every block.
+static void HeatmapTest() {
+  std::default_random_engine engine(1);
+  BlockLayout layout;
+  std::vector<Block> blocks;
+  size_t end = 0;
+  for (size_t i = 0; i < 2'000; ++i) {
+    Block block(end + engine() % 50, 1 + engine() % 300);
+    layout.Insert(block);
+    blocks.push_back(block);
+    end = block.end();
+  }
+  assert(layout.Count() == blocks.size());
+  auto brute_force = [&](size_t address) {
+    BlockLayout::Prefix prefix{0, 0, 0};
+    for (const Block& block : blocks) {
+      if (block.start() < address) {
+        ++prefix.blocks;
+        prefix.block_bytes += block.size();
+        prefix.allocated += std::min(block.end(), address) - block.start();
+      }
+    }
+    return prefix;
+  };
+  for (size_t i = 0; i < 1'000; ++i) {
+    size_t address = engine() % (end + 100);
+    BlockLayout::Prefix expected = brute_force(address);
+    BlockLayout::Prefix prefix = layout.PrefixBelow(address);
+    assert(prefix.blocks == expected.blocks);
+    assert(prefix.block_bytes == expected.block_bytes);
+    assert(prefix.allocated == expected.allocated);
+  }
+  // Columns that don't divide the range evenly.
+  Heatmap heatmap(1'000, end, 77);
+  heatmap.AddRow(layout);
+  heatmap.AddRow(BlockLayout());
+  assert(heatmap.Rows() == 2);
+  size_t start = 1'000;
+  for (size_t column = 0; column < 77; ++column) {
+    size_t next = 1'000 + (end - 1'000) * (column + 1) / 77;
+    BlockLayout::Prefix a = brute_force(start), b = brute_force(next);
+    const HeatmapCell& cell = heatmap.At(0, column);
+    assert(std::abs(cell.occupancy -
+                    static_cast<double>(b.allocated - a.allocated) /
+                        static_cast<double>(next - start)) < 1e-12);
+    double mean = b.blocks == a.blocks
+                      ? 0
+                      : static_cast<double>(b.block_bytes - a.block_bytes) /
+                            static_cast<double>(b.blocks - a.blocks);
+    assert(cell.mean_block_size == mean);
+    assert(heatmap.At(1, column).occupancy == 0);
+    start = next;
+  }
+  // A 77 x 2 greyscale image.
+  FILE* file = std::tmpfile();
+  heatmap.WritePgm(file, Heatmap::Channel::kOccupancy);
+  assert(std::ftell(file) == static_cast<long>(std::strlen("P5\n77 2\n255\n")) +
+                                 77 * 2);
+  std::fclose(file);
+}
+
+int main() {
+  HeatmapTest();
+}
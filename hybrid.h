@@ -0,0 +1,173 @@
+/* A hybrid allocator, as a production malloc would deploy first fit: small
+ * blocks go to slabs, and only large ones are placed first fit.
+ *
+ * Small sizes are rounded up to a size class.  A slab is a run of
+ * `slab_size` bytes taken from a `FirstFit`, cut into equal slots of one
+ * class, with a list of its free slots.  A class allocates from one of its
+ * slabs with a free slot, in O(1) time, and takes a new slab when there is
+ * none.  A slab whose slots are all free goes back to first fit, unless it's
+ * the last one of its class with free slots (so that a class that keeps
+ * allocating and freeing one block doesn't take and give back a slab each
+ * time).  Large blocks go straight to the `FirstFit`.
+ *
+ * Freeing a small block finds its slab by address, in O(log slabs) time.
+ * The slabs and the large blocks share the `FirstFit`, so its high-water
+ * mark and residency are the hybrid's.
+ */
+
+#ifndef HYBRID_H_
+#define HYBRID_H_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <vector>
+
+#include "block_layout.h"
+#include "first_fit.h"
+#include "residency.h"
+
+struct HybridOptions {
+  // Sizes up to `max_small` go to slabs, in classes `granularity` apart.
+  size_t granularity = 16;
+  size_t max_small = 256;
+  size_t slab_size = 4 << 10;
+};
+
+class HybridFit {
+ public:
+  explicit HybridFit(HybridOptions options = {})
+      :_options(options),
+       _partial(options.max_small / options.granularity) {
+    assert(_options.max_small % _options.granularity == 0);
+    assert(_options.max_small <= _options.slab_size);
+  }
+
+  // Returns a block of at least `size` bytes (exactly the class size, for a
+  // small one), which must be given back to `Free` as is.
+  Block Alloc(size_t size) {
+    assert(size > 0);
+    if (size > _options.max_small) {
+      _large_bytes += size;
+      return _first_fit.Alloc(size);
+    }
+    size_t c = Class(size);
+    if (_partial[c].empty()) NewSlab(c);
+    size_t id = _partial[c].back();
+    Slab& slab = _slabs[id];
+    uint32_t slot = slab.free.back();
+    slab.free.pop_back();
+    // The partial slab handed out is always the last of its class.
+    if (slab.free.empty()) _partial[c].pop_back();
+    _small_bytes += ClassSize(c);
+    return Block(slab.start + slot * ClassSize(c), ClassSize(c));
+  }
+
+  void Free(Block block) {
+    if (block.size() > _options.max_small) {
+      _large_bytes -= block.size();
+      _first_fit.Free(block);
+      return;
+    }
+    auto it = _by_start.upper_bound(block.start());
+    assert(it != _by_start.begin());
+    size_t id = std::prev(it)->second;
+    Slab& slab = _slabs[id];
+    size_t c = slab.size_class;
+    assert(block.size() == ClassSize(c));
+    assert(block.start() < slab.start + _options.slab_size);
+    _small_bytes -= ClassSize(c);
+    slab.free.push_back(
+        static_cast<uint32_t>((block.start() - slab.start) / ClassSize(c)));
+    if (slab.free.size() == 1) {
+      slab.partial_index = _partial[c].size();
+      _partial[c].push_back(id);
+    }
+    if (slab.free.size() == SlotsPerSlab(c) && _partial[c].size() > 1) {
+      FreeSlab(id);
+    }
+  }
+
+  size_t get_high_water() const { return _first_fit.get_high_water(); }
+  const Residency& get_residency() const {
+    return _first_fit.get_residency();
+  }
+
+  // Per tier: the bytes of the small blocks in use (rounded up to their
+  // classes), and of the slabs that hold them; and the bytes of the large
+  // blocks.
+  size_t SmallBytes() const { return _small_bytes; }
+  size_t SlabBytes() const {
+    return (_slabs.size() - _free_ids.size()) * _options.slab_size;
+  }
+  size_t LargeBytes() const { return _large_bytes; }
+
+ private:
+  struct Slab {
+    size_t start;
+    size_t size_class;
+    // Where it is in `_partial[size_class]`, if it has free slots.
+    size_t partial_index;
+    std::vector<uint32_t> free;
+  };
+
+  size_t Class(size_t size) const {
+    return (size - 1) / _options.granularity;
+  }
+  size_t ClassSize(size_t c) const { return (c + 1) * _options.granularity; }
+  size_t SlotsPerSlab(size_t c) const {
+    return _options.slab_size / ClassSize(c);
+  }
+
+  void NewSlab(size_t c) {
+    size_t id;
+    if (_free_ids.empty()) {
+      id = _slabs.size();
+      _slabs.emplace_back();
+    } else {
+      id = _free_ids.back();
+      _free_ids.pop_back();
+    }
+    Slab& slab = _slabs[id];
+    slab.start = _first_fit.Alloc(_options.slab_size).start();
+    slab.size_class = c;
+    slab.partial_index = _partial[c].size();
+    // Hand out the lowest slots first.
+    slab.free.clear();
+    for (size_t slot = SlotsPerSlab(c); slot-- > 0;) {
+      slab.free.push_back(static_cast<uint32_t>(slot));
+    }
+    _partial[c].push_back(id);
+    _by_start[slab.start] = id;
+  }
+
+  void FreeSlab(size_t id) {
+    Slab& slab = _slabs[id];
+    std::vector<size_t>& partial = _partial[slab.size_class];
+    // Swap it with the last partial slab, and drop it.
+    size_t last = partial.back();
+    partial[slab.partial_index] = last;
+    _slabs[last].partial_index = slab.partial_index;
+    partial.pop_back();
+    _first_fit.Free(Block(slab.start, _options.slab_size));
+    _by_start.erase(slab.start);
+    slab.free = {};
+    _free_ids.push_back(id);
+  }
+
+  HybridOptions _options;
+  FirstFit _first_fit;
+  // By id: every slab (those in `_free_ids` aren't in use).
+  std::vector<Slab> _slabs;
+  std::vector<size_t> _free_ids;
+  // By class: the slabs with free slots.
+  std::vector<std::vector<size_t>> _partial;
+  // The slabs in use, by start.
+  std::map<size_t, size_t> _by_start;
+  size_t _small_bytes = 0;
+  size_t _large_bytes = 0;
+};
+
+#endif  // HYBRID_H_
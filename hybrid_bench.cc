@@ -0,0 +1,87 @@
+// Benchmarks for `hybrid.h`: first fit alone against slabs for small sizes
+// and first fit for large, in a steady state with about `live` blocks alive.
+// For each, the time per event, the high-water mark relative to the most
+// bytes requested at once, and how full the slabs are.  Run with `make
+// bench`, or `./hybrid_bench live...` for other sizes.
+
+#include "hybrid.h"
+
+#include "first_fit.h"
+#include "simulator.h"
+#include "workload.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+// Runs `trace` through `allocator` and prints the time per event (one
+// allocation and, in the steady state, one free) and the high water / max
+// live.
+template <class Allocator>
+void Run(const char* name, const std::vector<Request>& trace,
+         Allocator& allocator) {
+  Simulator<Allocator> simulator(allocator);
+  size_t max_live = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < trace.size(); ++i) {
+    simulator.AdvanceTo(i);
+    simulator.Allocate(trace[i].size, LifetimeTicks(trace[i].lifetime));
+    max_live = std::max(max_live, simulator.LiveBytes());
+  }
+  auto end = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  std::printf("  %-24s %8.1f ns/event   high water / max live %6.3f", name,
+              ns / static_cast<double>(trace.size()),
+              static_cast<double>(allocator.get_high_water()) /
+                  static_cast<double>(max_live));
+}
+
+// `sizes` with lifetimes averaging `live` ticks, against first fit and
+// hybrids with small sizes up to 128, 256 and 512 bytes.
+void Compare(const char* name, Hyperexponential sizes, size_t live) {
+  std::vector<Request> trace;
+  WorkloadStream stream(sizes, static_cast<double>(live), 1);
+  for (size_t i = 0; i < 10 * live; ++i) trace.push_back(stream.Next());
+  std::printf("%s, %zu live\n", name, live);
+  {
+    FirstFit ff;
+    Run("first fit", trace, ff);
+    std::printf("\n");
+  }
+  for (size_t max_small : {128u, 256u, 512u}) {
+    HybridOptions options;
+    options.max_small = max_small;
+    HybridFit hybrid(options);
+    char label[64];
+    std::snprintf(label, sizeof(label), "slabs up to %zu", max_small);
+    Run(label, trace, hybrid);
+    // At the end of the run: how full the slabs are, and the large tier's
+    // share of the bytes.
+    std::printf("   slabs %5.1f%% full   large %5.1f%%\n",
+                100 * static_cast<double>(hybrid.SmallBytes()) /
+                    static_cast<double>(hybrid.SlabBytes()),
+                100 * static_cast<double>(hybrid.LargeBytes()) /
+                    static_cast<double>(hybrid.LargeBytes() +
+                                        hybrid.SmallBytes()));
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<size_t> lives;
+  for (int i = 1; i < argc; ++i) {
+    lives.push_back(std::strtoul(argv[i], nullptr, 10));
+  }
+  if (lives.empty()) lives = {10'000, 100'000};
+  for (size_t live : lives) {
+    // Each tier alone, then both.
+    Compare("small (exponential, mean 64)", {1, 64, 64}, live);
+    Compare("large (exponential, mean 4096)", {1, 4096, 4096}, live);
+    Compare("hyperexp 90% 64 / 4096", {0.9, 64, 4096}, live);
+  }
+}
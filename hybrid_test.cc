@@ -0,0 +1,94 @@
+#include "hybrid.h"
+
+#include <random>
+#include <set>
+#include <vector>
+
+// Checks that `blocks` don't overlap.
+static void CheckDisjoint(const std::vector<Block>& blocks) {
+  std::set<Block> sorted(blocks.begin(), blocks.end());
+  assert(sorted.size() == blocks.size());
+  size_t end = 0;
+  for (const Block& block : sorted) {
+    assert(block.start() >= end);
+    end = block.end();
+  }
+}
+
+static void SlabTest() {
+  HybridOptions options;
+  options.slab_size = 256;
+  HybridFit hybrid(options);
+  // Four 64-byte slots to a slab, handed out from the bottom.
+  Block a = hybrid.Alloc(50);
+  assert(a == Block(0, 64));
+  assert(hybrid.Alloc(64) == Block(64, 64));
+  assert(hybrid.SmallBytes() == 128);
+  assert(hybrid.SlabBytes() == 256);
+  // Another class takes another slab.
+  Block b = hybrid.Alloc(10);
+  assert(b == Block(256, 16));
+  // Large blocks go first fit.
+  Block large = hybrid.Alloc(300);
+  assert(large == Block(512, 300));
+  assert(hybrid.LargeBytes() == 300);
+  // A freed slot is reused.
+  hybrid.Free(a);
+  assert(hybrid.Alloc(64) == a);
+  // Filling the slab takes another one, which goes back once it's empty, as
+  // the first has free slots again.
+  std::vector<Block> more;
+  for (size_t i = 0; i < 3; ++i) more.push_back(hybrid.Alloc(64));
+  assert(more[2] == Block(812, 64));
+  assert(hybrid.SlabBytes() == 3 * 256);
+  hybrid.Free(more[0]);
+  hybrid.Free(more[2]);
+  assert(hybrid.SlabBytes() == 2 * 256);
+  // The last slab of a class stays, even when it's empty.
+  hybrid.Free(more[1]);
+  hybrid.Free(a);
+  hybrid.Free(Block(64, 64));
+  assert(hybrid.SmallBytes() == 16);
+  assert(hybrid.SlabBytes() == 2 * 256);
+  hybrid.Free(large);
+  assert(hybrid.get_residency().pages.Pages() == 1);
+}
+
+// Random churn over both tiers: blocks never overlap, the tiers' bytes add
+// up, and when everything is freed only one slab per class is left.
+static void RandomizedTest() {
+  HybridFit hybrid;
+  std::default_random_engine engine(1);
+  std::uniform_int_distribution<size_t> small(1, 256);
+  std::uniform_int_distribution<size_t> large(257, 5000);
+  std::vector<Block> blocks;
+  size_t small_bytes = 0, large_bytes = 0;
+  for (size_t i = 0; i < 50'000; ++i) {
+    if (blocks.size() > 1000 || (!blocks.empty() && engine() % 2)) {
+      size_t j = engine() % blocks.size();
+      (blocks[j].size() > 256 ? large_bytes : small_bytes) -=
+          blocks[j].size();
+      hybrid.Free(blocks[j]);
+      blocks[j] = blocks.back();
+      blocks.pop_back();
+    } else {
+      size_t n = engine() % 4 ? small(engine) : large(engine);
+      Block block = hybrid.Alloc(n);
+      assert(block.size() >= n && block.size() < n + 16);
+      (block.size() > 256 ? large_bytes : small_bytes) += block.size();
+      blocks.push_back(block);
+    }
+    assert(hybrid.SmallBytes() == small_bytes);
+    assert(hybrid.LargeBytes() == large_bytes);
+    assert(hybrid.SmallBytes() <= hybrid.SlabBytes());
+  }
+  CheckDisjoint(blocks);
+  for (const Block& block : blocks) hybrid.Free(block);
+  assert(hybrid.SmallBytes() == 0 && hybrid.LargeBytes() == 0);
+  assert(hybrid.SlabBytes() <= 256 / 16 * (4 << 10));
+}
+
+int main() {
+  SlabTest();
+  RandomizedTest();
+}
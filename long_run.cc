@@ -0,0 +1,92 @@
+// Runs one long first-fit simulation, checkpointing as it goes:
+//
+//   ./long_run events [checkpoint [every]]
+//
+// runs until `events` allocations have been done.  If `checkpoint` exists,
+// the run resumes from it (or stops, if it can't be read), and a new
+// checkpoint is written every `every` events (default 10 million) and at the
+// end.  Prints the metrics (with percentiles of the block sizes, hole sizes
+// and time per step), and the share of the time spent writing checkpoints.
+
+#include "long_run.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+
+int main(int argc, char** argv) {
+  if (argc < 2 || argc > 4) {
+    std::fprintf(stderr, "usage: %s events [checkpoint [every]]\n", argv[0]);
+    return 2;
+  }
+  uint64_t events = std::strtoull(argv[1], nullptr, 10);
+  std::string path = argc > 2 ? argv[2] : "";
+  uint64_t every = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 10'000'000;
+  if (every == 0) every = events;
+  std::unique_ptr<LongRun> run;
+  // Only a missing checkpoint starts a fresh run: one that can't be read
+  // (corrupt, or from another version) would be overwritten by it.
+  if (!path.empty() && access(path.c_str(), F_OK) == 0) {
+    ReadCheckpointFile(path, [&](CheckpointReader& reader) {
+      run = LongRun::Restore(reader);
+    });
+    if (!run) {
+      std::fprintf(stderr, "reading %s failed (corrupt, or from another "
+                   "version); move it away to start over\n", path.c_str());
+      return 1;
+    }
+    std::printf("resuming at event %lu\n",
+                static_cast<unsigned long>(run->Events()));
+  }
+  if (!run) {
+    // About a million blocks live at once.
+    run = std::make_unique<LongRun>(Hyperexponential{0.9, 100, 10'000},
+                                    1'000'000, 1);
+  }
+  using Clock = std::chrono::steady_clock;
+  Clock::duration total{}, checkpointing{};
+  auto start = Clock::now();
+  while (run->Events() < events) {
+    run->Step();
+    if (!path.empty() &&
+        (run->Events() % every == 0 || run->Events() == events)) {
+      auto checkpoint_start = Clock::now();
+      if (!WriteCheckpointFile(path, [&](CheckpointWriter& writer) {
+            run->Save(writer);
+          })) {
+        std::fprintf(stderr, "writing %s failed\n", path.c_str());
+        return 1;
+      }
+      checkpointing += Clock::now() - checkpoint_start;
+    }
+  }
+  total = Clock::now() - start;
+  double max_live = static_cast<double>(run->MaxLive());
+  std::printf("events %lu  high water / max live %.4f  mean live / max live "
+              "%.4f\n",
+              static_cast<unsigned long>(run->Events()),
+              static_cast<double>(run->Allocator().get_high_water()) /
+                  max_live,
+              run->MeanLive() / max_live);
+  std::printf("%-16s %10s %10s %10s %10s %10s\n", "percentiles", "50%", "90%",
+              "99%", "99.9%", "max");
+  for (auto [name, sketch] : {std::pair{"block size", &run->BlockSizes()},
+                              std::pair{"hole size", &run->HoleSizes()},
+                              std::pair{"step ns", &run->StepTimes()}}) {
+    if (sketch->Count() == 0) continue;
+    std::printf("%-16s %10.0f %10.0f %10.0f %10.0f %10.0f\n", name,
+                sketch->Quantile(0.5), sketch->Quantile(0.9),
+                sketch->Quantile(0.99), sketch->Quantile(0.999),
+                sketch->Max());
+  }
+  std::printf("checkpointing %.3fs of %.3fs (%.2f%%)\n",
+              std::chrono::duration<double>(checkpointing).count(),
+              std::chrono::duration<double>(total).count(),
+              100 * std::chrono::duration<double>(checkpointing).count() /
+                  std::chrono::duration<double>(total).count());
+}
@@ -0,0 +1,127 @@
+/* One long first-fit simulation (hyperexponential sizes, exponential
+ * lifetimes, one allocation per tick) that can be checkpointed and restored.
+ *
+ * The whole state is saved: the configuration, the position in the workload
+ * stream (which is all the RNG state there is, since `CounterRng` is counter
+ * based), the allocator's blocks, the pending deaths, and the metrics.  A
+ * restored run makes exactly the same allocations as one that never stopped.
+ *
+ * Besides the peak and mean live bytes, the run keeps `KllSketch`es of the
+ * block sizes, the hole sizes and the time per step, so percentiles come out
+ * at a fixed memory cost however long it runs, and sketches from separate
+ * runs can be merged.  The holes are sampled by walking the whole layout
+ * each time as many steps have gone by as there are live blocks, which costs
+ * O(1) amortised per step.
+ */
+
+#ifndef LONG_RUN_H_
+#define LONG_RUN_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "checkpoint.h"
+#include "first_fit.h"
+#include "quantile_sketch.h"
+#include "simulator.h"
+#include "workload.h"
+
+class LongRun {
+ public:
+  LongRun(Hyperexponential sizes, double mean_lifetime, uint64_t seed)
+      :_sizes(sizes), _mean_lifetime(mean_lifetime), _seed(seed),
+       _stream(sizes, mean_lifetime, seed) {}
+
+  LongRun(const LongRun&) = delete;
+  LongRun& operator=(const LongRun&) = delete;
+
+  // Does the next allocation (after freeing what died by then).
+  void Step() {
+    auto start = std::chrono::steady_clock::now();
+    _simulator.AdvanceTo(_stream.Position());
+    Request request = _stream.Next();
+    _simulator.Allocate(request.size, LifetimeTicks(request.lifetime));
+    auto end = std::chrono::steady_clock::now();
+    _step_nanos.Add(std::chrono::duration<double, std::nano>(end - start)
+                        .count());
+    _block_sizes.Add(static_cast<double>(request.size));
+    _max_live = std::max(_max_live, _simulator.LiveBytes());
+    _live_sum += static_cast<double>(_simulator.LiveBytes());
+    if (++_steps_since_hole_sample >= _simulator.LiveBlocks()) {
+      _steps_since_hole_sample = 0;
+      _first_fit.ForAllHoles([&](size_t size) {
+        _hole_sizes.Add(static_cast<double>(size));
+      });
+    }
+  }
+
+  uint64_t Events() const { return _stream.Position(); }
+  size_t MaxLive() const { return _max_live; }
+  double MeanLive() const {
+    return Events() ? _live_sum / static_cast<double>(Events()) : 0;
+  }
+  const FirstFit& Allocator() const { return _first_fit; }
+  const KllSketch& BlockSizes() const { return _block_sizes; }
+  const KllSketch& HoleSizes() const { return _hole_sizes; }
+  // In nanoseconds.
+  const KllSketch& StepTimes() const { return _step_nanos; }
+
+  void Save(CheckpointWriter& writer) const {
+    writer.WriteDouble(_sizes.p_small);
+    writer.WriteDouble(_sizes.small_mean);
+    writer.WriteDouble(_sizes.large_mean);
+    writer.WriteDouble(_mean_lifetime);
+    writer.Write(_seed);
+    writer.Write(_stream.Position());
+    writer.Write(_max_live);
+    writer.WriteDouble(_live_sum);
+    writer.Write(_steps_since_hole_sample);
+    _block_sizes.Save(writer);
+    _hole_sizes.Save(writer);
+    _step_nanos.Save(writer);
+    _first_fit.Save(writer);
+    _simulator.Save(writer);
+  }
+
+  // Returns the run saved by `Save`, or null if `reader` fails.
+  static std::unique_ptr<LongRun> Restore(CheckpointReader& reader) {
+    Hyperexponential sizes;
+    sizes.p_small = reader.ReadDouble();
+    sizes.small_mean = reader.ReadDouble();
+    sizes.large_mean = reader.ReadDouble();
+    double mean_lifetime = reader.ReadDouble();
+    uint64_t seed = reader.Read();
+    auto run = std::make_unique<LongRun>(sizes, mean_lifetime, seed);
+    run->_stream.Seek(reader.Read());
+    run->_max_live = reader.Read();
+    run->_live_sum = reader.ReadDouble();
+    run->_steps_since_hole_sample = reader.Read();
+    run->_block_sizes.Restore(reader);
+    run->_hole_sizes.Restore(reader);
+    run->_step_nanos.Restore(reader);
+    run->_first_fit.Restore(reader);
+    run->_simulator.Restore(reader);
+    if (!reader.Ok()) return nullptr;
+    return run;
+  }
+
+ private:
+  Hyperexponential _sizes;
+  double _mean_lifetime;
+  uint64_t _seed;
+  WorkloadStream _stream;
+  FirstFit _first_fit;
+  Simulator<FirstFit> _simulator{_first_fit};
+  // The most bytes live at once, and the sum over ticks of the live bytes.
+  size_t _max_live = 0;
+  double _live_sum = 0;
+  KllSketch _block_sizes;
+  KllSketch _hole_sizes;
+  KllSketch _step_nanos;
+  size_t _steps_since_hole_sample = 0;
+};
+
+#endif  // LONG_RUN_H_
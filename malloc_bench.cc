@@ -0,0 +1,138 @@
+// Benchmarks for `malloc`, to compare glibc with the first-fit heap.  Run
+// with `make malloc-bench`, which runs it both ways.
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// The resident set size, in MiB.
+double RssMiB() {
+  long pages = 0, resident = 0;
+  if (FILE* f = std::fopen("/proc/self/statm", "r")) {
+    if (std::fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    std::fclose(f);
+  }
+  return static_cast<double>(resident) *
+         static_cast<double>(sysconf(_SC_PAGESIZE)) / (1 << 20);
+}
+
+// Calls `fun` and prints the time per operation and the resident set size
+// afterwards, where `fun` does `ops` operations.
+template <class Fun>
+void Time(const char* name, size_t ops, Fun fun) {
+  auto start = std::chrono::steady_clock::now();
+  fun();
+  auto end = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  std::printf("%-36s %10zu ops %8.1f ns/op %8.1f MiB RSS\n", name, ops,
+              ns / static_cast<double>(ops), RssMiB());
+}
+
+// Each thread keeps `slots` small blocks, and replaces a random one `ops`
+// times.
+void SmallChurn(size_t num_threads, size_t slots, size_t ops) {
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; ++t) {
+    threads.emplace_back([=]() {
+      std::default_random_engine engine(static_cast<unsigned>(t));
+      std::uniform_int_distribution<size_t> size(16, 256);
+      std::vector<void*> blocks(slots, nullptr);
+      for (size_t i = 0; i < ops; ++i) {
+        void*& block = blocks[engine() % slots];
+        std::free(block);
+        block = std::malloc(size(engine));
+        static_cast<char*>(block)[0] = 1;
+      }
+      for (void* block : blocks) std::free(block);
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+}
+
+// Blocks with hyperexponential sizes (90% with mean 64 bytes, 10% with mean
+// 16KiB) and exponential lifetimes, as in `fitness.cc`, written to so that
+// they are resident.
+void Hyperexponential(size_t ops) {
+  std::default_random_engine engine(1);
+  std::bernoulli_distribution small(0.9);
+  std::exponential_distribution<double> small_size(1.0 / 64);
+  std::exponential_distribution<double> large_size(1.0 / (16 << 10));
+  std::exponential_distribution<double> lifetime(1.0 / 10'000);
+  using Death = std::pair<double, void*>;
+  std::priority_queue<Death, std::vector<Death>, std::greater<Death>> deaths;
+  for (size_t i = 0; i < ops; ++i) {
+    double now = static_cast<double>(i);
+    while (!deaths.empty() && deaths.top().first <= now) {
+      std::free(deaths.top().second);
+      deaths.pop();
+    }
+    double size = small(engine) ? small_size(engine) : large_size(engine);
+    size_t bytes = static_cast<size_t>(size) + 1;
+    void* block = std::malloc(bytes);
+    std::memset(block, 1, bytes);
+    deaths.push({now + lifetime(engine), block});
+  }
+  while (!deaths.empty()) {
+    std::free(deaths.top().second);
+    deaths.pop();
+  }
+}
+
+// A `std::map` of strings, with random inserts and erases.
+void MapOfStrings(size_t ops) {
+  std::default_random_engine engine(2);
+  std::uniform_int_distribution<size_t> key(0, 100'000);
+  std::map<size_t, std::string> map;
+  for (size_t i = 0; i < ops; ++i) {
+    size_t k = key(engine);
+    if (i % 2) {
+      map.erase(k);
+    } else {
+      map[k] = std::string(k % 100, 'x');
+    }
+  }
+}
+
+// Buffers grown a little at a time with `realloc`.
+void ReallocGrowth(size_t buffers, size_t steps) {
+  std::vector<char*> blocks(buffers, nullptr);
+  for (size_t step = 1; step <= steps; ++step) {
+    for (char*& block : blocks) {
+      block = static_cast<char*>(std::realloc(block, step * 16));
+      block[step * 16 - 1] = 1;
+    }
+  }
+  for (char* block : blocks) std::free(block);
+}
+
+}  // namespace
+
+int main() {
+  std::printf("%s\n", std::getenv("LD_PRELOAD") ? std::getenv("LD_PRELOAD")
+                                                : "glibc malloc");
+  size_t num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  Time("small churn, 1 thread", 2'000'000,
+       []() { SmallChurn(1, 10'000, 2'000'000); });
+  Time("small churn, all threads", 2'000'000 * num_threads,
+       [=]() { SmallChurn(num_threads, 10'000, 2'000'000); });
+  Time("hyperexponential sizes and lifetimes", 1'000'000,
+       []() { Hyperexponential(1'000'000); });
+  Time("std::map of strings", 1'000'000, []() { MapOfStrings(1'000'000); });
+  Time("realloc growth", 1'000 * 1'000, []() { ReallocGrowth(1'000, 1'000); });
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  std::printf("max RSS %.1f MiB\n", static_cast<double>(usage.ru_maxrss) / 1024);
+}
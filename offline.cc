@@ -0,0 +1,74 @@
+// Judges first fit against offline bounds on a synthetic trace: the most
+// bytes live at once (a lower bound for any placement) and clairvoyant
+// packings that know every lifetime (upper bounds on the best placement).
+// Run with `make offline && ./offline [events [mean_lifetime]]`; 10^8 events
+// take about 5GB.
+
+#include "offline.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+// Calls `fun` and prints how long it took.
+template <class Fun>
+auto Time(const char* name, Fun fun) {
+  auto start = std::chrono::steady_clock::now();
+  auto result = fun();
+  auto end = std::chrono::steady_clock::now();
+  std::printf("  %-36s %8.2f s\n", name,
+              std::chrono::duration<double>(end - start).count());
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t events = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10'000'000;
+  double mean_lifetime = argc > 2 ? std::strtod(argv[2], nullptr) : 100'000;
+  constexpr Hyperexponential kSizes{0.9, 100, 10'000};
+  std::printf("%zu events, hyperexp 90%% 100 / 10000, mean lifetime %.0f\n",
+              events, mean_lifetime);
+  ThreadPool pool;
+  std::vector<Interval> intervals = Time("trace", [&]() {
+    WorkloadStream stream(kSizes, mean_lifetime, 1);
+    std::vector<Interval> result(events);
+    for (size_t i = 0; i < events; ++i) {
+      result[i] = ToInterval(i, stream.Next());
+    }
+    return result;
+  });
+  std::vector<Death> deaths =
+      Time("sort deaths", [&]() { return SortedDeaths(pool, intervals); });
+  double max_live = static_cast<double>(
+      Time("max live", [&]() { return MaxLive(intervals, deaths); }));
+  auto ignore = [](size_t, size_t) {};
+  size_t first_fit = Time("first fit", [&]() {
+    return PackByLifetime(intervals, deaths, UINT64_MAX, ignore);
+  });
+  size_t by_class = Time("size classes, 8 per octave", [&]() {
+    return PackBySizeClass(intervals, deaths, 8, ignore);
+  });
+  auto threshold = static_cast<uint64_t>(mean_lifetime);
+  size_t by_lifetime_1x = Time("lifetime > mean at the high end", [&]() {
+    return PackByLifetime(intervals, deaths, threshold, ignore);
+  });
+  size_t by_lifetime_4x = Time("lifetime > 4x mean at the high end", [&]() {
+    return PackByLifetime(intervals, deaths, 4 * threshold, ignore);
+  });
+  size_t best = std::min({by_class, by_lifetime_1x, by_lifetime_4x});
+  std::printf("high water / max live\n");
+  std::printf("  %-36s %8.3f\n", "first fit",
+              static_cast<double>(first_fit) / max_live);
+  std::printf("  %-36s %8.3f\n", "size classes",
+              static_cast<double>(by_class) / max_live);
+  std::printf("  %-36s %8.3f\n", "lifetime > mean",
+              static_cast<double>(by_lifetime_1x) / max_live);
+  std::printf("  %-36s %8.3f\n", "lifetime > 4x mean",
+              static_cast<double>(by_lifetime_4x) / max_live);
+  std::printf("first fit / best clairvoyant %8.3f\n",
+              static_cast<double>(first_fit) / static_cast<double>(best));
+}
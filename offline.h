@@ -0,0 +1,195 @@
+/* Offline analysis of a trace, to judge an allocator's high-water mark
+ * against what knowing the whole trace in advance would allow.
+ *
+ * A trace is one allocation per tick (as in `fitness.cc`): allocation i
+ * happens at tick i, and is freed at the start of tick i + lifetime (or
+ * i + 1, for a lifetime of zero), before that tick's allocation.  So it is
+ * live during the ticks `[start, end)` of its `Interval`, and the blocks
+ * live at a tick are the ones whose intervals contain it.
+ *
+ * - `MaxLive` is the most bytes live at once, a lower bound for any
+ *   placement.  It merges the starts (in order already) with the deaths,
+ *   sorted in parallel, in one pass.
+ * - `PackBySizeClass` and `PackByLifetime` are clairvoyant packings, upper
+ *   bounds on the best placement.  The first rounds sizes up to classes
+ *   (`classes_per_octave` to each power of two) and gives each class its own
+ *   region, in which it colors the intervals optimally: a block takes the
+ *   lowest slot free at its start, so the region has as many slots as the
+ *   class ever has blocks live at once.  The second is first fit, except that
+ *   blocks that will live longer than `threshold` go to the high end
+ *   (`TwoEndedFit`), as only a clairvoyant allocator could know.
+ *
+ * Everything but the sort is a sequential pass, in O(n log n) time at worst
+ * (the heaps of free slots, and the layout's treap), and the memory is about
+ * 50 bytes per event (the intervals, the deaths and the placements), so
+ * 10^8 events take about 5GB.
+ */
+
+#ifndef OFFLINE_H_
+#define OFFLINE_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <span>
+#include <vector>
+
+#include "first_fit.h"
+#include "simulator.h"
+#include "thread_pool.h"
+#include "workload.h"
+
+// The ticks during which a block is live, `[start, end)`, and its size.
+struct Interval {
+  uint64_t start;
+  uint64_t end;
+  size_t size;
+};
+
+// The interval of `request`, allocated at tick `tick`.
+inline Interval ToInterval(uint64_t tick, Request request) {
+  uint64_t lifetime = std::max(LifetimeTicks(request.lifetime), uint64_t(1));
+  return {tick, tick + lifetime, request.size};
+}
+
+// The intervals of `trace`, in order of start.
+inline std::vector<Interval> ToIntervals(std::span<const Request> trace) {
+  std::vector<Interval> intervals(trace.size());
+  for (size_t i = 0; i < trace.size(); ++i) {
+    intervals[i] = ToInterval(i, trace[i]);
+  }
+  return intervals;
+}
+
+// When interval `index` ends.
+struct Death {
+  uint64_t time;
+  size_t index;
+
+  bool operator<(const Death& other) const { return time < other.time; }
+};
+
+// The deaths of `intervals`, in order of time, sorted with `pool`.  Ties
+// stay in order of start.
+inline std::vector<Death> SortedDeaths(ThreadPool& pool,
+                                       std::span<const Interval> intervals) {
+  std::vector<Death> deaths(intervals.size());
+  for (size_t i = 0; i < intervals.size(); ++i) {
+    deaths[i] = {intervals[i].end, i};
+  }
+  ParallelSort(pool, deaths.begin(), deaths.end());
+  return deaths;
+}
+
+// Calls `free(index)` for each interval that ends by the start of interval
+// `i` and `alloc(i)` for each interval `i`, in time order.  `intervals` must
+// be in order of start.
+template <class Alloc, class Free>
+void Sweep(std::span<const Interval> intervals, std::span<const Death> deaths,
+           Alloc alloc, Free free) {
+  size_t next_death = 0;
+  for (size_t i = 0; i < intervals.size(); ++i) {
+    assert(i == 0 || intervals[i - 1].start <= intervals[i].start);
+    while (next_death < deaths.size() &&
+           deaths[next_death].time <= intervals[i].start) {
+      free(deaths[next_death++].index);
+    }
+    alloc(i);
+  }
+}
+
+// The most bytes live at once.
+inline size_t MaxLive(std::span<const Interval> intervals,
+                      std::span<const Death> deaths) {
+  size_t live = 0, max_live = 0;
+  Sweep(intervals, deaths,
+        [&](size_t i) {
+          live += intervals[i].size;
+          max_live = std::max(max_live, live);
+        },
+        [&](size_t i) { live -= intervals[i].size; });
+  return max_live;
+}
+
+// Packs the blocks by size class (see above), calling `place(i, start)` for
+// each interval in order, and returns the height of the packing.
+template <class Place>
+size_t PackBySizeClass(std::span<const Interval> intervals,
+                       std::span<const Death> deaths,
+                       size_t classes_per_octave, Place place) {
+  // Each class's size, its lowest free slots, and the number of slots used
+  // so far.
+  using MinHeap = std::priority_queue<uint32_t, std::vector<uint32_t>,
+                                      std::greater<uint32_t>>;
+  std::vector<size_t> class_sizes;
+  std::vector<MinHeap> free_slots;
+  std::vector<uint32_t> slot_counts;
+  auto class_of = [&](size_t size) {
+    double octaves = std::log2(static_cast<double>(size));
+    auto c = static_cast<size_t>(
+        std::ceil(octaves * static_cast<double>(classes_per_octave)));
+    for (;; ++c) {
+      while (class_sizes.size() <= c) {
+        double n = static_cast<double>(class_sizes.size());
+        class_sizes.push_back(static_cast<size_t>(
+            std::ceil(std::exp2(n / static_cast<double>(classes_per_octave)))));
+        free_slots.emplace_back();
+        slot_counts.push_back(0);
+      }
+      // Rounding may leave a class a byte too small.
+      if (class_sizes[c] >= size) return c;
+    }
+  };
+  std::vector<uint32_t> slots(intervals.size());
+  std::vector<uint16_t> classes(intervals.size());
+  Sweep(intervals, deaths,
+        [&](size_t i) {
+          size_t c = class_of(intervals[i].size);
+          classes[i] = static_cast<uint16_t>(c);
+          if (free_slots[c].empty()) {
+            slots[i] = slot_counts[c]++;
+          } else {
+            slots[i] = free_slots[c].top();
+            free_slots[c].pop();
+          }
+        },
+        [&](size_t i) { free_slots[classes[i]].push(slots[i]); });
+  // The regions, one after another.
+  std::vector<size_t> bases(class_sizes.size() + 1, 0);
+  for (size_t c = 0; c < class_sizes.size(); ++c) {
+    bases[c + 1] = bases[c] + slot_counts[c] * class_sizes[c];
+  }
+  for (size_t i = 0; i < intervals.size(); ++i) {
+    place(i, bases[classes[i]] + slots[i] * class_sizes[classes[i]]);
+  }
+  return bases.back();
+}
+
+// First fit, but with blocks that live longer than `threshold` ticks at the
+// high end.  Calls `place(i, start)` for each interval as it's placed, and
+// returns the high-water mark.
+template <class Place>
+size_t PackByLifetime(std::span<const Interval> intervals,
+                      std::span<const Death> deaths, uint64_t threshold,
+                      Place place) {
+  TwoEndedFit fit;
+  std::vector<size_t> starts(intervals.size());
+  Sweep(intervals, deaths,
+        [&](size_t i) {
+          const Interval& interval = intervals[i];
+          Block block = fit.Alloc(interval.size,
+                                  interval.end - interval.start > threshold
+                                      ? TwoEndedFit::End::kHigh
+                                      : TwoEndedFit::End::kLow);
+          starts[i] = block.start();
+          place(i, block.start());
+        },
+        [&](size_t i) { fit.Free(Block(starts[i], intervals[i].size)); });
+  return fit.get_high_water();
+}
+
+#endif  // OFFLINE_H_
@@ -0,0 +1,66 @@
+#include "offline.h"
+
+#include <vector>
+
+// Checks that no two blocks live at the same tick overlap, given each
+// interval's start address.
+static void CheckPacking(const std::vector<Interval>& intervals,
+                         const std::vector<size_t>& starts, size_t height) {
+  for (size_t i = 0; i < intervals.size(); ++i) {
+    assert(starts[i] + intervals[i].size <= height);
+    // Those that start later, while `i` is live.
+    for (size_t j = i + 1;
+         j < intervals.size() && intervals[j].start < intervals[i].end; ++j) {
+      assert(starts[i] + intervals[i].size <= starts[j] ||
+             starts[j] + intervals[j].size <= starts[i]);
+    }
+  }
+}
+
+static void OfflineTest() {
+  ThreadPool pool(4);
+  for (unsigned seed = 1; seed <= 3; ++seed) {
+    WorkloadStream stream({0.9, 100, 10'000}, 300, seed);
+    std::vector<Request> trace;
+    for (size_t i = 0; i < 5'000; ++i) trace.push_back(stream.Next());
+    std::vector<Interval> intervals = ToIntervals(trace);
+    std::vector<Death> deaths = SortedDeaths(pool, intervals);
+    assert(std::is_sorted(deaths.begin(), deaths.end()));
+    // The same as the simulator's, with first fit.
+    FirstFit ff;
+    Simulator<FirstFit> simulator(ff);
+    size_t max_live = 0;
+    for (size_t i = 0; i < trace.size(); ++i) {
+      simulator.AdvanceTo(i);
+      simulator.Allocate(trace[i].size, LifetimeTicks(trace[i].lifetime));
+      max_live = std::max(max_live, simulator.LiveBytes());
+    }
+    assert(MaxLive(intervals, deaths) == max_live);
+    // Valid packings, no lower than the bound.
+    std::vector<size_t> starts(intervals.size());
+    auto place = [&](size_t i, size_t start) { starts[i] = start; };
+    for (size_t classes_per_octave : {1u, 8u}) {
+      size_t height =
+          PackBySizeClass(intervals, deaths, classes_per_octave, place);
+      assert(height >= max_live);
+      CheckPacking(intervals, starts, height);
+    }
+    size_t height = PackByLifetime(intervals, deaths, 300, place);
+    assert(height >= max_live);
+    CheckPacking(intervals, starts, height);
+    // With nothing at the high end, it's first fit.
+    assert(PackByLifetime(intervals, deaths, UINT64_MAX, place) ==
+           ff.get_high_water());
+  }
+  // One class of equal blocks packs into as many slots as are ever live.
+  std::vector<Interval> intervals = {
+      {0, 3, 8}, {1, 2, 8}, {2, 5, 8}, {3, 4, 8}, {4, 5, 8}};
+  ThreadPool one(1);
+  std::vector<Death> deaths = SortedDeaths(one, intervals);
+  assert(MaxLive(intervals, deaths) == 16);
+  assert(PackBySizeClass(intervals, deaths, 4, [](size_t, size_t) {}) == 16);
+}
+
+int main() {
+  OfflineTest();
+}
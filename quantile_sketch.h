@@ -0,0 +1,207 @@
+/* A streaming quantile sketch (KLL: Karnin, Lang and Liberty, "Optimal
+ * Quantile Approximation in Streams", 2016), for distributions that are too
+ * big to keep exactly, such as the hole sizes of a 64GiB heap.
+ *
+ * The sketch keeps a stack of compactors.  Level `h` holds values that each
+ * stand for `2^h` of the original ones.  When the sketch is over capacity,
+ * the lowest full level is sorted and every other value (starting at a
+ * random one of the first two) moves up a level, halving the level with an
+ * unbiased error.  Capacities shrink by 2/3 per level going down from the
+ * top, so the sketch holds O(k) values whatever the stream length, and a
+ * rank's error is about 1.7 / k of the count with high probability (about
+ * 1% for the default `k` of 200).
+ *
+ * Sketches of the same `k` can be merged (for example across threads or
+ * runs), with the same error bound as if one sketch had seen both streams.
+ * The coin flips come from a seeded generator, so a run is reproducible, and
+ * `Save`/`Restore` checkpoint the whole state.
+ */
+
+#ifndef QUANTILE_SKETCH_H_
+#define QUANTILE_SKETCH_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "checkpoint.h"
+
+class KllSketch {
+ public:
+  explicit KllSketch(size_t k = 200, uint64_t seed = 1)
+      :_k(std::max(k, size_t(8))), _random(seed), _levels(1) {
+    UpdateCapacity();
+  }
+
+  void Add(double value) {
+    _min = std::min(_min, value);
+    _max = std::max(_max, value);
+    ++_count;
+    _levels[0].push_back(value);
+    ++_size;
+    if (_size > _capacity) Compress();
+  }
+
+  // Adds everything `other` has seen.  Both must have the same `k`.  `other`
+  // may be this sketch, which then counts everything twice.
+  void Merge(const KllSketch& other) {
+    assert(_k == other._k);
+    if (&other == this) {
+      // Appending a level to itself would read what it's writing.
+      KllSketch copy = other;
+      Merge(copy);
+      return;
+    }
+    if (other._levels.size() > _levels.size()) {
+      _levels.resize(other._levels.size());
+    }
+    for (size_t h = 0; h < other._levels.size(); ++h) {
+      _levels[h].insert(_levels[h].end(), other._levels[h].begin(),
+                        other._levels[h].end());
+    }
+    _size += other._size;
+    _count += other._count;
+    _min = std::min(_min, other._min);
+    _max = std::max(_max, other._max);
+    UpdateCapacity();
+    while (_size > _capacity) Compress();
+  }
+
+  // The number of values added.
+  uint64_t Count() const { return _count; }
+  // The number of values stored, which is O(k).
+  size_t Size() const { return _size; }
+  double Min() const { return _min; }
+  double Max() const { return _max; }
+
+  // The approximate fraction of the values that are at most `value`.
+  double Rank(double value) const {
+    if (_count == 0) return 0;
+    uint64_t weight = 0;
+    for (size_t h = 0; h < _levels.size(); ++h) {
+      for (double x : _levels[h]) {
+        if (x <= value) weight += uint64_t(1) << h;
+      }
+    }
+    return static_cast<double>(weight) / static_cast<double>(_count);
+  }
+
+  // The approximate `q` quantile, for `q` in [0, 1]: the smallest stored
+  // value whose rank is at least `q`.  The sketch must not be empty.
+  double Quantile(double q) const {
+    assert(_count > 0);
+    if (q <= 0) return _min;
+    if (q >= 1) return _max;
+    std::vector<std::pair<double, uint64_t>> weighted;
+    weighted.reserve(_size);
+    for (size_t h = 0; h < _levels.size(); ++h) {
+      for (double x : _levels[h]) weighted.emplace_back(x, uint64_t(1) << h);
+    }
+    std::sort(weighted.begin(), weighted.end());
+    double target = q * static_cast<double>(_count);
+    uint64_t cumulative = 0;
+    for (const auto& [x, weight] : weighted) {
+      cumulative += weight;
+      if (static_cast<double>(cumulative) >= target) return x;
+    }
+    return _max;
+  }
+
+  void Save(CheckpointWriter& writer) const {
+    writer.Write(_k);
+    writer.Write(_random);
+    writer.Write(_count);
+    writer.WriteDouble(_min);
+    writer.WriteDouble(_max);
+    writer.Write(_levels.size());
+    for (const std::vector<double>& level : _levels) {
+      writer.Write(level.size());
+      for (double x : level) writer.WriteDouble(x);
+    }
+  }
+
+  void Restore(CheckpointReader& reader) {
+    _k = reader.Read();
+    _random = reader.Read();
+    _count = reader.Read();
+    _min = reader.ReadDouble();
+    _max = reader.ReadDouble();
+    // There are at most 64 levels, since each weight fits in 64 bits.
+    _levels.assign(std::clamp(reader.Read(), uint64_t(1), uint64_t(64)), {});
+    _size = 0;
+    for (std::vector<double>& level : _levels) {
+      size_t size = reader.Read();
+      for (size_t i = 0; i < size && reader.Ok(); ++i) {
+        level.push_back(reader.ReadDouble());
+      }
+      _size += level.size();
+    }
+    UpdateCapacity();
+  }
+
+ private:
+  // The capacity of level `h`, which is `k` at the top and shrinks by 2/3 per
+  // level below it, but is never less than 2.
+  size_t LevelCapacity(size_t h) const {
+    size_t depth = _levels.size() - 1 - h;
+    double capacity = static_cast<double>(_k) * std::pow(2.0 / 3, depth);
+    return std::max(size_t(2), static_cast<size_t>(std::ceil(capacity)));
+  }
+
+  // Sets `_capacity`, the total of the level capacities, which only changes
+  // when a level is added.
+  void UpdateCapacity() {
+    _capacity = 0;
+    for (size_t h = 0; h < _levels.size(); ++h) _capacity += LevelCapacity(h);
+  }
+
+  // Halves the lowest level that is at capacity, moving half of it up.
+  void Compress() {
+    size_t h = 0;
+    while (_levels[h].size() < LevelCapacity(h)) {
+      ++h;
+      // Some level is always full when the sketch is over capacity.
+      assert(h < _levels.size());
+    }
+    if (h + 1 == _levels.size()) {
+      _levels.emplace_back();
+      UpdateCapacity();
+    }
+    std::vector<double>& level = _levels[h];
+    std::sort(level.begin(), level.end());
+    // With an odd number, the largest value stays behind.
+    size_t pairs = level.size() / 2;
+    size_t offset = NextBit();
+    for (size_t i = 0; i < pairs; ++i) {
+      _levels[h + 1].push_back(level[2 * i + offset]);
+    }
+    size_t leftover = level.size() % 2;
+    if (leftover) level[0] = level.back();
+    level.resize(leftover);
+    _size -= pairs;
+  }
+
+  // A random bit (splitmix64).
+  size_t NextBit() {
+    uint64_t z = (_random += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return static_cast<size_t>((z ^ (z >> 31)) & 1);
+  }
+
+  size_t _k;
+  uint64_t _random;
+  std::vector<std::vector<double>> _levels;
+  size_t _size = 0;
+  size_t _capacity = 0;
+  uint64_t _count = 0;
+  double _min = std::numeric_limits<double>::infinity();
+  double _max = -std::numeric_limits<double>::infinity();
+};
+
+#endif  // QUANTILE_SKETCH_H_
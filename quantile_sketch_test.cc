@@ -0,0 +1,108 @@
+#include "quantile_sketch.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// The true rank of `value` in `sorted`.
+static double TrueRank(const std::vector<double>& sorted, double value) {
+  auto it = std::upper_bound(sorted.begin(), sorted.end(), value);
+  return static_cast<double>(it - sorted.begin()) /
+         static_cast<double>(sorted.size());
+}
+
+// Checks that the sketch's quantiles have true ranks within `epsilon`.
+static void CheckQuantiles(const KllSketch& sketch, std::vector<double> values,
+                           double epsilon) {
+  std::sort(values.begin(), values.end());
+  assert(sketch.Count() == values.size());
+  assert(sketch.Min() == values.front());
+  assert(sketch.Max() == values.back());
+  for (double q = 0.01; q < 1; q += 0.01) {
+    double rank = TrueRank(values, sketch.Quantile(q));
+    assert(std::abs(rank - q) <= epsilon);
+    assert(std::abs(sketch.Rank(sketch.Quantile(q)) - rank) <= epsilon);
+  }
+}
+
+static void AccuracyTest() {
+  std::default_random_engine engine(1);
+  std::exponential_distribution<double> exponential(0.001);
+  KllSketch sketch;
+  std::vector<double> values;
+  for (size_t i = 0; i < 1'000'000; ++i) {
+    values.push_back(std::floor(exponential(engine)));
+    sketch.Add(values.back());
+    // The memory stays bounded.
+    assert(sketch.Size() <= 3 * 200 + 64);
+  }
+  CheckQuantiles(sketch, values, 0.015);
+  // A small stream is kept exactly.
+  KllSketch small;
+  for (double x : {3.0, 1.0, 2.0}) small.Add(x);
+  assert(small.Quantile(0.5) == 2);
+  assert(small.Rank(1.5) == 1.0 / 3);
+}
+
+// Merging the sketches of parts of a stream is as good as sketching all of
+// it, however unequal the parts.
+static void MergeTest() {
+  std::default_random_engine engine(2);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::vector<double> values;
+  KllSketch merged;
+  for (size_t part = 0; part < 8; ++part) {
+    KllSketch sketch(200, part + 1);
+    size_t n = size_t(1000) << part;
+    for (size_t i = 0; i < n; ++i) {
+      values.push_back(uniform(engine) + static_cast<double>(part));
+      sketch.Add(values.back());
+    }
+    merged.Merge(sketch);
+  }
+  assert(merged.Size() <= 3 * 200 + 64);
+  CheckQuantiles(merged, values, 0.015);
+  // Merging a sketch with itself counts every value twice.
+  merged.Merge(merged);
+  std::vector<double> twice = values;
+  twice.insert(twice.end(), values.begin(), values.end());
+  assert(merged.Size() <= 3 * 200 + 64);
+  CheckQuantiles(merged, twice, 0.015);
+}
+
+static void SaveRestoreTest() {
+  KllSketch sketch;
+  for (size_t i = 0; i < 100'000; ++i) {
+    sketch.Add(static_cast<double>(i * 7919 % 100'003));
+  }
+  FILE* file = std::tmpfile();
+  {
+    CheckpointWriter writer(file);
+    sketch.Save(writer);
+  }
+  std::rewind(file);
+  KllSketch restored(8, 0);
+  CheckpointReader reader(file);
+  restored.Restore(reader);
+  assert(reader.Ok());
+  std::fclose(file);
+  // Both go on the same way, coin flips included.
+  for (size_t i = 0; i < 100'000; ++i) {
+    sketch.Add(static_cast<double>(i));
+    restored.Add(static_cast<double>(i));
+  }
+  assert(restored.Count() == sketch.Count());
+  assert(restored.Size() == sketch.Size());
+  for (double q = 0; q <= 1; q += 0.05) {
+    assert(restored.Quantile(q) == sketch.Quantile(q));
+  }
+}
+
+int main() {
+  AccuracyTest();
+  MergeTest();
+  SaveRestoreTest();
+}
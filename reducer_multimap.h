@@ -0,0 +1,395 @@
+/* A multimap version of `ReducerTree`: keys may repeat.  Free holes, say, can
+ * then be indexed by size alone, rather than by a (size, address) pair that
+ * doubles the key and makes every comparison slower.
+ *
+ * Elements with equal keys are ordered by `Tiebreak`, which compares their
+ * values (and is only called on equal keys).  The default, `InsertionOrder`,
+ * finds them all equivalent, so equal keys stay in the order they were
+ * inserted: a new element goes after the equivalent ones.
+ *
+ * The tree is a treap of `ReducerNode`s, like `ReducerTree`'s, whose
+ * reductions also count their elements (see `Counted`).  So `Count(key)` and
+ * `ReduceEqual(key)`, the reduction over the run of elements with `key`, take
+ * O(log n) expected time, as do `Insert` and `EraseOne`.  `EraseAll` takes
+ * O(log n + k) to remove k elements.
+ *
+ * There's no finger, lazy mode or parallel building: every mutation descends
+ * from the root and refreshes what it changed before returning.
+ */
+
+#ifndef REDUCER_MULTIMAP_H_
+#define REDUCER_MULTIMAP_H_
+
+#include <cassert>
+#include <compare>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <random>
+#include <tuple>
+#include <utility>
+
+#include "reducer_tree.h"
+
+// Orders elements with equal keys by when they were inserted.
+struct InsertionOrder {
+  template <class V>
+  std::weak_ordering operator()(const V&, const V&) const {
+    return std::weak_ordering::equivalent;
+  }
+};
+
+// A reduction along with the number of elements it reduces.
+template <class Reducer>
+class Counted {
+ public:
+  Counted() = default;
+  template <class K, class V>
+  Counted(const K& key, const V& value) :_count(1), _reduced(key, value) {}
+  Counted operator+(const Counted& other) const {
+    Counted result;
+    result._count = _count + other._count;
+    result._reduced = _reduced + other._reduced;
+    return result;
+  }
+  size_t count() const { return _count; }
+  const Reducer& reduced() const { return _reduced; }
+ private:
+  size_t _count = 0;
+  Reducer _reduced;
+};
+
+template <class K, class V, class Reducer, class Tiebreak = InsertionOrder>
+class ReducerMultimap {
+ private:
+  using Node = ReducerNode<K, V, Counted<Reducer>>;
+  using Ptr = std::unique_ptr<Node>;
+ public:
+  using key_type = K;
+  using value_type = V;
+  using reducer_type = Reducer;
+
+  explicit ReducerMultimap(Tiebreak tiebreak = Tiebreak())
+      :_tiebreak(std::move(tiebreak)) {}
+
+  // Inserts `{key, value}` after the elements that are equivalent to it.
+  void Insert(key_type key, value_type value) {
+    Ptr node = std::make_unique<Node>(_uniform_distribution(_engine),
+                                      std::move(key), std::move(value));
+    const Node& inserted = *node;
+    _root = Insert(std::move(_root), std::move(node), [&](const Node& other) {
+      return std::is_lt(Compare(inserted._key, inserted._value, other));
+    });
+    ++_size;
+    Refresh();
+  }
+
+  // The number of elements with key `key`.
+  template <LookupKeyFor<K> Q>
+  size_t Count(const Q& key) const {
+    return EqualRun(key).count();
+  }
+  size_t Count(const key_type& key) const { return Count<key_type>(key); }
+
+  // The reduction of the elements with key `key`.
+  template <LookupKeyFor<K> Q>
+  reducer_type ReduceEqual(const Q& key) const {
+    return EqualRun(key).reduced();
+  }
+  reducer_type ReduceEqual(const key_type& key) const {
+    return ReduceEqual<key_type>(key);
+  }
+
+  // Returns the reduction of the whole tree.
+  reducer_type Reduce() const { return Node::Reduce(_root).reduced(); }
+
+  // Returns the reduction of all the elements whose keys are `<` key.
+  template <LookupKeyFor<K> Q>
+  reducer_type PrefixLt(const Q& key) const {
+    return ReduceBefore(_root.get(), AtOrAfter(key)).reduced();
+  }
+  reducer_type PrefixLt(const key_type& key) const {
+    return PrefixLt<key_type>(key);
+  }
+
+  // Returns the first element with key `key` (the first inserted, for
+  // `InsertionOrder`), or `std::nullopt` if there is none.
+  template <LookupKeyFor<K> Q>
+  std::optional<std::tuple<const key_type&, const value_type&>> FindFirst(
+      const Q& key) const {
+    auto at_or_after = AtOrAfter(key);
+    const Node* first = nullptr;
+    for (const Node* node = _root.get(); node;) {
+      if (at_or_after(*node)) {
+        first = node;
+        node = node->_left.get();
+      } else {
+        node = node->_right.get();
+      }
+    }
+    if (!first || !std::is_eq(key <=> first->_key)) {
+      return std::nullopt;
+    }
+    return std::tuple<const key_type&, const value_type&>(first->_key,
+                                                          first->_value);
+  }
+  std::optional<std::tuple<const key_type&, const value_type&>> FindFirst(
+      const key_type& key) const {
+    return FindFirst<key_type>(key);
+  }
+
+  // Removes the first element with key `key`, if there is one.  Returns true
+  // if an element was removed.
+  template <LookupKeyFor<K> Q>
+  bool EraseOne(const Q& key) {
+    return EraseFirst(AtOrAfter(key), [&](const Node& node) {
+      return std::is_eq(key <=> node._key);
+    });
+  }
+  bool EraseOne(const key_type& key) { return EraseOne<key_type>(key); }
+
+  // Removes the first element equivalent to `{key, value}` (the element with
+  // that value, when `Tiebreak` orders the values of equal keys totally).
+  // Under `InsertionOrder` every element with the key would be equivalent, so
+  // this would ignore `value`; it isn't provided there.
+  bool EraseOne(const key_type& key, const value_type& value)
+    requires (!std::same_as<Tiebreak, InsertionOrder>) {
+    return EraseFirst(
+        [&](const Node& node) {
+          return std::is_lteq(Compare(key, value, node));
+        },
+        [&](const Node& node) {
+          return std::is_eq(Compare(key, value, node));
+        });
+  }
+
+  // Removes all the elements with key `key`, and returns how many there were.
+  template <LookupKeyFor<K> Q>
+  size_t EraseAll(const Q& key) {
+    auto [left, rest] = Split(std::move(_root), AtOrAfter(key));
+    auto [middle, right] = Split(std::move(rest), [&](const Node& node) {
+      return std::is_lt(key <=> node._key);
+    });
+    size_t count = Node::Reduce(middle).count();
+    _root = Node::Merge(std::move(left), std::move(right));
+    _size -= count;
+    Refresh();
+    return count;
+  }
+  size_t EraseAll(const key_type& key) { return EraseAll<key_type>(key); }
+
+  // Calls `fun(key, value)` on each element, in order.
+  template <class Fun>
+  void ForAll(const Fun& fun) const {
+    if (_root) {
+      _root->ForEach([&](const K& key, const V& value,
+                         const Counted<Reducer>&) { fun(key, value); });
+    }
+  }
+
+  size_t Size() const { return _size; }
+  bool Empty() const { return _size == 0; }
+
+  // Checks the order (equivalent elements may be on either side of a node),
+  // the priorities, and the reductions and counts.
+  void Validate() const {
+    size_t size = 0;
+    if (_root) size = Validate(*_root, nullptr, nullptr);
+    assert(size == _size);
+  }
+
+ private:
+  // Compares `{key, value}` with `node`'s element.
+  std::weak_ordering Compare(const K& key, const V& value,
+                             const Node& node) const {
+    auto cmp = key <=> node._key;
+    if (!std::is_eq(cmp)) {
+      return cmp;
+    }
+    return _tiebreak(value, node._value);
+  }
+
+  void Refresh() const {
+    if (_root) _root->Refresh();
+  }
+
+  // The descents below take a predicate `after(node)` that splits the
+  // elements in two: it is false for a prefix of them and true for the rest.
+
+  // The elements with keys `>= key`.
+  template <class Q>
+  static auto AtOrAfter(const Q& key) {
+    return [&key](const Node& node) { return std::is_lteq(key <=> node._key); };
+  }
+
+  // The reduction of the elements below `node` that aren't `after`, and of
+  // those that are.
+  template <class After>
+  static Counted<Reducer> ReduceBefore(const Node* node, const After& after) {
+    Counted<Reducer> reduced;
+    while (node) {
+      if (after(*node)) {
+        node = node->_left.get();
+      } else {
+        reduced = reduced + Node::Reduce(node->_left) +
+                  Counted<Reducer>(node->_key, node->_value);
+        node = node->_right.get();
+      }
+    }
+    return reduced;
+  }
+  template <class After>
+  static Counted<Reducer> ReduceAfter(const Node* node, const After& after) {
+    Counted<Reducer> reduced;
+    while (node) {
+      if (after(*node)) {
+        reduced = Counted<Reducer>(node->_key, node->_value) +
+                  Node::Reduce(node->_right) + reduced;
+        node = node->_left.get();
+      } else {
+        node = node->_right.get();
+      }
+    }
+    return reduced;
+  }
+
+  // The elements with key `key` are all below the highest one, in its left
+  // subtree's suffix and its right subtree's prefix.
+  template <class Q>
+  Counted<Reducer> EqualRun(const Q& key) const {
+    const Node* node = _root.get();
+    while (node) {
+      auto cmp = key <=> node->_key;
+      if (std::is_lt(cmp)) {
+        node = node->_left.get();
+      } else if (std::is_gt(cmp)) {
+        node = node->_right.get();
+      } else {
+        return ReduceAfter(node->_left.get(), AtOrAfter(key)) +
+               Counted<Reducer>(node->_key, node->_value) +
+               ReduceBefore(node->_right.get(), [&](const Node& other) {
+                 return std::is_lt(key <=> other._key);
+               });
+      }
+    }
+    return Counted<Reducer>();
+  }
+
+  // Splits the subtree at `node` into the elements that aren't `after` and
+  // those that are.
+  template <class After>
+  static std::tuple<Ptr, Ptr> Split(Ptr node, const After& after) {
+    if (!node) {
+      return {nullptr, nullptr};
+    }
+    if (after(*node)) {
+      auto [left, right] = Split(std::move(node->_left), after);
+      node->SetLeft(std::move(right));
+      return {std::move(left), std::move(node)};
+    }
+    auto [left, right] = Split(std::move(node->_right), after);
+    node->SetRight(std::move(left));
+    return {std::move(node), std::move(right)};
+  }
+
+  // Inserts `node` just before the first element of `root`'s subtree that's
+  // `after`.
+  template <class After>
+  static Ptr Insert(Ptr root, Ptr node, const After& after) {
+    if (!root) {
+      return node;
+    }
+    if (node->_priority < root->_priority) {
+      if (after(*root)) {
+        root->SetLeft(Insert(std::move(root->_left), std::move(node), after));
+      } else {
+        root->SetRight(
+            Insert(std::move(root->_right), std::move(node), after));
+      }
+      return root;
+    }
+    auto [left, right] = Split(std::move(root), after);
+    node->SetBoth(std::move(left), std::move(right));
+    return node;
+  }
+
+  // Removes the first element that's `after`, if it's a `match`.  Returns
+  // true if it was removed.
+  template <class After, class Match>
+  bool EraseFirst(const After& after, const Match& match) {
+    bool reached = false;
+    Ptr extracted;
+    _root = ExtractFirst(std::move(_root), after, match, reached, extracted);
+    if (!extracted) {
+      return false;
+    }
+    --_size;
+    Refresh();
+    return true;
+  }
+  // The node-level `EraseFirst`.  Sets `reached` once it has found the first
+  // element that's `after`, and moves that node into `extracted` if it
+  // matches.
+  template <class After, class Match>
+  static Ptr ExtractFirst(Ptr node, const After& after, const Match& match,
+                          bool& reached, Ptr& extracted) {
+    if (!node) {
+      return node;
+    }
+    if (!after(*node)) {
+      node->SetRight(ExtractFirst(std::move(node->_right), after, match,
+                                  reached, extracted));
+      return node;
+    }
+    node->SetLeft(ExtractFirst(std::move(node->_left), after, match, reached,
+                               extracted));
+    if (reached) {
+      return node;
+    }
+    reached = true;
+    if (!match(*node)) {
+      return node;
+    }
+    Ptr merged = Node::Merge(std::move(node->_left), std::move(node->_right));
+    extracted = std::move(node);
+    return merged;
+  }
+
+  // Validates the subtree at `node`, whose elements must be between `lower`
+  // and `upper` (inclusive; null means unbounded), and returns its size.
+  size_t Validate(const Node& node, const Node* lower,
+                  const Node* upper) const {
+    assert(!lower || std::is_gteq(Compare(node._key, node._value, *lower)));
+    assert(!upper || std::is_lteq(Compare(node._key, node._value, *upper)));
+    assert(!node._dirty);
+    Counted<Reducer> reduced(node._key, node._value);
+    size_t size = 1;
+    if (node._left) {
+      assert(node._priority >= node._left->_priority);
+      size += Validate(*node._left, lower, &node);
+      reduced = node._left->_reduced + reduced;
+    }
+    if (node._right) {
+      assert(node._priority >= node._right->_priority);
+      size += Validate(*node._right, &node, upper);
+      reduced = reduced + node._right->_reduced;
+    }
+    assert(reduced.count() == size);
+    assert(reduced.count() == node._reduced.count());
+    assert(reduced.reduced().value() == node._reduced.reduced().value());
+    return size;
+  }
+
+  Ptr _root;
+  size_t _size = 0;
+  [[no_unique_address]] Tiebreak _tiebreak;
+  std::random_device _device;
+  std::default_random_engine _engine{_device()};
+  // Node priorities are 63 bits.
+  std::uniform_int_distribution<size_t> _uniform_distribution{0, SIZE_MAX >> 1};
+};
+
+#endif  // REDUCER_MULTIMAP_H_
@@ -0,0 +1,201 @@
+#include "reducer_multimap.h"
+
+#include <compare>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Sums the values, and keeps the first and last ones, so that the order of a
+// reduction shows.
+class SumReducer {
+ public:
+  SumReducer() = default;
+  SumReducer(size_t, size_t v) :_sum(v), _first(v), _last(v), _empty(false) {}
+  SumReducer operator+(const SumReducer& other) const {
+    if (_empty) return other;
+    if (other._empty) return *this;
+    SumReducer result = *this;
+    result._sum += other._sum;
+    result._last = other._last;
+    return result;
+  }
+  std::tuple<size_t, size_t, size_t> value() const {
+    return {_sum, _first, _last};
+  }
+ private:
+  size_t _sum = 0;
+  size_t _first = 0;
+  size_t _last = 0;
+  bool _empty = true;
+};
+
+static SumReducer ReduceRange(std::multimap<size_t, size_t>::iterator begin,
+                              std::multimap<size_t, size_t>::iterator end) {
+  SumReducer result;
+  for (; begin != end; ++begin) {
+    result = result + SumReducer(begin->first, begin->second);
+  }
+  return result;
+}
+
+static void SmallTest() {
+  ReducerMultimap<size_t, size_t, SumReducer> tree;
+  assert(tree.Empty() && tree.Count(5) == 0 && !tree.FindFirst(5));
+  tree.Insert(5, 1);
+  tree.Insert(3, 2);
+  tree.Insert(5, 3);
+  tree.Insert(5, 4);
+  tree.Insert(7, 5);
+  tree.Validate();
+  assert(tree.Size() == 5);
+  assert(tree.Count(5) == 3 && tree.Count(3) == 1 && tree.Count(4) == 0);
+  // Equal keys are in insertion order.
+  assert(tree.ReduceEqual(5).value() == std::make_tuple(8, 1, 4));
+  assert(std::get<1>(*tree.FindFirst(5)) == 1);
+  assert(tree.PrefixLt(5).value() == std::make_tuple(2, 2, 2));
+  assert(tree.PrefixLt(6).value() == std::make_tuple(10, 2, 4));
+  // The first inserted goes first.
+  assert(tree.EraseOne(5));
+  assert(std::get<1>(*tree.FindFirst(5)) == 3);
+  assert(!tree.EraseOne(4));
+  assert(tree.EraseOne(5));
+  assert(tree.Count(5) == 1);
+  assert(std::get<1>(*tree.FindFirst(5)) == 4);
+  assert(tree.EraseAll(5) == 1 && tree.EraseAll(5) == 0);
+  assert(tree.Size() == 2);
+  std::vector<std::pair<size_t, size_t>> elements;
+  tree.ForAll([&](size_t k, size_t v) { elements.emplace_back(k, v); });
+  assert((elements == std::vector<std::pair<size_t, size_t>>{{3, 2}, {7, 5}}));
+  tree.Validate();
+}
+
+// Orders equal keys by value, as a hole index would order equal sizes by
+// address.
+struct ByValue {
+  std::weak_ordering operator()(size_t a, size_t b) const { return a <=> b; }
+};
+
+static void TiebreakTest() {
+  ReducerMultimap<size_t, size_t, SumReducer, ByValue> tree;
+  for (size_t v : {40u, 10u, 30u, 20u}) tree.Insert(16, v);
+  tree.Insert(32, 0);
+  assert(tree.ReduceEqual(16).value() == std::make_tuple(100, 10, 40));
+  assert(std::get<1>(*tree.FindFirst(16)) == 10);
+  // A particular element, by its value.
+  assert(tree.EraseOne(16, 30));
+  assert(!tree.EraseOne(16, 30));
+  assert(tree.ReduceEqual(16).value() == std::make_tuple(70, 10, 40));
+  // Not necessarily the first one.
+  assert(tree.EraseOne(16, 40));
+  assert(tree.ReduceEqual(16).value() == std::make_tuple(30, 10, 20));
+  assert(tree.EraseOne(16));
+  assert(std::get<1>(*tree.FindFirst(16)) == 20);
+  tree.Validate();
+}
+
+template <class Tree>
+concept EraseOneByValue = requires(Tree tree) {
+  tree.EraseOne(size_t(5), size_t(4));
+};
+// Under `InsertionOrder` a value can't pick out an element.
+static_assert(EraseOneByValue<ReducerMultimap<size_t, size_t, SumReducer,
+                                              ByValue>>);
+static_assert(!EraseOneByValue<ReducerMultimap<size_t, size_t, SumReducer>>);
+
+// Random operations, with few distinct keys so that runs are long, against a
+// `std::multimap` (which also keeps equal keys in insertion order).
+static void RandomizedTest() {
+  ReducerMultimap<size_t, size_t, SumReducer> tree;
+  std::multimap<size_t, size_t> expect;
+  std::default_random_engine engine(2);
+  for (size_t i = 0; i < 20'000; ++i) {
+    size_t key = engine() % 50;
+    switch (engine() % 7) {
+      case 0:
+      case 1:
+      case 2: {
+        tree.Insert(key, i);
+        expect.emplace(key, i);
+        break;
+      }
+      case 3: {
+        auto [it, end] = expect.equal_range(key);
+        assert(tree.EraseOne(key) == (it != end));
+        if (it != end) expect.erase(it);
+        break;
+      }
+      case 4: {
+        if (engine() % 20 == 0) {
+          assert(tree.EraseAll(key) == expect.erase(key));
+        }
+        break;
+      }
+      case 5: {
+        auto [begin, end] = expect.equal_range(key);
+        assert(tree.Count(key) ==
+               static_cast<size_t>(std::distance(begin, end)));
+        assert(tree.ReduceEqual(key).value() == ReduceRange(begin, end).value());
+        auto first = tree.FindFirst(key);
+        assert(first.has_value() == (begin != end));
+        assert(!first || std::get<1>(*first) == begin->second);
+        break;
+      }
+      case 6: {
+        assert(tree.PrefixLt(key).value() ==
+               ReduceRange(expect.begin(), expect.lower_bound(key)).value());
+        break;
+      }
+    }
+    assert(tree.Size() == expect.size());
+    if (i % 1000 == 0) tree.Validate();
+  }
+  assert(tree.Reduce().value() ==
+         ReduceRange(expect.begin(), expect.end()).value());
+  auto it = expect.begin();
+  tree.ForAll([&](size_t k, size_t v) {
+    assert(k == it->first && v == it->second);
+    ++it;
+  });
+  assert(it == expect.end());
+  tree.Validate();
+}
+
+// Lookups with `std::string_view` in a tree of `std::string` keys.
+class CountReducer {
+ public:
+  CountReducer() = default;
+  CountReducer(const std::string&, size_t) :_count(1) {}
+  CountReducer operator+(const CountReducer& other) const {
+    CountReducer result;
+    result._count = _count + other._count;
+    return result;
+  }
+  size_t value() const { return _count; }
+ private:
+  size_t _count = 0;
+};
+
+static void StringKeyTest() {
+  ReducerMultimap<std::string, size_t, CountReducer> tree;
+  for (size_t i = 0; i < 10; ++i) tree.Insert(i % 2 ? "odd" : "even", i);
+  std::string_view odd = "odd";
+  assert(tree.Count(odd) == 5);
+  assert(tree.PrefixLt(odd).value() == 5);
+  assert(std::get<1>(*tree.FindFirst(odd)) == 1);
+  assert(tree.EraseAll(std::string_view("even")) == 5);
+  assert(tree.Size() == 5);
+  tree.Validate();
+}
+
+int main() {
+  SmallTest();
+  TiebreakTest();
+  RandomizedTest();
+  StringKeyTest();
+}
@@ -9,23 +9,116 @@
  * elements of the tree.  Since it's not quite the same as `std::map` we also
  * use camel case for the method names.
  *
- * We rely on the spaceship operator <=> working for keys.
+ * We rely on the spaceship operator <=> working for keys.  Lookups also accept
+ * any type that `<=>` compares with keys directly, such as `std::string_view`
+ * for `std::string` keys, so they don't have to construct a key.  Descents
+ * over `std::string` keys skip the bytes that the key is known to share with
+ * every node below (see `KeyPath`), so long common prefixes are compared once
+ * rather than at every level.
+ *
+ * Reductions are maintained with dirty flags: a mutation marks the nodes whose
+ * reductions it changes, and they are recomputed when somebody looks at them.
+ * By default each mutation recomputes what it touched before returning, so the
+ * tree is always clean.  In lazy mode (see `SetLazy`), mutations only mark
+ * nodes, which saves work when there are many updates between queries, and
+ * makes appending ascending keys amortized O(1) (see `Insert`).
  */
 
 #ifndef REDUCER_TREE_H_
 #define REDUCER_TREE_H_
 
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <compare>
+#include <concepts>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <random>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "thread_pool.h"
 
 template <class K, class V, class Reducer>
 class ReducerNode;
 
+template <class K, class V, class Reducer, class Tiebreak>
+class ReducerMultimap;
+
+// `Q` can be compared with keys of type `K` as it is, so looking up a `Q`
+// doesn't need to convert it to a `K`.
+template <class Q, class K>
+concept LookupKeyFor = requires(const Q& q, const K& k) { q <=> k; };
+
+// Compares a key with the keys on a path down a tree.  A descent calls
+// `Compare` at each node, and then `Left` or `Right` as it goes on.  In
+// general that's just `<=>`.
+template <class Q, class K>
+class KeyPath {
+ public:
+  explicit KeyPath(const Q& key) :_key(key) {}
+  auto Compare(const K& other) const { return _key <=> other; }
+  void Left() {}
+  void Right() {}
+ private:
+  const Q& _key;
+};
+
+// For string keys, the path remembers how many leading bytes the key shares
+// with the nearest keys on either side so far.  Every key below them lies
+// between the two, so it shares at least the smaller of those with the key,
+// and comparing starts after that.  Keys with long common prefixes (paths,
+// say) then don't compare the prefix again at every level.
+template <class Q>
+  requires std::convertible_to<const Q&, std::string_view>
+class KeyPath<Q, std::string> {
+ public:
+  explicit KeyPath(const Q& key) :_key(key) {}
+  std::strong_ordering Compare(const std::string& other) {
+    size_t n = std::min(_key.size(), other.size());
+    size_t i = CommonPrefix(other, std::min(_lower, _upper), n);
+    _last = i;
+    if (i < n) {
+      return static_cast<unsigned char>(_key[i]) <=>
+             static_cast<unsigned char>(other[i]);
+    }
+    return _key.size() <=> other.size();
+  }
+  void Left() { _upper = _last; }
+  void Right() { _lower = _last; }
+ private:
+  // The length of the common prefix of the key and `other`, which is at
+  // least `i` and at most `n`.
+  size_t CommonPrefix(std::string_view other, size_t i, size_t n) const {
+    if constexpr (std::endian::native == std::endian::little) {
+      for (; i + 8 <= n; i += 8) {
+        uint64_t a, b;
+        std::memcpy(&a, _key.data() + i, 8);
+        std::memcpy(&b, other.data() + i, 8);
+        if (a != b) return i + static_cast<size_t>(std::countr_zero(a ^ b)) / 8;
+      }
+    }
+    while (i < n && _key[i] == other[i]) ++i;
+    return i;
+  }
+
+  std::string_view _key;
+  // The common prefixes with the nearest keys below and above so far, and
+  // with the last key compared.
+  size_t _lower = 0;
+  size_t _upper = 0;
+  size_t _last = 0;
+};
+
 // A Reducer Tree is like an (ordered) map, where we also have a reduction value
 // for subtrees.
 template <class K, class V, class Reducer>
@@ -38,50 +131,224 @@ class ReducerTree {
   using value_type = V;
   using reducer_type = Reducer;
 
+  ReducerTree() = default;
+
   // Inserts `{key, value}` into the tree, if it's not there.  If it is there,
   // then nothing is changed.
   //
   // Return true if the insertion happened, false if it was already there.
+  //
+  // The search starts from the finger (the path to the most recently inserted
+  // node) rather than from the root, so finding where a key goes that is
+  // larger than every key in the tree, or close to the previous insertion,
+  // takes amortized O(1) expected time.  In lazy mode the whole insertion does:
+  // the ancestors of the new node are only marked dirty, and marking stops at
+  // the first ancestor that is already dirty.  Otherwise the ancestors'
+  // reductions are recomputed before returning, in O(log n) expected time, so
+  // that the tree is clean for concurrent readers.
   bool Insert(key_type key, value_type value) {
-    if (Find(key)) {
+    return Emplace(std::move(key), std::move(value));
+  }
+
+  // Like `Insert`, but constructs the key from `key` and the value from
+  // `value_args` in place.  If `key` can be compared with keys as it is (see
+  // `LookupKeyFor`), nothing is constructed unless the insertion happens.
+  template <class KeyArg, class... ValueArgs>
+  bool Emplace(KeyArg&& key, ValueArgs&&... value_args) {
+    if constexpr (LookupKeyFor<std::remove_cvref_t<KeyArg>, key_type>) {
+      size_t depth = FingerDepth(key);
+      if (FingerSubtreeContains(depth, key)) {
+        return false;
+      }
+      Node* node = LinkAtFinger(depth, std::make_unique<Node>(
+          _uniform_distribution(_engine), std::forward<KeyArg>(key),
+          std::forward<ValueArgs>(value_args)...));
+      DebugValidate(node->_key);
+      return true;
+    } else {
+      return Emplace(key_type(std::forward<KeyArg>(key)),
+                     std::forward<ValueArgs>(value_args)...);
+    }
+  }
+
+  // Owns a node that has been extracted from a tree, so that it can be
+  // inserted into another tree (of the same type) without allocating or
+  // copying anything.  The key and value can be changed in between.
+  class NodeHandle {
+   public:
+    NodeHandle() = default;
+    bool Empty() const { return !_node; }
+    explicit operator bool() const { return !Empty(); }
+    key_type& Key() const { return _node->_key; }
+    value_type& Value() const { return _node->_value; }
+   private:
+    friend class ReducerTree;
+    explicit NodeHandle(Ptr node) :_node(std::move(node)) {}
+    Ptr _node;
+  };
+
+  // Removes the node whose key equals `key`, and returns it.  Returns an empty
+  // handle if there is no such node.
+  template <LookupKeyFor<K> Q>
+  NodeHandle Extract(const Q& key) {
+    _finger.clear();
+    Ptr extracted;
+    _root = Node::Extract(std::move(_root), key, extracted);
+    if (extracted) --_size;
+    if (!_lazy) Refresh();
+    DebugValidate(key);
+    return NodeHandle(std::move(extracted));
+  }
+  NodeHandle Extract(const key_type& key) {
+    return Extract<key_type>(key);
+  }
+
+  // Inserts the node owned by `handle` (which must not be empty), if its key
+  // isn't already in the tree.  Returns true if the insertion happened, in
+  // which case `handle` is left empty.  Otherwise `handle` still owns the node.
+  bool Insert(NodeHandle&& handle) {
+    assert(handle._node);
+    const key_type& key = handle._node->_key;
+    size_t depth = FingerDepth(key);
+    if (FingerSubtreeContains(depth, key)) {
       return false;
     }
-    Ptr node = std::make_unique<Node>(_uniform_distribution(_engine),
-                                      std::move(key),
-                                      std::move(value));
-    _root = Node::Insert(std::move(_root), std::move(node));
-    ++_size;
+    LinkAtFinger(depth, std::move(handle._node));
+    DebugValidate(key);
     return true;
   }
 
+  // Like `Insert`, but first moves the finger to `hint`, which should be a key
+  // near `key` (typically the neighbor of where `key` goes).  The cost is that
+  // of `Insert` plus the cost of moving the finger, which is O(log d) expected
+  // when `hint` is d keys away from the previous insertion.
+  template <LookupKeyFor<K> Q>
+  bool InsertHint(const Q& hint, key_type key, value_type value) {
+    MoveFinger(hint);
+    return Insert(std::move(key), std::move(value));
+  }
+  bool InsertHint(const key_type& hint, key_type key, value_type value) {
+    return InsertHint<key_type>(hint, std::move(key), std::move(value));
+  }
+
   // If `key` is in the tree, then return a reference to the key, the associated
   // value, and the reduced value at that node.  Else return `std::nullopt`.
+  //
+  // Like the other lookups, `Find` takes either a key, or anything that can be
+  // compared with keys (and so needn't be converted to a key first).
+  template <LookupKeyFor<K> Q>
+  std::optional<std::tuple<const key_type&,
+                           const value_type&,
+                           const reducer_type&>> Find(const Q& key) const {
+    return Node::Find(_root, key);
+  }
   std::optional<std::tuple<const key_type&,
                            const value_type&,
                            const reducer_type&>> Find(const key_type& key) const {
     return Node::Find(_root, key);
   }
 
+  // Builds a tree containing `elements`, which needn't be sorted.  If a key
+  // appears more than once, the first one wins, as if the elements had been
+  // inserted in order.  The elements are sorted with `pool`, and then subtrees
+  // of more than `grain` nodes are built (reductions included) in parallel.
+  //
+  // The result is perfectly balanced.  It is a valid treap: priorities are
+  // drawn level by level from disjoint ranges, where the range for each level
+  // is where the priorities of that many nodes would fall in a random treap.
+  // So later insertions (with uniformly random priorities) behave as usual.
+  static ReducerTree BuildParallel(
+      std::vector<std::pair<key_type, value_type>> elements,
+      ThreadPool& pool,
+      size_t grain = 1 << 12) {
+    ParallelSort(pool, elements.begin(), elements.end(),
+                 [](const auto& a, const auto& b) { return a.first < b.first; });
+    elements.erase(std::unique(elements.begin(), elements.end(),
+                               [](const auto& a, const auto& b) {
+                                 return a.first == b.first;
+                               }),
+                   elements.end());
+    size_t n = elements.size();
+    // The priority range for each depth: the nodes at depth `d` get the ranks
+    // `[2^d - 1, 2^(d+1) - 1)` counting down from the highest priority.
+    std::vector<std::pair<size_t, size_t>> bands;
+    constexpr long double kMaxPriority = SIZE_MAX >> 1;
+    for (size_t d = 0; d < std::bit_width(n); ++d) {
+      long double first_rank = static_cast<long double>((size_t(1) << d) - 1);
+      long double end_rank = static_cast<long double>(
+          std::min((size_t(2) << d) - 1, n));
+      long double size = static_cast<long double>(n);
+      bands.emplace_back(
+          static_cast<size_t>(kMaxPriority * (1 - end_rank / size)),
+          static_cast<size_t>(kMaxPriority * (1 - first_rank / size)));
+    }
+    std::random_device device;
+    size_t seed = (size_t(device()) << 32) ^ device();
+    Ptr root = BuildBalanced(pool, elements.data(), 0, n, 0, bands, seed,
+                             grain);
+    return ReducerTree(std::move(root), n, false);
+  }
+
+  // Returns the reduction of the whole tree.
+  reducer_type Reduce() const {
+    return Node::Reduce(_root);
+  }
+
   // Returns the reduction of all the keys that are `<` key.
+  template <LookupKeyFor<K> Q>
+  reducer_type PrefixLt(const Q& key) const {
+    return Node::PrefixLt(_root, key);
+  }
   reducer_type PrefixLt(const key_type& key) const {
     return Node::PrefixLt(_root, key);
   }
 
   // Removes the node whose key equals `key`, if there is one.  Returns true if
   // a node was removed.
-  bool Erase(key_type key) {
-    bool erased;
-    _root = Node::Erase(std::move(_root), key, erased);
-    if (erased) --_size;
-    return erased;
+  template <LookupKeyFor<K> Q>
+  bool Erase(const Q& key) {
+    return !Extract(key).Empty();
+  }
+  bool Erase(const key_type& key) {
+    return Erase<key_type>(key);
+  }
+
+  // Removes all the keys `k` such that `lo <= k < hi`.  Returns the number of
+  // keys removed.
+  //
+  // Cutting out the range takes O(log n) expected time.  Freeing the k removed
+  // nodes (and counting them, to fix up `Size()`) takes O(k), which is cheaper
+  // than k calls to `Erase`.
+  template <LookupKeyFor<K> Q>
+  size_t EraseRange(const Q& lo, const Q& hi) {
+    return std::get<1>(CutRange(lo, hi));
+  }
+
+  size_t EraseRange(const key_type& lo, const key_type& hi) {
+    return EraseRange<key_type>(lo, hi);
+  }
+
+  // Like `EraseRange`, but instead of freeing the removed nodes, returns them as
+  // a new tree (which is lazy iff this tree is).
+  template <LookupKeyFor<K> Q>
+  ReducerTree ExtractRange(const Q& lo, const Q& hi) {
+    auto [removed, count] = CutRange(lo, hi);
+    return ReducerTree(std::move(removed), count, _lazy);
+  }
+  ReducerTree ExtractRange(const key_type& lo, const key_type& hi) {
+    return ExtractRange<key_type>(lo, hi);
   }
   std::ostream& Print(std::ostream& os) const {
+    Refresh();
     os << "{";
     if (_root) _root->Print(os, 1);
     os << "}";
     return os;
   }
+  // Checks the order, the priorities, and the reductions of the clean nodes.
+  // Outside lazy mode every node must be clean.
   void Validate() const {
+    assert(_lazy || !_root || !_root->_dirty);
     size_t size = 0;
     if (_root) {
       size = _root->Validate(nullptr, nullptr);
@@ -89,13 +356,85 @@ class ReducerTree {
     assert(size == _size);
   }
 
+  // Validates only the nodes that inserting or removing `key` changes (see
+  // `ReducerNode::ValidatePath`), in O(log n) expected time.  Like `Validate`,
+  // it doesn't refresh anything.
+  template <LookupKeyFor<K> Q>
+  void ValidatePath(const Q& key) const {
+    Node::ValidatePath(_root.get(), key);
+  }
+  void ValidatePath(const key_type& key) const {
+    Node::ValidatePath(_root.get(), key);
+  }
+
+  // A debug mode for big randomized tests: when `full_check_period` is
+  // nonzero, every mutation refreshes the tree (even in lazy mode, so that the
+  // reductions along the modified path are checked too) and calls
+  // `ValidatePath` on the keys it touched, and every `full_check_period`th
+  // mutation calls `Validate`.  Zero turns it off.
+  void SetDebugValidation(size_t full_check_period) {
+    _full_check_period = full_check_period;
+    _mutations = 0;
+  }
+
   bool ForAll(std::function<bool(const K& key, const V& value, const Reducer& reduced)> fun) const {
     if (!_root) {
       return true;
     }
+    Refresh();
     return _root->ForAll(fun);
   }
 
+  // Applies `fun` to every element, in parallel and in no particular order, so
+  // `fun` must be safe to call concurrently.  The top of the tree is split into
+  // tasks for `pool`, down to subtrees of roughly `grain` elements, which are
+  // each visited sequentially.
+  void ParallelForAll(
+      ThreadPool& pool,
+      const std::function<void(const K& key, const V& value,
+                               const Reducer& reduced)>& fun,
+      size_t grain = 1 << 12) const {
+    if (!_root) {
+      return;
+    }
+    Refresh();
+    _root->ParallelForAll(pool, fun, ForkDepth(grain));
+  }
+
+  // Returns `combine(map(e_1), combine(map(e_2), ...))` over the elements
+  // `e_i` in key order, where `map` is called as `map(key, value, reduced)`
+  // and returns an `R`.  `combine` must be associative, with `identity` as its
+  // identity, since the elements are grouped by subtree: that's what lets
+  // `pool` work on subtrees in parallel (as in `ParallelForAll`).
+  //
+  // For example, with `std::vector` for `R` and concatenation for `combine`
+  // (taking its first argument by value and appending to it), this exports the
+  // elements in order, with one buffer per task.
+  template <class R, class Map, class Combine>
+  R ParallelMapReduce(ThreadPool& pool, const Map& map, const Combine& combine,
+                      const R& identity, size_t grain = 1 << 12) const {
+    Refresh();
+    return Node::ParallelMapReduce(_root.get(), pool, map, combine, identity,
+                                   ForkDepth(grain));
+  }
+
+  // Recomputes all the out-of-date reductions.  Queries recompute the
+  // reductions they need, so calling this isn't required for correctness.
+  // But queries are `const` and yet may write to the nodes, so call `Refresh`
+  // before sharing the tree among concurrent readers.
+  void Refresh() const {
+    if (_root) _root->Refresh();
+  }
+
+  // In lazy mode, mutations only mark the nodes they touch as dirty, leaving
+  // the reductions to be recomputed by later queries or by `Refresh`.  Leaving
+  // lazy mode refreshes the tree.
+  void SetLazy(bool lazy) {
+    _lazy = lazy;
+    if (!_lazy) Refresh();
+  }
+  bool Lazy() const { return _lazy; }
+
   size_t Size() const { return _size; }
   bool Empty() const { return _size == 0; }
 
@@ -104,11 +443,243 @@ class ReducerTree {
     return tree.Print(os);
   }
 
+  // Returns the depth above which parallel traversals fork: a treap's depth-d
+  // subtrees have about Size() / 2^d elements.
+  size_t ForkDepth(size_t grain) const {
+    return std::bit_width(_size / std::max(grain, size_t(1)));
+  }
+
+  ReducerTree(Ptr root, size_t size, bool lazy)
+      :_root(std::move(root)), _size(size), _lazy(lazy) {
+    if (!_lazy) Refresh();
+  }
+
+  // Builds a balanced tree out of `elements[begin, end)` (which are sorted,
+  // with distinct keys), whose root is at `depth`.
+  static Ptr BuildBalanced(ThreadPool& pool,
+                           std::pair<key_type, value_type>* elements,
+                           size_t begin, size_t end, size_t depth,
+                           const std::vector<std::pair<size_t, size_t>>& bands,
+                           size_t seed, size_t grain) {
+    if (begin == end) {
+      return nullptr;
+    }
+    size_t middle = begin + (end - begin) / 2;
+    auto [band_lo, band_hi] = bands[depth];
+    size_t priority = band_lo;
+    if (band_hi > band_lo) {
+      // A SplitMix64 hash of the position, so that no state is shared.
+      size_t z = seed + (middle + 1) * 0x9e3779b97f4a7c15;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+      priority += (z ^ (z >> 31)) % (band_hi - band_lo);
+    }
+    Ptr node = std::make_unique<Node>(priority,
+                                      std::move(elements[middle].first),
+                                      std::move(elements[middle].second));
+    Ptr left, right;
+    auto build_left = [&]() {
+      left = BuildBalanced(pool, elements, begin, middle, depth + 1, bands,
+                           seed, grain);
+    };
+    auto build_right = [&]() {
+      right = BuildBalanced(pool, elements, middle + 1, end, depth + 1, bands,
+                            seed, grain);
+    };
+    if (end - begin > grain) {
+      pool.Fork2(build_left, build_right);
+    } else {
+      build_left();
+      build_right();
+    }
+    node->SetBoth(std::move(left), std::move(right));
+    node->Refresh();
+    return node;
+  }
+
+  // Detaches the keys in `[lo, hi)`, and returns them (with a dirty root) and
+  // how many there are.
+  template <class Q>
+  std::tuple<Ptr, size_t> CutRange(const Q& lo, const Q& hi) {
+    if (!std::is_lt(lo <=> hi)) {
+      return {nullptr, 0};
+    }
+    _finger.clear();
+    auto [left, rest] = Node::SplitBefore(std::move(_root), lo);
+    auto [middle, right] = Node::SplitBefore(std::move(rest), hi);
+    _root = Node::Merge(std::move(left), std::move(right));
+    size_t count = Node::Count(middle.get());
+    _size -= count;
+    if (!_lazy) Refresh();
+    DebugValidate(lo, hi);
+    return {std::move(middle), count};
+  }
+
+  // One step of the finger: a node on the path from the root, along with the
+  // bounds on the keys of its subtree (null means unbounded).
+  struct FingerEntry {
+    Node* node;
+    const key_type* lower_bound;
+    const key_type* upper_bound;
+  };
+
+  // Returns true if `key` belongs in the subtree of `entry`.
+  template <class Q>
+  static bool FingerEntryContains(const FingerEntry& entry, const Q& key) {
+    return (!entry.lower_bound || std::is_gt(key <=> *entry.lower_bound)) &&
+           (!entry.upper_bound || std::is_lt(key <=> *entry.upper_bound));
+  }
+
+  // Returns how many entries of the finger contain `key` (which is a prefix
+  // of the finger).
+  //
+  // A new node's ancestors are the entries that contain its key and have a
+  // higher priority, which is also a prefix.  `Insert` climbs from the bottom
+  // until both hold.  For ascending keys the climb pops the part of the right
+  // spine that the new node takes over, so it is amortized O(1).
+  template <class Q>
+  size_t FingerDepth(const Q& key) const {
+    size_t depth = _finger.size();
+    while (depth > 0 && !FingerEntryContains(_finger[depth - 1], key)) {
+      --depth;
+    }
+    return depth;
+  }
+
+  // Returns the link below the first `depth` entries of the finger on the
+  // way to `key`.
+  Ptr& FingerChild(size_t depth, const key_type& key) {
+    if (depth == 0) {
+      return _root;
+    }
+    Node* parent = _finger[depth - 1].node;
+    return std::is_lt(key <=> parent->_key) ? parent->_left : parent->_right;
+  }
+
+  // Returns true if `key` is in the subtree below the first `depth` entries
+  // of the finger, where those entries all contain `key`.
+  template <class Q>
+  bool FingerSubtreeContains(size_t depth, const Q& key) const {
+    if (depth == 0) {
+      return Node::Contains(_root.get(), key);
+    }
+    const Node* parent = _finger[depth - 1].node;
+    auto cmp = key <=> parent->_key;
+    if (std::is_eq(cmp)) {
+      return true;
+    }
+    return Node::Contains(
+        (std::is_lt(cmp) ? parent->_left : parent->_right).get(), key);
+  }
+
+  // Inserts `node`, whose key belongs below the first `depth` entries of the
+  // finger and isn't in the tree.  Returns the node.
+  Node* LinkAtFinger(size_t depth, Ptr node) {
+    while (depth > 0 && _finger[depth - 1].node->_priority <= node->_priority) {
+      --depth;
+    }
+    Node* result = node.get();
+    InsertAtFinger(depth, std::move(node));
+    ++_size;
+    return result;
+  }
+
+  // Does the checks for `SetDebugValidation` after a mutation at `keys`.
+  template <class... Qs>
+  void DebugValidate(const Qs&... keys) {
+    if (_full_check_period == 0) {
+      return;
+    }
+    // The path's nodes are the dirty ones, which `ValidatePath` can't check.
+    Refresh();
+    (ValidatePath(keys), ...);
+    if (++_mutations % _full_check_period == 0) {
+      Validate();
+    }
+  }
+
+  // Inserts `node` below the first `depth` entries of the finger, and makes
+  // the finger be the path to `node`.
+  void InsertAtFinger(size_t depth, Ptr node) {
+    _finger.resize(depth);
+    const key_type& key = node->_key;
+    Ptr& child = FingerChild(depth, key);
+    child = Node::Insert(std::move(child), std::move(node));
+    if (_lazy) {
+      // Fixing up the reductions of the entries above the new subtree is
+      // deferred until somebody looks at them.
+      for (size_t i = depth; i > 0 && !_finger[i - 1].node->_dirty; --i) {
+        _finger[i - 1].node->_dirty = true;
+      }
+    } else {
+      // Bottom up, so that each entry's children are clean.
+      child->Refresh();
+      for (size_t i = depth; i > 0; --i) {
+        _finger[i - 1].node->RecomputeReduced();
+      }
+    }
+    ExtendFinger(key);
+  }
+
+  // Makes the finger be the path to `key` (or to where `key` would be).
+  template <class Q>
+  void MoveFinger(const Q& key) {
+    _finger.resize(FingerDepth(key));
+    ExtendFinger(key);
+  }
+
+  // Extends the finger down towards `key`, stopping at `key` or at a leaf.
+  template <class Q>
+  void ExtendFinger(const Q& key) {
+    const key_type* lower_bound = nullptr;
+    const key_type* upper_bound = nullptr;
+    Node* node = _root.get();
+    if (!_finger.empty()) {
+      const FingerEntry& last = _finger.back();
+      auto cmp = key <=> last.node->_key;
+      if (std::is_eq(cmp)) {
+        return;
+      }
+      lower_bound = last.lower_bound;
+      upper_bound = last.upper_bound;
+      if (std::is_lt(cmp)) {
+        upper_bound = &last.node->_key;
+        node = last.node->_left.get();
+      } else {
+        lower_bound = &last.node->_key;
+        node = last.node->_right.get();
+      }
+    }
+    KeyPath<Q, K> path(key);
+    while (node) {
+      _finger.push_back({node, lower_bound, upper_bound});
+      auto cmp = path.Compare(node->_key);
+      if (std::is_lt(cmp)) {
+        upper_bound = &node->_key;
+        node = node->_left.get();
+        path.Left();
+      } else if (std::is_gt(cmp)) {
+        lower_bound = &node->_key;
+        node = node->_right.get();
+        path.Right();
+      } else {
+        return;
+      }
+    }
+  }
+
   std::unique_ptr<Node> _root;
   size_t _size = 0;
+  // The path from the root to the most recently inserted node.
+  std::vector<FingerEntry> _finger;
   std::random_device _device;
   std::default_random_engine _engine{_device()};
-  std::uniform_int_distribution<size_t> _uniform_distribution;
+  // Node priorities are 63 bits.
+  std::uniform_int_distribution<size_t> _uniform_distribution{0, SIZE_MAX >> 1};
+  // For `SetDebugValidation`.
+  size_t _full_check_period = 0;
+  size_t _mutations = 0;
+  bool _lazy = false;
 };
 
 template <class K, class V, class Reducer>
@@ -119,78 +690,132 @@ class ReducerNode {
   using reducer_type = Reducer;
 
   using Ptr = std::unique_ptr<ReducerNode>;
-  // After construction, the _reduced value is in an undefined state.
-  ReducerNode(size_t priority, key_type key, value_type value)
-      :_priority(priority)
-      ,_key(std::move(key))
-      ,_value(std::move(value)) {}
+  friend class ReducerTree<K, V, Reducer>;
+  template <class, class, class, class>
+  friend class ReducerMultimap;
+  // Constructs the key from `key` and the value from `value_args`.  After
+  // construction, the node is dirty: the _reduced value is in an undefined
+  // state.  Only the low 63 bits of `priority` are used.
+  template <class KeyArg, class... ValueArgs>
+  ReducerNode(size_t priority, KeyArg&& key, ValueArgs&&... value_args)
+      :_priority(priority & (SIZE_MAX >> 1))
+      ,_dirty(true)
+      ,_key(std::forward<KeyArg>(key))
+      ,_value(std::forward<ValueArgs>(value_args)...) {}
 
   // Inserts `node` into the subtree rooted at `root`, returning the new root of
   // the subtree.  `root` can be null.  `node` must be a node with null
   // children.  Requires: `node->key` is not in the subtree rooted at `root`.
+  //
+  // Like all the mutators, `Insert` doesn't recompute reductions: it marks the
+  // nodes it changes (and so the returned root) as dirty.
   static Ptr Insert(Ptr root, Ptr node) {
+    KeyPath<K, K> path(node->_key);
+    return Insert(std::move(root), std::move(node), path);
+  }
+  static Ptr Insert(Ptr root, Ptr node, KeyPath<K, K>& path) {
     if (!root) {
       assert(!node->_left);
       assert(!node->_right);
-      node->RecomputeReduced();
+      node->_dirty = true;
       return node;
     }
     if (node->_priority < root->_priority) {
       // root remains root.
-      std::strong_ordering cmp = node->_key <=> root->_key;
+      std::strong_ordering cmp = path.Compare(root->_key);
       if (std::is_lt(cmp)) {
-        root->SetLeftAndUpdateReduced(Insert(std::move(root->_left), std::move(node)));
+        path.Left();
+        root->SetLeft(Insert(std::move(root->_left), std::move(node), path));
         return root;
       }
       if (std::is_gt(cmp)) {
-        root->SetRightAndUpdateReduced(Insert(std::move(root->_right), std::move(node)));
+        path.Right();
+        root->SetRight(Insert(std::move(root->_right), std::move(node), path));
         return root;
       }
       assert(false);
     }
     // node becomes root. Split root according to node's key.
-    auto [new_left, new_right] = Split(std::move(root), node->_key);
-    node->SetBothAndUpdateReduced(std::move(new_left), std::move(new_right));
+    auto [new_left, new_right] = Split(std::move(root), path);
+    node->SetBoth(std::move(new_left), std::move(new_right));
     return node;
   }
 
+  template <class Q>
   static std::optional<std::tuple<const key_type&,
                                   const value_type&,
                                   const reducer_type&>> Find(
-                                      const Ptr& root, const key_type& key) {
-    if (!root) {
-      return std::nullopt;
-    }
-    auto cmp = key <=> root->_key;
-    if (std::is_lt(cmp)) {
-      return Find(root->_left, key);
+                                      const Ptr& root, const Q& key) {
+    KeyPath<Q, K> path(key);
+    const ReducerNode* node = root.get();
+    while (node) {
+      auto cmp = path.Compare(node->_key);
+      if (std::is_lt(cmp)) {
+        node = node->_left.get();
+        path.Left();
+      } else if (std::is_gt(cmp)) {
+        node = node->_right.get();
+        path.Right();
+      } else {
+        node->Refresh();
+        return std::tuple<const key_type&, const value_type&,
+                          const reducer_type&>(
+            node->_key, node->_value, node->_reduced);
+      }
     }
-    if (std::is_gt(cmp)) {
-      return Find(root->_right, key);
+    return std::nullopt;
+  }
+
+  // Returns true if `key` is in the subtree rooted at `node`.  Unlike `Find`,
+  // this doesn't need to refresh anything.
+  template <class Q>
+  static bool Contains(const ReducerNode* node, const Q& key) {
+    KeyPath<Q, K> path(key);
+    while (node) {
+      auto cmp = path.Compare(node->_key);
+      if (std::is_lt(cmp)) {
+        node = node->_left.get();
+        path.Left();
+      } else if (std::is_gt(cmp)) {
+        node = node->_right.get();
+        path.Right();
+      } else {
+        return true;
+      }
     }
-    // Return `root` if key equals.
-    return std::tuple<const key_type&, const value_type&, const reducer_type>(
-        root->_key, root->_value, root->_reduced);
+    return false;
   }
 
-  static Ptr Erase(Ptr node, const K& key, bool& erased) {
+  // Removes the node whose key equals `key` (if any) from the subtree rooted
+  // at `node`, returning the new root of the subtree.  The removed node, with
+  // its children cleared, is moved into `extracted`.
+  template <class Q>
+  static Ptr Extract(Ptr node, const Q& key, Ptr& extracted) {
+    KeyPath<Q, K> path(key);
+    return Extract(std::move(node), path, extracted);
+  }
+  template <class Q>
+  static Ptr Extract(Ptr node, KeyPath<Q, K>& path, Ptr& extracted) {
     if (!node) {
-      erased = false;
       return node;
     }
-    auto cmp = key <=> node->_key;
+    auto cmp = path.Compare(node->_key);
     if (std::is_lt(cmp)) {
-      node->SetLeftAndUpdateReduced(
-          Erase(std::move(node->_left), key, erased));
+      path.Left();
+      node->SetLeft(
+          Extract(std::move(node->_left), path, extracted));
       return node;
     }
     if (std::is_gt(cmp)) {
-      node->SetRightAndUpdateReduced(
-          Erase(std::move(node->_right), key, erased));
+      path.Right();
+      node->SetRight(
+          Extract(std::move(node->_right), path, extracted));
       return node;
     }
-    erased = true;
-    return Merge(std::move(node->_left), std::move(node->_right));
+    Ptr merged = Merge(std::move(node->_left), std::move(node->_right));
+    node->_dirty = true;
+    extracted = std::move(node);
+    return merged;
   }
 
   // Returns the tree containing all the nodes of `a` and `b`.
@@ -208,56 +833,103 @@ class ReducerNode {
     }
     if (a->_priority > b->_priority) {
       // `a` is the new root.
-      a->_right = Merge(std::move(a->_right), std::move(b));
-      a->RecomputeReduced();
+      a->SetRight(Merge(std::move(a->_right), std::move(b)));
       return a;
     } else {
       // `b` is the new root
-      b->_left = Merge(std::move(a), std::move(b->_left));
-      b->RecomputeReduced();
+      b->SetLeft(Merge(std::move(a), std::move(b->_left)));
       return b;
     }
   }
 
   static std::tuple<Ptr, Ptr> Split(Ptr node, const key_type &key) {
+    KeyPath<K, K> path(key);
+    return Split(std::move(node), path);
+  }
+  static std::tuple<Ptr, Ptr> Split(Ptr node, KeyPath<K, K>& path) {
     if (!node) {
       return {nullptr, nullptr};
     }
-    auto cmp = key <=> node->_key;
+    auto cmp = path.Compare(node->_key);
     if (std::is_lt(cmp)) {
-      auto [left, right] = Split(std::move(node->_left), key);
-      node->SetLeftAndUpdateReduced(std::move(right));
+      path.Left();
+      auto [left, right] = Split(std::move(node->_left), path);
+      node->SetLeft(std::move(right));
       return {std::move(left), std::move(node)};
     }
     if (std::is_gt(cmp)) {
-      auto [left, right] = Split(std::move(node->_right), key);
-      node->SetRightAndUpdateReduced(std::move(left));
+      path.Right();
+      auto [left, right] = Split(std::move(node->_right), path);
+      node->SetRight(std::move(left));
       return {std::move(node), std::move(right)};
     }
     assert(false);
   }
 
+  // Like `Split`, but `key` may be in the tree: returns the subtrees of keys
+  // `< key` and `>= key`.
+  template <class Q>
+  static std::tuple<Ptr, Ptr> SplitBefore(Ptr node, const Q& key) {
+    KeyPath<Q, K> path(key);
+    return SplitBefore(std::move(node), path);
+  }
+  template <class Q>
+  static std::tuple<Ptr, Ptr> SplitBefore(Ptr node, KeyPath<Q, K>& path) {
+    if (!node) {
+      return {nullptr, nullptr};
+    }
+    if (std::is_lteq(path.Compare(node->_key))) {
+      path.Left();
+      auto [left, right] = SplitBefore(std::move(node->_left), path);
+      node->SetLeft(std::move(right));
+      return {std::move(left), std::move(node)};
+    }
+    path.Right();
+    auto [left, right] = SplitBefore(std::move(node->_right), path);
+    node->SetRight(std::move(left));
+    return {std::move(node), std::move(right)};
+  }
+
+  // Returns the number of nodes in the subtree rooted at `node`.
+  static size_t Count(const ReducerNode* node) {
+    size_t count = 0;
+    while (node) {
+      count += 1 + Count(node->_left.get());
+      node = node->_right.get();
+    }
+    return count;
+  }
+
   static Reducer Reduce(const Ptr& node) {
     if (node) {
+      node->Refresh();
       return node->_reduced;
     } else {
       return Reducer();
     }
   }
 
-  static Reducer PrefixLt(const Ptr& node, const key_type &key) {
+  template <class Q>
+  static Reducer PrefixLt(const Ptr& node, const Q& key) {
+    KeyPath<Q, K> path(key);
+    return PrefixLt(node, path);
+  }
+  template <class Q>
+  static Reducer PrefixLt(const Ptr& node, KeyPath<Q, K>& path) {
     if (!node) {
       return Reducer();
     }
-    auto cmp = key <=> node->_key;
+    auto cmp = path.Compare(node->_key);
     if (std::is_lt(cmp)) {
-      return PrefixLt(node->_left, key);
+      path.Left();
+      return PrefixLt(node->_left, path);
     }
     if (std::is_eq(cmp)) {
       return Reduce(node->_left);
     }
     if (std::is_gt(cmp)) {
-      return Reduce(node->_left) + Reducer(node->_key, node->_value) + PrefixLt(node->_right, key);
+      path.Right();
+      return Reduce(node->_left) + Reducer(node->_key, node->_value) + PrefixLt(node->_right, path);
     }
     assert(false);
   }
@@ -280,6 +952,82 @@ class ReducerNode {
     return true;
   }
 
+  // Applies `fun` to every node in the tree, in parallel for the nodes less
+  // than `fork_depth` deep.
+  void ParallelForAll(ThreadPool& pool,
+                      const std::function<void(const K& key,
+                                               const V& value,
+                                               const Reducer& reducer)>& fun,
+                      size_t fork_depth) const {
+    if (fork_depth == 0) {
+      ForEach(fun);
+      return;
+    }
+    auto visit_left = [&]() {
+      if (_left) _left->ParallelForAll(pool, fun, fork_depth - 1);
+    };
+    auto visit_right = [&]() {
+      if (_right) _right->ParallelForAll(pool, fun, fork_depth - 1);
+    };
+    pool.Fork2(visit_left, visit_right);
+    fun(_key, _value, _reduced);
+  }
+
+  // Like `ForAll`, without quitting early.
+  template <class Fun>
+  void ForEach(const Fun& fun) const {
+    const ReducerNode* node = this;
+    while (node) {
+      if (node->_left) node->_left->ForEach(fun);
+      fun(node->_key, node->_value, node->_reduced);
+      node = node->_right.get();
+    }
+  }
+
+  // The node-level `ReducerTree::ParallelMapReduce`.  Below `fork_depth`, a
+  // task folds its subtree into a single accumulator, so that a `combine`
+  // that appends to its first argument copies each element once per fork
+  // level rather than once per tree level.
+  template <class R, class Map, class Combine>
+  static R ParallelMapReduce(const ReducerNode* node, ThreadPool& pool,
+                             const Map& map, const Combine& combine,
+                             const R& identity, size_t fork_depth) {
+    if (!node) {
+      return identity;
+    }
+    if (fork_depth == 0) {
+      R result = identity;
+      node->FoldInto(result, map, combine);
+      return result;
+    }
+    R left = identity, right = identity;
+    auto reduce_left = [&]() {
+      left = ParallelMapReduce(node->_left.get(), pool, map, combine, identity,
+                               fork_depth - 1);
+    };
+    auto reduce_right = [&]() {
+      right = ParallelMapReduce(node->_right.get(), pool, map, combine,
+                                identity, fork_depth - 1);
+    };
+    pool.Fork2(reduce_left, reduce_right);
+    return combine(combine(std::move(left),
+                           map(node->_key, node->_value, node->_reduced)),
+                   std::move(right));
+  }
+
+  // Sets `result` to `combine(result, map(e))` for each element `e` of the
+  // subtree, in key order.
+  template <class R, class Map, class Combine>
+  void FoldInto(R& result, const Map& map, const Combine& combine) const {
+    const ReducerNode* node = this;
+    while (node) {
+      if (node->_left) node->_left->FoldInto(result, map, combine);
+      result = combine(std::move(result),
+                       map(node->_key, node->_value, node->_reduced));
+      node = node->_right.get();
+    }
+  }
+
   std::ostream& Print(std::ostream& os, size_t depth, bool pretty_print = true) const {
     os << "(" << _key << " " << _value << " " << _priority << " " << _reduced.value();
     if (!_left && !_right) {
@@ -309,45 +1057,110 @@ class ReducerNode {
     return os << ")";
   }
 
+  // Recomputes the reductions of the dirty nodes in this subtree.  The dirty
+  // nodes always include the ancestors of any dirty node, so this only visits
+  // the dirty nodes (and their children).
+  void Refresh() const {
+    if (!_dirty) return;
+    if (_left && _left->_dirty) _left->Refresh();
+    if (_right && _right->_dirty) _right->Refresh();
+    RecomputeReduced();
+    _dirty = false;
+  }
+
   // Validates a subtree.  All entries must be strictly between `lower_bound`
   // and `upper_bound`.  The subtree must be priority-heap ordered (parents may
-  // not have lower priority than children).  The reducer values must be
-  // correct.
+  // not have lower priority than children).  The parent of a dirty node must be
+  // dirty, and the reducer values of the clean nodes must be correct.
   //
   // Returns the size of the subtree.
   size_t Validate(const K* lower_bound, const K* upper_bound) const {
+    ValidateNode(lower_bound, upper_bound);
+    size_t left_size = 0;
+    if (_left) {
+      left_size = _left->Validate(lower_bound, &_key);
+    }
+    size_t right_size = 0;
+    if (_right) {
+      right_size = _right->Validate(&_key, upper_bound);
+    }
+    return 1 + left_size + right_size;
+  }
+
+  // Validates the nodes on the search path for `key`, and, if `key` is found,
+  // the right spine of its left subtree and the left spine of its right
+  // subtree.  Those are all the nodes that inserting or removing `key` can
+  // change (the split or merged nodes end up on those spines, or on the path),
+  // so this checks an `Insert` or `Erase` in O(log n) expected time.
+  template <class Q>
+  static void ValidatePath(const ReducerNode* node, const Q& key) {
+    const K* lower_bound = nullptr;
+    const K* upper_bound = nullptr;
+    while (node) {
+      node->ValidateNode(lower_bound, upper_bound);
+      auto cmp = key <=> node->_key;
+      if (std::is_lt(cmp)) {
+        upper_bound = &node->_key;
+        node = node->_left.get();
+      } else if (std::is_gt(cmp)) {
+        lower_bound = &node->_key;
+        node = node->_right.get();
+      } else {
+        for (const ReducerNode* left = node->_left.get(); left;
+             left = left->_right.get()) {
+          left->ValidateNode(lower_bound, &node->_key);
+          lower_bound = &left->_key;
+        }
+        for (const ReducerNode* right = node->_right.get(); right;
+             right = right->_left.get()) {
+          right->ValidateNode(&node->_key, upper_bound);
+          upper_bound = &right->_key;
+        }
+        return;
+      }
+    }
+  }
+
+  // Validates this node against its bounds and its children: the children's
+  // keys are in range, their priorities are no higher, they are only dirty if
+  // this node is, and if this node is clean its reduction is right.
+  void ValidateNode(const K* lower_bound, const K* upper_bound) const {
     if (lower_bound) {
       assert(*lower_bound < _key);
     }
     if (upper_bound) {
       assert(_key < *upper_bound);
     }
-    size_t left_size = 0;
     if (_left) {
+      assert(_left->_key < _key);
+      assert(!lower_bound || *lower_bound < _left->_key);
       assert(_priority >= _left->_priority);
-      left_size = _left->Validate(lower_bound, &_key);
+      assert(_dirty || !_left->_dirty);
     }
-    size_t right_size = 0;
     if (_right) {
+      assert(_key < _right->_key);
+      assert(!upper_bound || _right->_key < *upper_bound);
       assert(_priority >= _right->_priority);
-      right_size = _right->Validate(&_key, upper_bound);
+      assert(_dirty || !_right->_dirty);
     }
-    Reducer rhere = Reducer(_key, _value);
-    if (_left) {
-      rhere = _left->_reduced + rhere;
-    }
-    if (_right) {
-      rhere = rhere + _right->_reduced;
+    if (!_dirty) {
+      Reducer rhere = Reducer(_key, _value);
+      if (_left) {
+        rhere = _left->_reduced + rhere;
+      }
+      if (_right) {
+        rhere = rhere + _right->_reduced;
+      }
+      assert(rhere.value() == _reduced.value());
     }
-    assert(rhere.value() == _reduced.value());
-    return 1 + left_size + right_size;
   }
 
   static Ptr MakeNodeForTest(size_t priority, K key, V value,
                              Ptr left = nullptr, Ptr right= nullptr) {
     Ptr result = std::make_unique<ReducerNode>(
         priority, std::move(key), std::move(value));
-    result->SetBothAndUpdateReduced(std::move(left), std::move(right));
+    result->SetBoth(std::move(left), std::move(right));
+    result->Refresh();
     return result;
   }
 
@@ -364,23 +1177,25 @@ class ReducerNode {
     return p->Print(os, 0, false);
   }
 
-  void SetLeftAndUpdateReduced(Ptr new_left) {
+  // The setters mark the node dirty.
+  void SetLeft(Ptr new_left) {
     _left = std::move(new_left);
-    RecomputeReduced();
+    _dirty = true;
   }
 
-  void SetRightAndUpdateReduced(Ptr new_right) {
+  void SetRight(Ptr new_right) {
     _right = std::move(new_right);
-    RecomputeReduced();
+    _dirty = true;
   }
 
-  void SetBothAndUpdateReduced(Ptr new_left, Ptr new_right) {
+  void SetBoth(Ptr new_left, Ptr new_right) {
     _left = std::move(new_left);
     _right = std::move(new_right);
-    RecomputeReduced();
+    _dirty = true;
   }
 
-  void RecomputeReduced() {
+  // Requires: the children are clean.
+  void RecomputeReduced() const {
     _reduced = Reducer(_key, _value);
     if (_left) {
       _reduced = _left->_reduced + std::move(_reduced);
@@ -389,10 +1204,12 @@ class ReducerNode {
       _reduced = std::move(_reduced) + _right->_reduced;
     }
   }
-  size_t _priority;
+  size_t _priority : 63;
+  // True if `_reduced` is out of date.
+  mutable size_t _dirty : 1;
   K _key;
   [[no_unique_address]] V _value;
-  [[no_unique_address]] Reducer _reduced;
+  [[no_unique_address]] mutable Reducer _reduced;
   Ptr _left;
   Ptr _right;
 };
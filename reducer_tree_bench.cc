@@ -0,0 +1,341 @@
+// Benchmarks for `ReducerTree`.  Run with `make bench`.
+
+#include "reducer_tree.h"
+
+#include "reducer_multimap.h"
+#include "rope.h"
+
+#include <algorithm>
+#include <chrono>
+#include <compare>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+class SumReducer {
+ public:
+  SumReducer() = default;
+  SumReducer(size_t, size_t v) :_sum(v) {}
+  SumReducer operator+(const SumReducer& other) const {
+    return SumReducer(_sum + other._sum);
+  }
+  size_t value() const { return _sum; }
+ private:
+  explicit SumReducer(size_t v) :_sum(v) {}
+  size_t _sum = 0;
+};
+
+using Tree = ReducerTree<size_t, size_t, SumReducer>;
+
+// Calls `fun` and prints the time per operation, where `fun` does `ops`
+// operations.
+template <class Fun>
+void Time(const char* name, size_t ops, Fun fun) {
+  auto start = std::chrono::steady_clock::now();
+  fun();
+  auto end = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  std::printf("%-40s %10zu ops %8.1f ns/op\n", name, ops,
+              ns / static_cast<double>(ops));
+}
+
+void SequentialInsertBench(size_t n) {
+  {
+    Tree tree;
+    Time("Insert ascending", n, [&]() {
+      for (size_t i = 0; i < n; ++i) {
+        tree.Insert(i, i);
+      }
+    });
+    assert(tree.PrefixLt(n).value() == n * (n - 1) / 2);
+  }
+  {
+    // Only marking the ancestors, rather than recomputing them.
+    Tree tree;
+    tree.SetLazy(true);
+    Time("Insert ascending, lazy", n, [&]() {
+      for (size_t i = 0; i < n; ++i) {
+        tree.Insert(i, i);
+      }
+    });
+    assert(tree.PrefixLt(n).value() == n * (n - 1) / 2);
+  }
+  {
+    Tree tree;
+    Time("InsertHint ascending", n, [&]() {
+      tree.Insert(0, 0);
+      for (size_t i = 1; i < n; ++i) {
+        tree.InsertHint(i - 1, i, i);
+      }
+    });
+    assert(tree.PrefixLt(n).value() == n * (n - 1) / 2);
+  }
+  {
+    // Appends interleaved with a query, so the spine is refreshed every time.
+    Tree tree;
+    size_t sum = 0;
+    Time("Insert ascending + PrefixLt", n, [&]() {
+      for (size_t i = 0; i < n; ++i) {
+        tree.Insert(i, i);
+        sum += tree.PrefixLt(i).value();
+      }
+    });
+    assert(sum > 0);
+  }
+  {
+    // Two interleaved ascending streams, such as the two ends of a heap.
+    Tree tree;
+    Time("InsertHint two ascending streams", n, [&]() {
+      tree.Insert(0, 0);
+      tree.Insert(n, n);
+      for (size_t i = 1; i < n / 2; ++i) {
+        tree.InsertHint(i - 1, i, i);
+        tree.InsertHint(n + i - 1, n + i, n + i);
+      }
+    });
+  }
+  {
+    std::vector<size_t> keys(n);
+    for (size_t i = 0; i < n; ++i) keys[i] = i;
+    std::shuffle(keys.begin(), keys.end(), std::default_random_engine(1));
+    Tree tree;
+    Time("Insert random", n, [&]() {
+      for (size_t key : keys) {
+        tree.Insert(key, key);
+      }
+    });
+  }
+  {
+    std::map<size_t, size_t> map;
+    Time("std::map emplace_hint ascending", n, [&]() {
+      for (size_t i = 0; i < n; ++i) {
+        map.emplace_hint(map.end(), i, i);
+      }
+    });
+  }
+}
+
+// Replaces random keys (an Erase and an Insert per update) in a tree of size
+// `n`, doing a `PrefixLt` query after every `updates_per_query` updates, in
+// both eager and lazy mode.
+void MixedUpdateQueryBench(size_t n, size_t updates) {
+  std::printf("%-22s %10s %12s %12s\n",
+              "updates per query", "updates", "eager ns/op", "lazy ns/op");
+  for (size_t updates_per_query = 1; updates_per_query <= 4096;
+       updates_per_query *= 4) {
+    double ns[2];
+    for (bool lazy : {false, true}) {
+      std::default_random_engine engine(2);
+      std::uniform_int_distribution<size_t> distribution(0, 2 * n);
+      Tree tree;
+      std::vector<size_t> keys;
+      while (keys.size() < n) {
+        size_t key = distribution(engine);
+        if (tree.Insert(key, key)) keys.push_back(key);
+      }
+      tree.SetLazy(lazy);
+      size_t sum = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < updates; ++i) {
+        size_t& key = keys[distribution(engine) % n];
+        tree.Erase(key);
+        do {
+          key = distribution(engine);
+        } while (!tree.Insert(key, key));
+        if (i % updates_per_query == updates_per_query - 1) {
+          sum += tree.PrefixLt(distribution(engine)).value();
+        }
+      }
+      auto end = std::chrono::steady_clock::now();
+      assert(sum > 0 || updates < updates_per_query);
+      ns[lazy] = std::chrono::duration<double, std::nano>(end - start).count() /
+                 static_cast<double>(updates);
+    }
+    std::printf("%-22zu %10zu %12.1f %12.1f\n",
+                updates_per_query, updates, ns[0], ns[1]);
+  }
+}
+
+// Loads `n` random keys with `Insert` and with `BuildParallel`.
+void BulkBuildBench(size_t n) {
+  std::default_random_engine engine(3);
+  std::uniform_int_distribution<size_t> distribution;
+  std::vector<std::pair<size_t, size_t>> elements;
+  for (size_t i = 0; i < n; ++i) {
+    elements.emplace_back(distribution(engine), i);
+  }
+  {
+    Tree tree;
+    Time("Insert unsorted", n, [&]() {
+      for (const auto& [key, value] : elements) {
+        tree.Insert(key, value);
+      }
+    });
+  }
+  for (size_t num_threads = 1; num_threads <= ThreadPool::DefaultNumThreads();
+       num_threads *= 2) {
+    ThreadPool pool(num_threads);
+    std::vector<std::pair<size_t, size_t>> copy = elements;
+    char name[64];
+    std::snprintf(name, sizeof(name), "BuildParallel %zu threads", num_threads);
+    Time(name, n, [&]() {
+      Tree tree = Tree::BuildParallel(std::move(copy), pool);
+      assert(tree.Size() <= n);
+    });
+  }
+}
+
+// Counts the elements.
+class CountReducer {
+ public:
+  CountReducer() = default;
+  CountReducer(const std::string&, size_t) :_count(1) {}
+  CountReducer operator+(const CountReducer& other) const {
+    return CountReducer(_count + other._count);
+  }
+  size_t value() const { return _count; }
+ private:
+  explicit CountReducer(size_t count) :_count(count) {}
+  size_t _count = 0;
+};
+
+// String keys that share long prefixes, like allocation-site paths: `n`
+// random keys in `groups` groups with `prefix_length` bytes in common.
+void StringKeyBench(size_t n, size_t groups, size_t prefix_length) {
+  std::default_random_engine engine(4);
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < n; ++i) {
+    std::string key(prefix_length, '/');
+    key += std::to_string(engine() % groups);
+    key += "/site:" + std::to_string(engine());
+    keys.push_back(std::move(key));
+  }
+  char name[64];
+  ReducerTree<std::string, size_t, CountReducer> tree;
+  std::snprintf(name, sizeof(name), "string Insert, %zu-byte prefixes",
+                prefix_length);
+  Time(name, n, [&]() {
+    for (size_t i = 0; i < n; ++i) tree.Insert(keys[i], i);
+  });
+  std::shuffle(keys.begin(), keys.end(), engine);
+  size_t found = 0;
+  std::snprintf(name, sizeof(name), "string Find, %zu-byte prefixes",
+                prefix_length);
+  Time(name, n, [&]() {
+    for (const std::string& key : keys) found += tree.Find(key).has_value();
+  });
+  size_t sum = 0;
+  std::snprintf(name, sizeof(name), "string PrefixLt, %zu-byte prefixes",
+                prefix_length);
+  Time(name, n, [&]() {
+    for (const std::string& key : keys) sum += tree.PrefixLt(key).value();
+  });
+  assert(found == tree.Size() && sum == n * (n - 1) / 2);
+}
+
+// Concatenates the keys into one `std::string`, copying at every level.
+class StringCatReducer {
+ public:
+  StringCatReducer() = default;
+  StringCatReducer(const std::string& key, size_t) :_string(key) {}
+  StringCatReducer operator+(const StringCatReducer& other) const {
+    return StringCatReducer(_string + other._string);
+  }
+  const std::string& value() const { return _string; }
+ private:
+  explicit StringCatReducer(std::string s) :_string(std::move(s)) {}
+  std::string _string;
+};
+
+// Inserts `n` random 8-byte keys into a tree that concatenates its keys,
+// reading the whole concatenation's length after each insert.
+template <class Reducer>
+void ConcatBench(const char* name, size_t n) {
+  std::default_random_engine engine(5);
+  ReducerTree<std::string, size_t, Reducer> tree;
+  size_t total = 0;
+  Time(name, n, [&]() {
+    for (size_t i = 0; i < n; ++i) {
+      tree.Insert(std::to_string(10'000'000 + engine() % 90'000'000), i);
+      total += tree.Reduce().value().size();
+    }
+  });
+  assert(total > 0);
+}
+
+// Counts the holes.
+class HoleCountReducer {
+ public:
+  HoleCountReducer() = default;
+  template <class K>
+  HoleCountReducer(const K&, size_t) :_count(1) {}
+  HoleCountReducer operator+(const HoleCountReducer& other) const {
+    HoleCountReducer result;
+    result._count = _count + other._count;
+    return result;
+  }
+  size_t value() const { return _count; }
+ private:
+  size_t _count = 0;
+};
+
+struct ByAddress {
+  std::weak_ordering operator()(size_t a, size_t b) const { return a <=> b; }
+};
+
+// Indexes `n` holes by size, with sizes from 64 classes, and then frees them
+// each by (size, address): once keyed by size with the address as the
+// multimap's tie-break, and once keyed by the (size, address) pair.
+void HoleIndexBench(size_t n) {
+  std::default_random_engine engine(6);
+  std::vector<std::pair<size_t, size_t>> holes;
+  for (size_t i = 0; i < n; ++i) {
+    holes.emplace_back(16 * (1 + engine() % 64), i * 4096);
+  }
+  std::vector<std::pair<size_t, size_t>> shuffled = holes;
+  std::shuffle(shuffled.begin(), shuffled.end(), engine);
+  {
+    ReducerMultimap<size_t, size_t, HoleCountReducer, ByAddress> index;
+    Time("holes Insert, multimap by size", n, [&]() {
+      for (const auto& [size, address] : holes) index.Insert(size, address);
+    });
+    size_t count = 0;
+    Time("holes Count, multimap by size", n, [&]() {
+      for (const auto& [size, address] : shuffled) count += index.Count(size);
+    });
+    Time("holes EraseOne, multimap by size", n, [&]() {
+      for (const auto& [size, address] : shuffled) {
+        index.EraseOne(size, address);
+      }
+    });
+    assert(count > 0 && index.Empty());
+  }
+  {
+    ReducerTree<std::pair<size_t, size_t>, size_t, HoleCountReducer> index;
+    Time("holes Insert, tree by (size, address)", n, [&]() {
+      for (const auto& hole : holes) index.Insert(hole, 0);
+    });
+    Time("holes Erase, tree by (size, address)", n, [&]() {
+      for (const auto& hole : shuffled) index.Erase(hole);
+    });
+    assert(index.Empty());
+  }
+}
+
+}  // namespace
+
+int main() {
+  SequentialInsertBench(1'000'000);
+  MixedUpdateQueryBench(10'000, 500'000);
+  BulkBuildBench(1'000'000);
+  StringKeyBench(200'000, 100, 8);
+  StringKeyBench(200'000, 100, 128);
+  ConcatBench<StringCatReducer>("concat Insert, std::string, 20000", 20'000);
+  ConcatBench<RopeCatReducer>("concat Insert, Rope, 20000", 20'000);
+  ConcatBench<RopeCatReducer>("concat Insert, Rope, 1000000", 1'000'000);
+  HoleIndexBench(1'000'000);
+}
@@ -1,7 +1,29 @@
 #include "reducer_tree.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iterator>
 #include <map>
+#include <new>
 #include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Count allocations, so tests can check that some operations don't allocate.
+static std::atomic<size_t> allocation_count = 0;
+
+void* operator new(size_t size) {
+  ++allocation_count;
+  if (void* result = std::malloc(size)) {
+    return result;
+  }
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
 
 class StringToLengthReducer {
  public:
@@ -179,7 +201,7 @@ class MaxReducer {
   size_t value_view() const { return _max; }
  private:
   explicit MaxReducer(size_t v) :_max(v) {}
-  size_t _max;
+  size_t _max = 0;
 };
 
 static void RandomizedTest() {
@@ -235,6 +257,502 @@ static void RandomizedTest() {
   }
 }
 
+// Like `RandomizedTest`, but big: it relies on `SetDebugValidation` to check
+// only what each operation touched, with a full check now and then, so it
+// takes O(log n) per operation.  (With `num_ops` at 10^7 and `key_space` at
+// 2*10^6 it takes minutes rather than years.)
+static void LargeRandomizedTest() {
+  std::random_device device;
+  std::default_random_engine engine{device()};
+  constexpr size_t num_ops = 200'000;
+  constexpr size_t key_space = 100'000;
+  std::uniform_int_distribution<size_t> key_distribution(0, key_space);
+  std::uniform_int_distribution<size_t> op_distribution(0, 9);
+  for (bool lazy : {false, true}) {
+    ReducerTree<size_t, size_t, MaxReducer> tree;
+    std::map<size_t, size_t> expect;
+    tree.SetLazy(lazy);
+    tree.SetDebugValidation(50'000);
+    for (size_t opnum = 0; opnum < num_ops; ++opnum) {
+      size_t key = key_distribution(engine);
+      switch (op_distribution(engine)) {
+        case 0: {
+          // Erase a range of about 10 keys.
+          auto first = expect.lower_bound(key);
+          auto last = expect.lower_bound(key + 20);
+          assert(tree.EraseRange(key, key + 20) ==
+                 size_t(std::distance(first, last)));
+          expect.erase(first, last);
+          break;
+        }
+        case 1:
+        case 2:
+        case 3:
+          assert(tree.Erase(key) == (expect.erase(key) == 1));
+          break;
+        case 4: {
+          auto found = tree.Find(key);
+          auto it = expect.find(key);
+          assert(found.has_value() == (it != expect.end()));
+          if (found) {
+            assert(std::get<1>(*found) == it->second);
+          }
+          // The reduction at a node covers its subtree, so it is at least its
+          // own value.
+          assert(!found || std::get<2>(*found).value() >= it->second);
+          if (opnum % 100 == 0) {
+            size_t max = 0;
+            for (auto below = expect.begin(); below != expect.lower_bound(key);
+                 ++below) {
+              max = std::max(max, below->second);
+            }
+            assert(tree.PrefixLt(key).value() == max);
+          }
+          break;
+        }
+        default:
+          // Insert more than erase, so that the tree fills up, and often
+          // insert ascending runs.
+          if (opnum % 1000 < 100) {
+            key = key_space + opnum;
+          }
+          assert(tree.Insert(key, opnum) == expect.insert({key, opnum}).second);
+          break;
+      }
+      assert(tree.Size() == expect.size());
+    }
+    CheckTreeContains(tree, expect);
+  }
+}
+
+// Ascending insertions are appends to the right spine.
+static void AppendTest() {
+  ReducerTree<size_t, size_t, MaxReducer> tree;
+  std::map<size_t, size_t> expect;
+  size_t max = 0;
+  for (size_t i = 0; i < 1000; ++i) {
+    size_t v = (i * 7919) % 1009;
+    assert(tree.Insert(i, v));
+    expect.insert({i, v});
+    // Inserting it again is rejected.
+    assert(!tree.Insert(i, v + 1));
+    assert(tree.PrefixLt(i).value() == max);
+    max = std::max(max, v);
+    assert(tree.PrefixLt(i + 1).value() == max);
+    if (i % 100 == 0) {
+      CheckTreeContains(tree, expect);
+    }
+  }
+  CheckTreeContains(tree, expect);
+  // Going back to inserting small keys after a run of appends.
+  assert(tree.Insert(5000, 1));
+  assert(tree.Erase(3));
+  expect.erase(3);
+  assert(tree.Insert(3, 5000));
+  assert(tree.Insert(5001, 2));
+  expect.insert({5000, 1});
+  expect.insert({3, 5000});
+  expect.insert({5001, 2});
+  CheckTreeContains(tree, expect);
+}
+
+static void InsertHintTest() {
+  std::random_device device;
+  std::default_random_engine engine{device()};
+  ReducerTree<std::string, Empty, StringCatReducer> tree;
+  std::map<std::string, Empty> expect;
+  // Two interleaved ascending streams, each hinted with its own previous key.
+  std::string a = "a", b = "b";
+  assert(tree.Insert(a, Empty()));
+  assert(tree.Insert(b, Empty()));
+  expect.insert({a, Empty()});
+  expect.insert({b, Empty()});
+  for (size_t i = 0; i < 100; ++i) {
+    std::string next_a = a + "a";
+    std::string next_b = b + "b";
+    assert(tree.InsertHint(a, next_a, Empty()));
+    assert(tree.InsertHint(b, next_b, Empty()));
+    // Hinting with a key that isn't in the tree is allowed.
+    assert(!tree.InsertHint("c", next_a, Empty()));
+    expect.insert({next_a, Empty()});
+    expect.insert({next_b, Empty()});
+    a = std::move(next_a);
+    b = std::move(next_b);
+    CheckTreeContains(tree, expect);
+  }
+  std::string all;
+  for (const auto& [key, value] : expect) {
+    all += key;
+  }
+  assert(tree.PrefixLt("c").value() == all);
+  // Random keys near random hints.
+  std::uniform_int_distribution<size_t> letter(0, 25);
+  for (size_t i = 0; i < 300; ++i) {
+    auto it = expect.begin();
+    std::advance(it, std::uniform_int_distribution<size_t>(
+        0, expect.size() - 1)(engine));
+    std::string key = it->first;
+    key += static_cast<char>('a' + letter(engine));
+    bool inserted = tree.InsertHint(it->first, key, Empty());
+    assert(inserted == expect.insert({key, Empty()}).second);
+  }
+  CheckTreeContains(tree, expect);
+}
+
+// Returns the max of the values whose keys are `< key`.
+static size_t PrefixMax(const std::map<size_t, size_t>& map, size_t key) {
+  size_t max = 0;
+  for (auto it = map.begin(); it != map.end() && it->first < key; ++it) {
+    max = std::max(max, it->second);
+  }
+  return max;
+}
+
+static void LazyTest() {
+  std::random_device device;
+  std::default_random_engine engine{device()};
+  std::uniform_int_distribution<size_t> distribution(0, 999);
+  ReducerTree<size_t, size_t, MaxReducer> tree;
+  std::map<size_t, size_t> expect;
+  tree.SetLazy(true);
+  assert(tree.Lazy());
+  for (size_t round = 0; round < 20; ++round) {
+    // A burst of updates with no queries.
+    for (size_t i = 0; i < 100; ++i) {
+      size_t key = distribution(engine);
+      if (distribution(engine) % 3 == 0) {
+        assert(tree.Erase(key) == (expect.erase(key) == 1));
+      } else {
+        size_t value = distribution(engine);
+        assert(tree.Insert(key, value) == expect.insert({key, value}).second);
+      }
+    }
+    // Validate doesn't refresh, but checks the dirty invariants.
+    tree.Validate();
+    // Queries recompute what they look at.
+    for (size_t i = 0; i < 10; ++i) {
+      size_t key = distribution(engine);
+      assert(tree.PrefixLt(key).value() == PrefixMax(expect, key));
+      tree.Validate();
+    }
+    if (round % 2 == 0) {
+      tree.Refresh();
+    }
+    CheckTreeContains(tree, expect);
+  }
+  tree.SetLazy(false);
+  CheckTreeContains(tree, expect);
+}
+
+static void EraseRangeTest() {
+  std::random_device device;
+  std::default_random_engine engine{device()};
+  std::uniform_int_distribution<size_t> distribution(0, 999);
+  for (bool lazy : {false, true}) {
+    ReducerTree<size_t, size_t, MaxReducer> tree;
+    std::map<size_t, size_t> expect;
+    tree.SetLazy(lazy);
+    // Empty ranges and empty trees.
+    assert(tree.EraseRange(0, 1000) == 0);
+    for (size_t i = 0; i < 500; ++i) {
+      size_t key = distribution(engine);
+      tree.Insert(key, key);
+      expect.insert({key, key});
+    }
+    assert(tree.EraseRange(500, 500) == 0);
+    assert(tree.EraseRange(600, 500) == 0);
+    CheckTreeContains(tree, expect);
+    for (size_t round = 0; round < 50; ++round) {
+      size_t lo = distribution(engine);
+      size_t hi = lo + distribution(engine) / 10;
+      auto first = expect.lower_bound(lo);
+      auto last = expect.lower_bound(hi);
+      std::map<size_t, size_t> range(first, last);
+      expect.erase(first, last);
+      if (round % 2 == 0) {
+        assert(tree.EraseRange(lo, hi) == range.size());
+      } else {
+        auto extracted = tree.ExtractRange(lo, hi);
+        assert(extracted.Lazy() == lazy);
+        assert(extracted.Size() == range.size());
+        CheckTreeContains(extracted, range);
+        if (!range.empty()) {
+          assert(extracted.PrefixLt(hi).value() == PrefixMax(range, hi));
+        }
+      }
+      assert(tree.Size() == expect.size());
+      CheckTreeContains(tree, expect);
+      // The tree still works after cutting out a range.
+      size_t key = distribution(engine);
+      assert(tree.Insert(key, key) == expect.insert({key, key}).second);
+      CheckTreeContains(tree, expect);
+    }
+    assert(tree.EraseRange(0, 1000) == expect.size());
+    assert(tree.Empty());
+    tree.Validate();
+  }
+}
+
+static void BuildParallelTest() {
+  std::random_device device;
+  std::default_random_engine engine{device()};
+  ThreadPool pool(4);
+  for (size_t size : {0u, 1u, 2u, 3u, 1000u, 100'000u}) {
+    std::uniform_int_distribution<size_t> distribution(0, 2 * size);
+    std::vector<std::pair<size_t, size_t>> elements;
+    std::map<size_t, size_t> expect;
+    for (size_t i = 0; i < size; ++i) {
+      size_t key = distribution(engine);
+      elements.emplace_back(key, i);
+      // The first occurrence of a key wins.
+      expect.insert({key, i});
+    }
+    auto tree = ReducerTree<size_t, size_t, MaxReducer>::BuildParallel(
+        std::move(elements), pool, 100);
+    assert(tree.Size() == expect.size());
+    CheckTreeContains(tree, expect);
+    // The tree is a treap that the usual operations work on.
+    for (size_t i = 0; i < 100; ++i) {
+      size_t key = distribution(engine);
+      if (i % 2) {
+        assert(tree.Erase(key) == (expect.erase(key) == 1));
+      } else {
+        assert(tree.Insert(key, i) == expect.insert({key, i}).second);
+      }
+      assert(tree.PrefixLt(key).value() == PrefixMax(expect, key));
+    }
+    CheckTreeContains(tree, expect);
+  }
+  // String keys and values get moved into the nodes.
+  std::vector<std::pair<std::string, Empty>> elements;
+  for (char c = 'z'; c >= 'a'; --c) {
+    elements.emplace_back(std::string(1, c), Empty());
+  }
+  auto tree = ReducerTree<std::string, Empty, StringCatReducer>::BuildParallel(
+      std::move(elements), pool, 4);
+  tree.Validate();
+  assert(tree.PrefixLt("zz").value() == "abcdefghijklmnopqrstuvwxyz");
+}
+
+static void ParallelTraversalTest() {
+  std::random_device device;
+  std::default_random_engine engine{device()};
+  std::uniform_int_distribution<size_t> distribution(0, 1'000'000);
+  ThreadPool pool(4);
+  for (size_t size : {0u, 1u, 10u, 10'000u}) {
+    ReducerTree<size_t, size_t, MaxReducer> tree;
+    std::map<size_t, size_t> expect;
+    for (size_t i = 0; i < size; ++i) {
+      size_t key = distribution(engine);
+      tree.Insert(key, i);
+      expect.insert({key, i});
+    }
+    size_t expected_sum = 0;
+    for (const auto& [key, value] : expect) {
+      expected_sum += key + value;
+    }
+    for (size_t grain : {1u, 100u, 1'000'000u}) {
+      std::atomic<size_t> count = 0, sum = 0;
+      tree.ParallelForAll(pool, [&](size_t key, size_t value,
+                                    const MaxReducer&) {
+        ++count;
+        sum += key + value;
+      }, grain);
+      assert(count == expect.size());
+      assert(sum == expected_sum);
+      // Export in order.
+      using Elements = std::vector<std::pair<size_t, size_t>>;
+      Elements elements = tree.ParallelMapReduce(
+          pool,
+          [](size_t key, size_t value, const MaxReducer&) {
+            return Elements{{key, value}};
+          },
+          [](Elements a, const Elements& b) {
+            a.insert(a.end(), b.begin(), b.end());
+            return a;
+          },
+          Elements(), grain);
+      assert(elements == Elements(expect.begin(), expect.end()));
+    }
+  }
+  // `combine` needn't be commutative.
+  ReducerTree<std::string, Empty, StringCatReducer> tree;
+  for (char c = 'a'; c <= 'z'; ++c) {
+    tree.Insert(std::string(1, c), Empty());
+  }
+  std::string all = tree.ParallelMapReduce(
+      pool,
+      [](const std::string& key, Empty, const StringCatReducer&) {
+        return key;
+      },
+      [](const std::string& a, const std::string& b) { return a + b; },
+      std::string(), 2);
+  assert(all == "abcdefghijklmnopqrstuvwxyz");
+}
+
+class CountReducer {
+ public:
+  CountReducer() = default;
+  CountReducer(const std::string&, Empty) :_count(1) {}
+  CountReducer operator+(const CountReducer& other) const {
+    return CountReducer(_count + other._count);
+  }
+  size_t value() const { return _count; }
+ private:
+  explicit CountReducer(size_t count) :_count(count) {}
+  size_t _count = 0;
+};
+
+static void HeterogeneousLookupTest() {
+  ReducerTree<std::string, Empty, CountReducer> tree;
+  // Long enough that making a `std::string` of one allocates.
+  const std::string prefix(100, 'x');
+  std::vector<std::string> keys;
+  for (char c = 'a'; c <= 'z'; ++c) {
+    keys.push_back(prefix + c);
+    assert(tree.Insert(keys.back(), Empty()));
+  }
+  std::string other = prefix + "zz";
+  std::string_view a = keys[0], m = keys[12], z = keys[25];
+  tree.Refresh();
+  size_t allocations = allocation_count;
+  assert(tree.Find(m));
+  assert(std::get<0>(*tree.Find(m)) == m);
+  assert(!tree.Find(std::string_view(other)));
+  assert(tree.PrefixLt(m).value() == 12);
+  assert(tree.PrefixLt(z).value() == 25);
+  assert(tree.PrefixLt(std::string_view(other)).value() == 26);
+  // String literals are compared as they are, too.
+  assert(!tree.Find("x"));
+  assert(tree.PrefixLt("y").value() == 26);
+  // Emplacing a key that's already there doesn't construct anything.
+  assert(!tree.Emplace(a, Empty()));
+  assert(!tree.Emplace(keys[1], Empty()));
+  assert(!tree.Erase(std::string_view(other)));
+  assert(!tree.Erase(other));
+  assert(tree.Erase(m));
+  assert(tree.Erase(keys[13]));
+  assert(tree.EraseRange(std::string_view(keys[20]), z) == 5);
+  assert(allocation_count == allocations);
+  // Emplace constructs the key from the `std::string_view` when it inserts.
+  assert(tree.Emplace(m, Empty()));
+  assert(tree.Emplace(std::string_view(other)));
+  assert(tree.Find(other));
+  assert(tree.Size() == 26 - 7 + 2);
+  tree.Validate();
+}
+
+// Keys that share long prefixes, and differ in bytes both below and above
+// 0x80, against a `std::map`.
+static void SharedPrefixTest() {
+  ReducerTree<std::string, Empty, CountReducer> tree;
+  std::map<std::string, Empty> expect;
+  std::default_random_engine engine(7);
+  const std::string prefixes[] = {"", std::string(5, 'p'),
+                                  std::string(21, 'p'),
+                                  std::string(21, 'p') + "\xf0q"};
+  auto random_key = [&]() {
+    std::string key = prefixes[engine() % std::size(prefixes)];
+    for (size_t n = engine() % 12; n > 0; --n) {
+      const char bytes[] = {'a', 'b', 'p', '\x7f', '\x80', '\xf0'};
+      key += bytes[engine() % std::size(bytes)];
+    }
+    return key;
+  };
+  for (size_t i = 0; i < 20'000; ++i) {
+    std::string key = random_key();
+    switch (engine() % 4) {
+      case 0:
+      case 1:
+        assert(tree.Insert(key, Empty()) == expect.emplace(key, Empty()).second);
+        break;
+      case 2:
+        assert(tree.Erase(std::string_view(key)) == (expect.erase(key) == 1));
+        break;
+      case 3: {
+        assert(tree.Find(std::string_view(key)).has_value() ==
+               expect.contains(key));
+        auto lower = expect.lower_bound(key);
+        size_t below = static_cast<size_t>(
+            std::distance(expect.begin(), lower));
+        assert(tree.PrefixLt(std::string_view(key)).value() == below);
+        break;
+      }
+    }
+  }
+  assert(tree.Size() == expect.size());
+  for (size_t i = 0; i < 100; ++i) {
+    std::string lo = random_key(), hi = random_key();
+    if (hi < lo) std::swap(lo, hi);
+    size_t erased = 0;
+    for (auto it = expect.lower_bound(lo); it != expect.end() && it->first < hi;) {
+      it = expect.erase(it);
+      ++erased;
+    }
+    assert(tree.EraseRange(std::string_view(lo), std::string_view(hi)) ==
+           erased);
+  }
+  assert(tree.Size() == expect.size());
+  auto it = expect.begin();
+  bool in_order = tree.ForAll([&](const std::string& key, const Empty&,
+                                  const CountReducer&) {
+    return key == (it++)->first;
+  });
+  assert(in_order && it == expect.end());
+  tree.Validate();
+}
+
+static void NodeHandleTest() {
+  using Tree = ReducerTree<size_t, size_t, MaxReducer>;
+  Tree free_blocks, allocated_blocks;
+  std::map<size_t, size_t> expect_free, expect_allocated;
+  for (size_t i = 0; i < 100; ++i) {
+    free_blocks.Insert(i, i * 10);
+    expect_free.insert({i, i * 10});
+  }
+  assert(free_blocks.Extract(1000).Empty());
+  auto MoveAll = [](Tree& from, std::map<size_t, size_t>& expect_from,
+                    Tree& to, std::map<size_t, size_t>& expect_to) {
+    for (size_t i = 0; i < 100; ++i) {
+      Tree::NodeHandle handle = from.Extract(i);
+      assert(handle);
+      assert(handle.Key() == i);
+      assert(handle.Value() == i * 10);
+      assert(to.Insert(std::move(handle)));
+      assert(handle.Empty());
+      expect_to.insert(expect_from.extract(i));
+    }
+  };
+  // The first round trip sizes the fingers.
+  MoveAll(free_blocks, expect_free, allocated_blocks, expect_allocated);
+  MoveAll(allocated_blocks, expect_allocated, free_blocks, expect_free);
+  // Moving nodes between trees doesn't allocate.
+  size_t allocations = allocation_count;
+  MoveAll(free_blocks, expect_free, allocated_blocks, expect_allocated);
+  assert(allocation_count == allocations);
+  CheckTreeContains(free_blocks, expect_free);
+  CheckTreeContains(allocated_blocks, expect_allocated);
+  assert(allocated_blocks.PrefixLt(50).value() == 490);
+  // The key and value can be changed before reinserting.
+  Tree::NodeHandle handle = allocated_blocks.Extract(size_t(7));
+  handle.Key() = 1000;
+  handle.Value() = 1;
+  assert(allocated_blocks.Insert(std::move(handle)));
+  expect_allocated.erase(7);
+  expect_allocated.insert({1000, 1});
+  CheckTreeContains(allocated_blocks, expect_allocated);
+  // A failed insertion leaves the node in the handle.
+  handle = allocated_blocks.Extract(size_t(8));
+  handle.Key() = 9;
+  assert(!allocated_blocks.Insert(std::move(handle)));
+  assert(handle && handle.Key() == 9 && handle.Value() == 80);
+  assert(free_blocks.Insert(std::move(handle)));
+  expect_allocated.erase(8);
+  expect_free.insert({9, 80});
+  CheckTreeContains(free_blocks, expect_free);
+  CheckTreeContains(allocated_blocks, expect_allocated);
+}
+
 int main() {
   NodeTestSplitEmpty();
   NodeTestSplitOneLeft();
@@ -243,4 +761,14 @@ int main() {
   Test1();
   Test2();
   RandomizedTest();
+  AppendTest();
+  InsertHintTest();
+  LazyTest();
+  EraseRangeTest();
+  BuildParallelTest();
+  ParallelTraversalTest();
+  HeterogeneousLookupTest();
+  SharedPrefixTest();
+  NodeHandleTest();
+  LargeRandomizedTest();
 }
@@ -0,0 +1,156 @@
+/* How much memory a heap would really use: the number of pages (and huge
+ * pages) that hold at least one byte of a live block.  Pages with no live
+ * bytes can be given back to the OS, so this is an "effective RSS", which
+ * can be much less than the high-water mark.
+ *
+ * The counts are kept up to date as blocks come and go, from the neighbors
+ * that `BlockLayout::Insert` and `Erase` return at no extra cost: only the
+ * first and last page of a block can be shared with another block, and then
+ * only with the block right below or right above it.  So an update takes
+ * O(1) time on top of the layout's O(log n).  A batch of frees sorted by
+ * address (`BlockLayout::EraseBatch`) is counted in one pass over the batch.
+ */
+
+#ifndef RESIDENCY_H_
+#define RESIDENCY_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "block_layout.h"
+#include "checkpoint.h"
+
+// Counts the pages of one size that hold live bytes, and the most there have
+// been at once.
+class PageCounter {
+ public:
+  explicit PageCounter(size_t page_size) :_page_size(page_size) {}
+
+  size_t PageSize() const { return _page_size; }
+  size_t Pages() const { return _pages; }
+  size_t PeakPages() const { return _peak_pages; }
+
+  // Call after `block` is inserted, with the neighbors it was inserted
+  // between.
+  void Insert(Block block, BlockLayout::Neighbors neighbors) {
+    _pages += OwnPages(block, neighbors);
+    _peak_pages = std::max(_peak_pages, _pages);
+  }
+
+  // Call after `block` is erased, with the neighbors it had.
+  void Erase(Block block, BlockLayout::Neighbors neighbors) {
+    size_t own = OwnPages(block, neighbors);
+    assert(own <= _pages);
+    _pages -= own;
+  }
+
+  // Call after `blocks`, sorted by address, are erased together, with the
+  // neighbors `BlockLayout::EraseBatch` returned.  A page can hold bytes of
+  // several of them, so it counts each page once.
+  void EraseBatch(std::span<const Block> blocks,
+                  std::span<const BlockLayout::Neighbors> neighbors) {
+    assert(blocks.size() == neighbors.size());
+    size_t next_page = 0;  // The first page not counted yet.
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      size_t first = blocks[i].start() / _page_size;
+      size_t last = (blocks[i].end() - 1) / _page_size;
+      // `[first, end)` are the pages that no block that stays holds.
+      size_t end = last + 1;
+      if (neighbors[i].below_end > 0 &&
+          (neighbors[i].below_end - 1) / _page_size == first) {
+        ++first;
+      }
+      if (neighbors[i].above_start != SIZE_MAX &&
+          neighbors[i].above_start / _page_size == last) {
+        --end;
+      }
+      first = std::max(first, next_page);
+      if (first < end) {
+        assert(end - first <= _pages);
+        _pages -= end - first;
+      }
+      next_page = std::max(next_page, last + 1);
+    }
+  }
+
+  // Counts the pages of `blocks` from scratch, in O(n) time, and resets the
+  // peak to that (as the high-water mark is reset after compaction).
+  void Recount(const BlockLayout& blocks) {
+    _pages = 0;
+    size_t next_page = 0;  // The first page not counted yet.
+    blocks.ForAll([&](Block block) {
+      size_t first = std::max(block.start() / _page_size, next_page);
+      size_t last = (block.end() - 1) / _page_size;
+      if (first <= last) _pages += last - first + 1;
+      next_page = std::max(next_page, last + 1);
+    });
+    _peak_pages = _pages;
+  }
+
+  void Save(CheckpointWriter& writer) const {
+    writer.Write(_pages);
+    writer.Write(_peak_pages);
+  }
+  void Restore(CheckpointReader& reader) {
+    _pages = reader.Read();
+    _peak_pages = reader.Read();
+  }
+
+ private:
+  // The number of pages that hold bytes of `block` and of no other block.
+  size_t OwnPages(Block block, BlockLayout::Neighbors neighbors) const {
+    assert(block.size() > 0);
+    size_t first = block.start() / _page_size;
+    size_t last = (block.end() - 1) / _page_size;
+    bool shares_first = neighbors.below_end > 0 &&
+                        (neighbors.below_end - 1) / _page_size == first;
+    bool shares_last = neighbors.above_start != SIZE_MAX &&
+                       neighbors.above_start / _page_size == last;
+    if (first == last) return shares_first || shares_last ? 0 : 1;
+    return last - first + 1 - shares_first - shares_last;
+  }
+
+  size_t _page_size;
+  size_t _pages = 0;
+  size_t _peak_pages = 0;
+};
+
+// Both counts that matter on x86-64: 4KiB pages and 2MiB huge pages.
+struct Residency {
+  static constexpr size_t kPageSize = 4 << 10;
+  static constexpr size_t kHugePageSize = 2 << 20;
+
+  PageCounter pages{kPageSize};
+  PageCounter huge_pages{kHugePageSize};
+
+  void Insert(Block block, BlockLayout::Neighbors neighbors) {
+    pages.Insert(block, neighbors);
+    huge_pages.Insert(block, neighbors);
+  }
+  void Erase(Block block, BlockLayout::Neighbors neighbors) {
+    pages.Erase(block, neighbors);
+    huge_pages.Erase(block, neighbors);
+  }
+  void EraseBatch(std::span<const Block> blocks,
+                  std::span<const BlockLayout::Neighbors> neighbors) {
+    pages.EraseBatch(blocks, neighbors);
+    huge_pages.EraseBatch(blocks, neighbors);
+  }
+  void Recount(const BlockLayout& blocks) {
+    pages.Recount(blocks);
+    huge_pages.Recount(blocks);
+  }
+  void Save(CheckpointWriter& writer) const {
+    pages.Save(writer);
+    huge_pages.Save(writer);
+  }
+  void Restore(CheckpointReader& reader) {
+    pages.Restore(reader);
+    huge_pages.Restore(reader);
+  }
+};
+
+#endif  // RESIDENCY_H_
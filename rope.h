@@ -0,0 +1,216 @@
+/* An immutable rope: a string kept as a balanced tree of chunks, so that
+ * concatenation shares both operands instead of copying them.
+ *
+ * Nodes are immutable and reference counted, so a rope is cheap to copy and
+ * two ropes can share any part of their trees.  The tree is an AVL tree with
+ * the chunks at the leaves.  `a + b` joins the two trees, making
+ * O(|height(a) - height(b)| + 1) new nodes, which is O(log n) for n chunks,
+ * and shares everything else.  A short chunk joined onto a rope is copied
+ * into the rope's adjacent edge chunk when the two fit in `kChunkBytes`
+ * (rebuilding that edge's O(log n) nodes), so that a rope built up from many
+ * one-character pieces doesn't spend a node on every character.
+ *
+ * That makes a rope a good reducer value for concatenation: with
+ * `RopeCatReducer` a `ReducerTree` updates a path in O(log^2 n) time rather
+ * than O(total length), and the reductions of all the nodes share their
+ * chunks, rather than each holding a copy of its whole subtree's string.
+ */
+
+#ifndef ROPE_H_
+#define ROPE_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+class Rope {
+ public:
+  // A single chunk is merged into the edge chunk it's joined to when the two
+  // together are at most this long.
+  static constexpr size_t kChunkBytes = 64;
+
+  Rope() = default;
+  explicit Rope(std::string_view s)
+      :_root(s.empty() ? nullptr : MakeLeaf(std::string(s))) {}
+
+  friend Rope operator+(const Rope& a, const Rope& b) {
+    return Rope(Join(a._root, b._root));
+  }
+
+  size_t size() const { return _root ? _root->size : 0; }
+  bool empty() const { return !_root; }
+
+  // The character at `i`, in O(log n) time.
+  char operator[](size_t i) const {
+    assert(i < size());
+    const Node* node = _root.get();
+    while (!node->IsLeaf()) {
+      if (i < node->left->size) {
+        node = node->left.get();
+      } else {
+        i -= node->left->size;
+        node = node->right.get();
+      }
+    }
+    return node->chunk[i];
+  }
+
+  // Calls `fun(std::string_view)` on each chunk, in order.
+  template <class Fun>
+  void ForEachChunk(Fun fun) const {
+    if (_root) ForEachChunk(_root.get(), fun);
+  }
+
+  // The whole string, copied out.
+  std::string str() const {
+    std::string result;
+    result.reserve(size());
+    ForEachChunk([&](std::string_view chunk) { result += chunk; });
+    return result;
+  }
+
+  // The height of the tree (0 for a single chunk), for tests.
+  size_t Height() const { return _root ? _root->height : 0; }
+
+  friend bool operator==(const Rope& a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    bool equal = true;
+    size_t at = 0;
+    a.ForEachChunk([&](std::string_view chunk) {
+      equal = equal && chunk == b.substr(at, chunk.size());
+      at += chunk.size();
+    });
+    return equal;
+  }
+  friend bool operator==(const Rope& a, const Rope& b) {
+    return a._root == b._root || (a.size() == b.size() && a == b.str());
+  }
+
+ private:
+  struct Node;
+  using Ptr = std::shared_ptr<const Node>;
+
+  // A leaf holds a chunk; an inner node holds two subtrees whose heights
+  // differ by at most one.
+  struct Node {
+    Ptr left;
+    Ptr right;
+    std::string chunk;
+    size_t size;
+    uint8_t height;
+
+    bool IsLeaf() const { return !left; }
+  };
+
+  explicit Rope(Ptr root) :_root(std::move(root)) {}
+
+  static Ptr MakeLeaf(std::string chunk) {
+    size_t size = chunk.size();
+    return std::make_shared<const Node>(
+        Node{nullptr, nullptr, std::move(chunk), size, 0});
+  }
+  static Ptr MakeNode(Ptr left, Ptr right) {
+    size_t size = left->size + right->size;
+    auto height =
+        static_cast<uint8_t>(std::max(left->height, right->height) + 1);
+    return std::make_shared<const Node>(
+        Node{std::move(left), std::move(right), {}, size, height});
+  }
+  static int Height(const Ptr& node) { return node->height; }
+
+  // A balanced tree of `left` then `right`, whose heights differ by at most
+  // two.
+  static Ptr Balance(Ptr left, Ptr right) {
+    if (Height(left) > Height(right) + 1) {
+      if (Height(left->left) >= Height(left->right)) {
+        return MakeNode(left->left, MakeNode(left->right, std::move(right)));
+      }
+      const Ptr& middle = left->right;
+      return MakeNode(MakeNode(left->left, middle->left),
+                      MakeNode(middle->right, std::move(right)));
+    }
+    if (Height(right) > Height(left) + 1) {
+      if (Height(right->right) >= Height(right->left)) {
+        return MakeNode(MakeNode(std::move(left), right->left), right->right);
+      }
+      const Ptr& middle = right->left;
+      return MakeNode(MakeNode(std::move(left), middle->left),
+                      MakeNode(middle->right, right->right));
+    }
+    return MakeNode(std::move(left), std::move(right));
+  }
+
+  // `node` with its last (or first) leaf replaced by `leaf`.  Every height is
+  // unchanged, so the tree stays balanced.
+  static Ptr ReplaceLast(const Ptr& node, Ptr leaf) {
+    if (node->IsLeaf()) return leaf;
+    return MakeNode(node->left, ReplaceLast(node->right, std::move(leaf)));
+  }
+  static Ptr ReplaceFirst(const Ptr& node, Ptr leaf) {
+    if (node->IsLeaf()) return leaf;
+    return MakeNode(ReplaceFirst(node->left, std::move(leaf)), node->right);
+  }
+
+  // Concatenates `a` and `b`, either of which may be null, walking down the
+  // side of the taller one to the height of the shorter.  If either is a
+  // single chunk that fits in the other's adjacent edge chunk, the two chunks
+  // are copied into one instead.
+  static Ptr Join(const Ptr& a, const Ptr& b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (b->IsLeaf()) {
+      const Node* last = a.get();
+      while (!last->IsLeaf()) last = last->right.get();
+      if (last->size + b->size <= kChunkBytes) {
+        return ReplaceLast(a, MakeLeaf(last->chunk + b->chunk));
+      }
+    }
+    if (a->IsLeaf()) {
+      const Node* first = b.get();
+      while (!first->IsLeaf()) first = first->left.get();
+      if (a->size + first->size <= kChunkBytes) {
+        return ReplaceFirst(b, MakeLeaf(a->chunk + first->chunk));
+      }
+    }
+    if (Height(a) > Height(b) + 1) {
+      return Balance(a->left, Join(a->right, b));
+    }
+    if (Height(b) > Height(a) + 1) {
+      return Balance(Join(a, b->left), b->right);
+    }
+    return MakeNode(a, b);
+  }
+
+  template <class Fun>
+  static void ForEachChunk(const Node* node, Fun& fun) {
+    while (!node->IsLeaf()) {
+      ForEachChunk(node->left.get(), fun);
+      node = node->right.get();
+    }
+    fun(std::string_view(node->chunk));
+  }
+
+  Ptr _root;
+};
+
+// Reduces a `ReducerTree` to the concatenation of its keys, as a `Rope`.
+class RopeCatReducer {
+ public:
+  RopeCatReducer() = default;
+  template <class V>
+  RopeCatReducer(std::string_view key, const V&) :_rope(key) {}
+  RopeCatReducer operator+(const RopeCatReducer& other) const {
+    return RopeCatReducer(_rope + other._rope);
+  }
+  const Rope& value() const { return _rope; }
+ private:
+  explicit RopeCatReducer(Rope rope) :_rope(std::move(rope)) {}
+  Rope _rope;
+};
+
+#endif  // ROPE_H_
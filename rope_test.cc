@@ -0,0 +1,131 @@
+#include "rope.h"
+
+#include "reducer_tree.h"
+
+#include <cmath>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+struct Empty {};
+
+// An AVL tree of n leaves is at most about 1.44 log2(n) high.
+static void CheckHeight(const Rope& rope, size_t chunks) {
+  double bound = 1.45 * std::log2(static_cast<double>(chunks) + 2) + 1;
+  assert(static_cast<double>(rope.Height()) <= bound);
+}
+
+static void SmallTest() {
+  Rope empty;
+  assert(empty.empty() && empty.size() == 0 && empty == "");
+  Rope a("abc"), b("de");
+  Rope ab = a + b;
+  assert(ab == "abcde" && ab.size() == 5);
+  assert(ab[0] == 'a' && ab[3] == 'd' && ab[4] == 'e');
+  // Short chunks become one.
+  assert(ab.Height() == 0);
+  assert(empty + ab == "abcde" && ab + empty == "abcde");
+  // The operands are unchanged.
+  assert(a == "abc" && b == "de");
+  Rope long_a(std::string(Rope::kChunkBytes, 'x'));
+  Rope joined = long_a + b;
+  assert(joined.Height() == 1);
+  assert(joined.str() == std::string(Rope::kChunkBytes, 'x') + "de");
+  assert(!(joined == "xxde"));
+  // A short chunk goes into the edge chunk it meets, at either end.
+  Rope longer = joined + Rope("f");
+  assert(longer.Height() == 1 && longer.str() == joined.str() + "f");
+  Rope mixed = Rope("a") + long_a;
+  assert(mixed.Height() == 1);
+  assert((Rope("b") + mixed).Height() == 1);
+  assert(Rope("b") + mixed == "ba" + long_a.str());
+  // One character at a time fills whole chunks.
+  Rope built;
+  for (size_t i = 0; i < 1000; ++i) built = built + Rope("y");
+  size_t chunks = 0;
+  built.ForEachChunk([&](std::string_view chunk) {
+    assert(chunk.size() <= Rope::kChunkBytes);
+    ++chunks;
+  });
+  assert(chunks == (1000 + Rope::kChunkBytes - 1) / Rope::kChunkBytes);
+  assert(built == std::string(1000, 'y'));
+}
+
+// Random concatenations, of ropes both built up and taken from a pool, match
+// the same concatenations of `std::string`s.
+static void RandomizedTest() {
+  std::default_random_engine engine(3);
+  std::vector<Rope> ropes;
+  std::vector<std::string> strings;
+  std::vector<size_t> chunks;
+  for (size_t i = 0; i < 2000; ++i) {
+    size_t n = engine() % 3 == 0 ? 1 + engine() % 200 : 1 + engine() % 5;
+    std::string s;
+    for (size_t j = 0; j < n; ++j) {
+      s += static_cast<char>('a' + engine() % 26);
+    }
+    if (ropes.size() < 2 || engine() % 4 == 0) {
+      ropes.emplace_back(s);
+      strings.push_back(s);
+      chunks.push_back(1);
+      continue;
+    }
+    size_t x = engine() % ropes.size(), y = engine() % ropes.size();
+    ropes.push_back(ropes[x] + ropes[y]);
+    strings.push_back(strings[x] + strings[y]);
+    chunks.push_back(chunks[x] + chunks[y]);
+    const Rope& rope = ropes.back();
+    const std::string& string = strings.back();
+    assert(rope.size() == string.size());
+    CheckHeight(rope, chunks.back());
+    size_t at = engine() % string.size();
+    assert(rope[at] == string[at]);
+    // Keep the strings from growing without bound.
+    if (string.size() > 100'000) {
+      ropes.pop_back();
+      strings.pop_back();
+      chunks.pop_back();
+    }
+  }
+  for (size_t i = 0; i < ropes.size(); ++i) {
+    assert(ropes[i] == strings[i]);
+    assert(ropes[i].str() == strings[i]);
+    for (size_t j = 0; j < strings[i].size(); j += 1 + strings[i].size() / 7) {
+      assert(ropes[i][j] == strings[i][j]);
+    }
+  }
+}
+
+// A tree of ropes reduces to the concatenation of its keys, through inserts
+// and erases.
+static void ReducerTest() {
+  ReducerTree<std::string, Empty, RopeCatReducer> tree;
+  std::map<std::string, Empty> expect;
+  std::default_random_engine engine(5);
+  for (size_t i = 0; i < 5000; ++i) {
+    std::string key = std::to_string(engine() % 2000);
+    if (engine() % 3 == 0) {
+      assert(tree.Erase(key) == (expect.erase(key) == 1));
+    } else {
+      assert(tree.Insert(key, Empty()) == expect.emplace(key, Empty()).second);
+    }
+    if (i % 100 == 0) {
+      std::string all, below;
+      for (const auto& [k, v] : expect) {
+        if (k < key) below += k;
+        all += k;
+      }
+      assert(tree.PrefixLt(key).value() == below);
+      assert(tree.Reduce().value() == all);
+      CheckHeight(tree.Reduce().value(), expect.size());
+    }
+  }
+  tree.Validate();
+}
+
+int main() {
+  SmallTest();
+  RandomizedTest();
+  ReducerTest();
+}
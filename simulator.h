@@ -0,0 +1,210 @@
+/* The core of an event-driven fitness simulation: the clock, and the queue of
+ * blocks waiting to die.
+ *
+ * Time is an integer number of ticks (one per allocation in `fitness.cc`).
+ * Deaths are kept in a `RadixHeap`, a priority queue for keys that never go
+ * below the last key popped.  That's always true of a simulation's deaths,
+ * since nothing dies in the past.  A push is an append to a vector, and each
+ * entry moves to a lower bucket at most once per bit of its distance from
+ * the clock, so an event costs amortised O(log L) for lifetimes up to L (in
+ * practice a few moves), with sequential memory access.  A binary heap does
+ * O(log n) cache misses per event, which for large n costs about as much as
+ * the allocator.
+ */
+
+#ifndef SIMULATOR_H_
+#define SIMULATOR_H_
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "block_layout.h"
+#include "checkpoint.h"
+
+// A min-priority queue of `(key, value)` pairs, where each key pushed must be
+// at least the last key popped.  `MinKey` and `Pop` take O(1) amortised
+// time, plus a move for each bit by which a key drops from bucket to bucket.
+template <class T>
+class RadixHeap {
+ public:
+  RadixHeap() = default;
+  // An empty heap whose keys must be at least `last_key`.
+  explicit RadixHeap(uint64_t last_key) :_last(last_key) {}
+
+  bool empty() const { return _size == 0; }
+  size_t size() const { return _size; }
+
+  void Push(uint64_t key, T value) {
+    assert(key >= _last);
+    size_t i = Bucket(key);
+    _buckets[i].push_back({key, std::move(value)});
+    _mins[i] = std::min(_mins[i], key);
+    ++_size;
+  }
+
+  // The smallest key.  The heap must not be empty.  This doesn't change the
+  // heap, so later pushes may still be below it.
+  uint64_t MinKey() const {
+    assert(_size > 0);
+    size_t i = 0;
+    while (_buckets[i].empty()) ++i;
+    return _mins[i];
+  }
+
+  // The last key popped (or the one given to the constructor).
+  uint64_t LastKey() const { return _last; }
+
+  // Applies `fun(key, value)` to every pair, bucket by bucket.  Pushing them
+  // in that order into a `RadixHeap(LastKey())` rebuilds this heap exactly,
+  // so that it pops equal keys in the same order.
+  template <class Fun>
+  void ForAll(Fun fun) const {
+    for (const std::vector<Entry>& bucket : _buckets) {
+      for (const Entry& entry : bucket) fun(entry.key, entry.value);
+    }
+  }
+
+  // Removes and returns a pair with the smallest key.  The heap must not be
+  // empty.
+  std::pair<uint64_t, T> Pop() {
+    Pull();
+    Entry entry = std::move(_buckets[0].back());
+    _buckets[0].pop_back();
+    if (_buckets[0].empty()) _mins[0] = UINT64_MAX;
+    --_size;
+    return {entry.key, std::move(entry.value)};
+  }
+
+ private:
+  struct Entry {
+    uint64_t key;
+    T value;
+  };
+
+  static std::array<uint64_t, 65> Filled(uint64_t value) {
+    std::array<uint64_t, 65> result;
+    result.fill(value);
+    return result;
+  }
+
+  // Bucket 0 holds the keys equal to `_last`, and bucket `i` the keys whose
+  // highest bit that differs from `_last` is bit `i - 1`.
+  size_t Bucket(uint64_t key) const {
+    return static_cast<size_t>(std::bit_width(key ^ _last));
+  }
+
+  // Makes bucket 0 nonempty, by advancing `_last` to the smallest key of the
+  // lowest nonempty bucket and redistributing that bucket, whose entries all
+  // land lower down.
+  void Pull() {
+    assert(_size > 0);
+    if (!_buckets[0].empty()) return;
+    size_t i = 1;
+    while (_buckets[i].empty()) ++i;
+    _last = _mins[i];
+    for (Entry& entry : _buckets[i]) {
+      size_t j = Bucket(entry.key);
+      _mins[j] = std::min(_mins[j], entry.key);
+      _buckets[j].push_back(std::move(entry));
+    }
+    _buckets[i].clear();
+    _mins[i] = UINT64_MAX;
+  }
+
+  std::array<std::vector<Entry>, 65> _buckets;
+  // The smallest key in each bucket (`UINT64_MAX` if it's empty).
+  std::array<uint64_t, 65> _mins = Filled(UINT64_MAX);
+  uint64_t _last = 0;
+  size_t _size = 0;
+};
+
+// The number of ticks a block with the given `lifetime` lives: allocated at
+// tick `t`, it is freed at the first tick at or after `t + lifetime`.
+inline uint64_t LifetimeTicks(double lifetime) {
+  assert(lifetime >= 0);
+  return static_cast<uint64_t>(std::ceil(lifetime));
+}
+
+// Drives an allocator (such as `FirstFit`) through time: the caller allocates
+// blocks and schedules their deaths, and `AdvanceTo` frees them when they're
+// due.
+template <class Allocator>
+class Simulator {
+ public:
+  explicit Simulator(Allocator& allocator) :_allocator(allocator) {}
+
+  uint64_t Now() const { return _now; }
+
+  // The bytes and the number of blocks that are allocated and not yet freed.
+  size_t LiveBytes() const { return _live_bytes; }
+  size_t LiveBlocks() const { return _deaths.size(); }
+
+  // Moves the clock forward to `time`, freeing every block that dies by then.
+  void AdvanceTo(uint64_t time) {
+    assert(time >= _now);
+    _now = time;
+    while (!_deaths.empty() && _deaths.MinKey() <= time) {
+      Block block = _deaths.Pop().second;
+      _live_bytes -= block.size();
+      _allocator.Free(block);
+    }
+  }
+
+  // Records that `block`, just allocated, dies `lifetime` ticks from now.
+  void Schedule(Block block, uint64_t lifetime) {
+    _live_bytes += block.size();
+    _deaths.Push(_now + lifetime, block);
+  }
+
+  // Allocates `size` bytes, to die `lifetime` ticks from now.
+  Block Allocate(size_t size, uint64_t lifetime) {
+    Block block = _allocator.Alloc(size);
+    Schedule(block, lifetime);
+    return block;
+  }
+
+  // Saves or restores the clock and the pending deaths (but not the
+  // allocator, which the caller saves alongside).  The deaths are rebuilt
+  // exactly, so blocks that die at the same tick are freed in the same order
+  // after a restore.  That matters for an allocator that batches its frees
+  // (`FirstFit(free_batch)`), where it decides which holes are free at the
+  // next allocation.
+  void Save(CheckpointWriter& writer) const {
+    writer.Write(_now);
+    writer.Write(_live_bytes);
+    writer.Write(_now - _deaths.LastKey());
+    writer.Write(_deaths.size());
+    _deaths.ForAll([&](uint64_t time, Block block) {
+      writer.Write(time - _now);
+      writer.Write(block.start());
+      writer.Write(block.size());
+    });
+  }
+  void Restore(CheckpointReader& reader) {
+    _now = reader.Read();
+    _live_bytes = reader.Read();
+    _deaths = RadixHeap<Block>(_now - reader.Read());
+    size_t count = reader.Read();
+    for (size_t i = 0; i < count && reader.Ok(); ++i) {
+      uint64_t time = _now + reader.Read();
+      size_t start = reader.Read();
+      size_t size = reader.Read();
+      _deaths.Push(time, Block(start, size));
+    }
+  }
+
+ private:
+  Allocator& _allocator;
+  RadixHeap<Block> _deaths;
+  uint64_t _now = 0;
+  size_t _live_bytes = 0;
+};
+
+#endif  // SIMULATOR_H_
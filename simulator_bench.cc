@@ -0,0 +1,139 @@
+// Benchmarks for `simulator.h`: the death queue alone, a `RadixHeap` against
+// a `std::priority_queue`, and whole simulations of `FirstFit` (freeing at
+// once, or in deferred batches), with about `live` blocks alive at once.  Run
+// with `make bench`, or `./simulator_bench live...` for other sizes (each
+// block costs 24 bytes in either queue, plus a tree node for `FirstFit`).
+
+#include "first_fit.h"
+#include "simulator.h"
+#include "workload.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Calls `fun` and prints the time per operation, where `fun` does `ops`
+// operations.
+template <class Fun>
+void Time(const char* name, size_t live, size_t ops, Fun fun) {
+  auto start = std::chrono::steady_clock::now();
+  fun();
+  auto end = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  std::printf("%-36s %10zu live %10zu ops %8.1f ns/op\n", name, live, ops,
+              ns / static_cast<double>(ops));
+}
+
+// One event per tick, for `ticks` ticks, with lifetimes averaging `live`
+// ticks.  The first `live` ticks fill the queue and aren't timed.
+void QueueBench(size_t live, size_t ticks) {
+  std::vector<uint64_t> lifetimes;
+  WorkloadStream stream({1, 16, 16}, static_cast<double>(live), 1);
+  for (size_t i = 0; i < live + ticks; ++i) {
+    lifetimes.push_back(LifetimeTicks(stream.Next().lifetime));
+  }
+  size_t sum = 0;
+  {
+    using Death = std::pair<uint64_t, Block>;
+    auto later = [](const Death& a, const Death& b) {
+      return a.first > b.first;
+    };
+    std::priority_queue<Death, std::vector<Death>, decltype(later)> deaths(
+        later);
+    auto tick = [&](uint64_t now) {
+      while (!deaths.empty() && deaths.top().first <= now) {
+        sum += deaths.top().second.size();
+        deaths.pop();
+      }
+      deaths.push({now + lifetimes[now], Block(now, 1)});
+    };
+    for (uint64_t now = 0; now < live; ++now) tick(now);
+    Time("std::priority_queue", live, ticks, [&]() {
+      for (uint64_t now = live; now < live + ticks; ++now) tick(now);
+    });
+  }
+  {
+    RadixHeap<Block> deaths;
+    auto tick = [&](uint64_t now) {
+      while (!deaths.empty() && deaths.MinKey() <= now) {
+        sum -= deaths.Pop().second.size();
+      }
+      deaths.Push(now + lifetimes[now], Block(now, 1));
+    };
+    for (uint64_t now = 0; now < live; ++now) tick(now);
+    Time("RadixHeap", live, ticks, [&]() {
+      for (uint64_t now = live; now < live + ticks; ++now) tick(now);
+    });
+  }
+  // Both queues freed the same blocks.
+  if (sum != 0) std::abort();
+}
+
+// `FirstFit` driven by a `Simulator`, with hyperexponential sizes.
+void SimulatorBench(size_t live, size_t ticks) {
+  WorkloadStream stream({0.9, 100, 10'000}, static_cast<double>(live), 1);
+  FirstFit ff;
+  Simulator<FirstFit> simulator(ff);
+  auto tick = [&](uint64_t now) {
+    simulator.AdvanceTo(now);
+    Request request = stream.Next();
+    simulator.Allocate(request.size, LifetimeTicks(request.lifetime));
+  };
+  for (uint64_t now = 0; now < live; ++now) tick(now);
+  Time("Simulator<FirstFit>", live, ticks, [&]() {
+    for (uint64_t now = live; now < live + ticks; ++now) tick(now);
+  });
+}
+
+// `SimulatorBench` with frees deferred and applied `batch` at a time, and
+// what that does to the high-water mark (relative to the most bytes live at
+// once).
+void DeferredFreeBench(size_t live, size_t ticks) {
+  for (size_t batch : {1u, 16u, 64u, 256u, 1024u}) {
+    WorkloadStream stream({0.9, 100, 10'000}, static_cast<double>(live), 1);
+    FirstFit ff(batch);
+    Simulator<FirstFit> simulator(ff);
+    size_t max_live = 0;
+    auto tick = [&](uint64_t now) {
+      simulator.AdvanceTo(now);
+      Request request = stream.Next();
+      simulator.Allocate(request.size, LifetimeTicks(request.lifetime));
+      max_live = std::max(max_live, simulator.LiveBytes());
+    };
+    for (uint64_t now = 0; now < live; ++now) tick(now);
+    char name[64];
+    std::snprintf(name, sizeof(name), "free batch %zu", batch);
+    Time(name, live, ticks, [&]() {
+      for (uint64_t now = live; now < live + ticks; ++now) tick(now);
+    });
+    std::printf("%-36s high water / max live %6.3f\n", "",
+                static_cast<double>(ff.get_high_water()) /
+                    static_cast<double>(max_live));
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<size_t> lives;
+  for (int i = 1; i < argc; ++i) {
+    lives.push_back(std::strtoul(argv[i], nullptr, 10));
+  }
+  if (lives.empty()) lives = {1'000, 1'000'000, 10'000'000};
+  for (size_t live : lives) {
+    QueueBench(live, 10'000'000);
+  }
+  for (size_t live : lives) {
+    SimulatorBench(live, 1'000'000);
+  }
+  for (size_t live : lives) {
+    DeferredFreeBench(live, 1'000'000);
+  }
+}
@@ -0,0 +1,108 @@
+#include "simulator.h"
+
+#include "first_fit.h"
+
+#include <functional>
+#include <queue>
+#include <random>
+#include <vector>
+
+static void RadixHeapTest() {
+  std::default_random_engine engine(1);
+  RadixHeap<size_t> heap;
+  using Entry = std::pair<uint64_t, size_t>;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> expected;
+  uint64_t now = 0;
+  for (size_t i = 0; i < 100'000; ++i) {
+    if (engine() % 3 != 0 || expected.empty()) {
+      // Keys from `now` (ties included) up to far in the future.
+      uint64_t delay = engine() >> (engine() % 64);
+      uint64_t key = delay > UINT64_MAX - now ? UINT64_MAX : now + delay;
+      heap.Push(key, i);
+      expected.push({key, i});
+    } else {
+      auto [key, value] = heap.Pop();
+      assert(key == expected.top().first);
+      // Ties may come out in any order.
+      std::vector<Entry> ties;
+      while (expected.top() != Entry{key, value}) {
+        assert(expected.top().first == key);
+        ties.push_back(expected.top());
+        expected.pop();
+      }
+      expected.pop();
+      for (const Entry& tie : ties) expected.push(tie);
+      now = key;
+    }
+    assert(heap.size() == expected.size());
+    assert(heap.empty() || heap.MinKey() == expected.top().first);
+  }
+  while (!heap.empty()) {
+    assert(heap.Pop().first == expected.top().first);
+    expected.pop();
+  }
+  assert(expected.empty());
+}
+
+static void SimulatorTest() {
+  // Blocks live for 0, 1, 2 or 3 ticks.
+  FirstFit ff;
+  Simulator<FirstFit> simulator(ff);
+  std::vector<Block> blocks;
+  for (uint64_t t = 0; t < 4; ++t) {
+    simulator.AdvanceTo(t);
+    blocks.push_back(simulator.Allocate(10, t));
+  }
+  // A block that dies at tick t is freed by `AdvanceTo(t)`, so the first
+  // three reuse the same place.
+  assert(blocks[0].start() == 0);
+  assert(blocks[1].start() == 0);
+  assert(blocks[2].start() == 0);
+  assert(blocks[3].start() == 10);
+  assert(simulator.LiveBlocks() == 2);
+  assert(simulator.LiveBytes() == 20);
+  simulator.AdvanceTo(4);
+  assert(simulator.LiveBlocks() == 1);
+  simulator.AdvanceTo(6);
+  assert(simulator.LiveBlocks() == 0);
+  assert(simulator.LiveBytes() == 0);
+  assert(ff.get_high_water() == 20);
+  assert(LifetimeTicks(0) == 0);
+  assert(LifetimeTicks(0.5) == 1);
+  assert(LifetimeTicks(2) == 2);
+}
+
+// The simulator frees the same blocks at the same ticks as a binary heap of
+// deaths with floating-point times, so first fit does the same thing.
+static void SimulatorMatchesPriorityQueueTest() {
+  std::default_random_engine engine(2);
+  std::exponential_distribution<double> size(1.0 / 100);
+  std::exponential_distribution<double> lifetime(1.0 / 500);
+  FirstFit expected_ff, ff;
+  using Death = std::pair<double, size_t>;
+  std::priority_queue<Death, std::vector<Death>, std::greater<Death>> deaths;
+  std::vector<Block> blocks;
+  Simulator<FirstFit> simulator(ff);
+  for (size_t i = 0; i < 20'000; ++i) {
+    double now = static_cast<double>(i);
+    while (!deaths.empty() && deaths.top().first <= now) {
+      expected_ff.Free(blocks[deaths.top().second]);
+      deaths.pop();
+    }
+    simulator.AdvanceTo(i);
+    size_t bytes = static_cast<size_t>(size(engine)) + 1;
+    double life = lifetime(engine);
+    blocks.push_back(expected_ff.Alloc(bytes));
+    deaths.push({now + life, i});
+    Block block = simulator.Allocate(bytes, LifetimeTicks(life));
+    assert(block == blocks.back());
+    assert(simulator.LiveBlocks() == deaths.size());
+  }
+  assert(ff.get_high_water() == expected_ff.get_high_water());
+}
+
+int main() {
+  RadixHeapTest();
+  SimulatorTest();
+  SimulatorMatchesPriorityQueueTest();
+}
@@ -0,0 +1,133 @@
+// Benchmarks for `thread_cache.h`: throughput with 1 to 8 threads, with and
+// without thread caches in front of a locked `FirstFit`, and what the caches
+// do to fragmentation.  Run with `make bench`.
+
+#include "thread_cache.h"
+
+#include "first_fit.h"
+#include "simulator.h"
+#include "workload.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Sizes mostly small, some large: 90% with mean 64 bytes, 10% with mean 4KiB.
+constexpr Hyperexponential kSizes{0.9, 64, 4096};
+
+// Each of `num_threads` threads keeps 1000 blocks and replaces a random one
+// `ops` times, through `alloc` and `free`.  Returns the operations per
+// second, counting an alloc and a free as one.
+template <class MakeState, class Alloc, class Free>
+double Churn(size_t num_threads, size_t ops, MakeState make_state,
+             Alloc alloc, Free free) {
+  constexpr size_t kSlots = 1000;
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t]() {
+      auto state = make_state();
+      WorkloadStream stream(kSizes, 1, t + 1);
+      CounterRng rng(t + 1);
+      std::vector<Block> blocks;
+      for (size_t i = 0; i < kSlots; ++i) {
+        blocks.push_back(alloc(*state, stream.Next().size));
+      }
+      for (size_t i = 0; i < ops; ++i) {
+        Block& block = blocks[rng(i) % kSlots];
+        free(*state, block);
+        block = alloc(*state, stream.Next().size);
+      }
+      for (const Block& block : blocks) free(*state, block);
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  auto end = std::chrono::steady_clock::now();
+  return static_cast<double>(num_threads * ops) /
+         std::chrono::duration<double>(end - start).count();
+}
+
+void ThroughputBench(size_t ops) {
+  std::printf("%-8s %14s %14s %16s\n", "threads", "locked M/s", "cached M/s",
+              "locks per op");
+  for (size_t num_threads : {1u, 2u, 4u, 8u}) {
+    double locked;
+    {
+      SharedAllocator<FirstFit> shared;
+      locked = Churn(
+          num_threads, ops, [&]() { return &shared; },
+          [](SharedAllocator<FirstFit>& s, size_t size) {
+            return s.Alloc(size);
+          },
+          [](SharedAllocator<FirstFit>& s, Block block) { s.Free(block); });
+    }
+    SharedAllocator<FirstFit> shared;
+    double cached = Churn(
+        num_threads, ops,
+        [&]() { return std::make_unique<ThreadCache<FirstFit>>(shared); },
+        [](ThreadCache<FirstFit>& c, size_t size) { return c.Alloc(size); },
+        [](ThreadCache<FirstFit>& c, Block block) { c.Free(block); });
+    std::printf("%-8zu %14.2f %14.2f %16.3f\n", num_threads, locked / 1e6,
+                cached / 1e6,
+                static_cast<double>(shared.LockCount()) /
+                    static_cast<double>(num_threads * ops));
+  }
+}
+
+// Shore-style steady state, as in `fitness.cc`, with and without a cache
+// (one thread).  Prints the high-water mark relative to the most bytes ever
+// requested at once.
+void FragmentationBench(size_t allocations) {
+  constexpr double kMeanLifetime = 10'000;
+  std::vector<Request> trace;
+  WorkloadStream stream(kSizes, kMeanLifetime, 1);
+  for (size_t i = 0; i < allocations; ++i) trace.push_back(stream.Next());
+  // The bytes requested (not rounded up) that are live at each tick.
+  size_t max_live = 0;
+  {
+    FirstFit ff;
+    Simulator<FirstFit> simulator(ff);
+    for (size_t i = 0; i < trace.size(); ++i) {
+      simulator.AdvanceTo(i);
+      simulator.Allocate(trace[i].size, LifetimeTicks(trace[i].lifetime));
+      max_live = std::max(max_live, simulator.LiveBytes());
+    }
+    std::printf("\n%-28s high water / max live %6.3f\n", "no cache",
+                static_cast<double>(ff.get_high_water()) /
+                    static_cast<double>(max_live));
+  }
+  for (size_t capacity : {8u, 64u, 512u}) {
+    SharedAllocator<FirstFit> shared;
+    ThreadCacheOptions options;
+    options.capacity = capacity;
+    options.batch = capacity / 2;
+    size_t high_water;
+    {
+      ThreadCache<FirstFit> cache(shared, options);
+      Simulator<ThreadCache<FirstFit>> simulator(cache);
+      for (size_t i = 0; i < trace.size(); ++i) {
+        simulator.AdvanceTo(i);
+        simulator.Allocate(trace[i].size, LifetimeTicks(trace[i].lifetime));
+      }
+      high_water =
+          shared.With([](FirstFit& ff) { return ff.get_high_water(); });
+    }
+    char name[64];
+    std::snprintf(name, sizeof(name), "cache, capacity %zu", capacity);
+    std::printf("%-28s high water / max live %6.3f\n", name,
+                static_cast<double>(high_water) /
+                    static_cast<double>(max_live));
+  }
+}
+
+}  // namespace
+
+int main() {
+  ThroughputBench(1'000'000);
+  FragmentationBench(1'000'000);
+}
@@ -0,0 +1,132 @@
+#include "thread_cache.h"
+
+#include "first_fit.h"
+
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+// Checks that `blocks` don't overlap.
+static void CheckDisjoint(const std::vector<Block>& blocks) {
+  std::set<Block> sorted(blocks.begin(), blocks.end());
+  assert(sorted.size() == blocks.size());
+  size_t end = 0;
+  for (const Block& block : sorted) {
+    assert(block.start() >= end);
+    end = block.end();
+  }
+}
+
+static size_t LivePages(SharedAllocator<FirstFit>& shared) {
+  return shared.With([](FirstFit& ff) {
+    return ff.get_residency().pages.Pages();
+  });
+}
+
+static void SingleThreadTest() {
+  SharedAllocator<FirstFit> shared;
+  ThreadCacheOptions options;
+  options.capacity = 8;
+  options.batch = 4;
+  {
+    ThreadCache<FirstFit> cache(shared, options);
+    // The first small allocation takes a batch.
+    Block a = cache.Alloc(20);
+    assert(a.size() == 32);
+    assert(shared.LockCount() == 1);
+    assert(cache.CachedBytes() == 3 * 32);
+    Block b = cache.Alloc(17);
+    assert(b.size() == 32 && b.start() != a.start());
+    assert(shared.LockCount() == 1);
+    // A freed block is the next one handed out.
+    cache.Free(a);
+    assert(cache.Alloc(32) == a);
+    // Large blocks aren't cached.
+    Block large = cache.Alloc(5000);
+    assert(large.size() == 5000);
+    assert(shared.LockCount() == 2);
+    cache.Free(large);
+    assert(shared.LockCount() == 3);
+    cache.Free(a);
+    cache.Free(b);
+  }
+  // The destructor gave everything back.
+  assert(LivePages(shared) == 0);
+}
+
+// Random churn: the blocks in use never overlap, a full class flushes a
+// batch at a time, and the caches stay bounded.
+static void RandomizedTest() {
+  SharedAllocator<FirstFit> shared;
+  ThreadCacheOptions options;
+  options.capacity = 16;
+  options.batch = 8;
+  ThreadCache<FirstFit> cache(shared, options);
+  std::default_random_engine engine(1);
+  std::uniform_int_distribution<size_t> size(1, 2000);
+  std::vector<Block> blocks;
+  for (size_t i = 0; i < 20'000; ++i) {
+    if (blocks.size() > 300 || (!blocks.empty() && engine() % 2)) {
+      size_t j = engine() % blocks.size();
+      cache.Free(blocks[j]);
+      blocks[j] = blocks.back();
+      blocks.pop_back();
+    } else {
+      size_t n = size(engine);
+      blocks.push_back(cache.Alloc(n));
+      assert(blocks.back().size() >= n);
+    }
+    // Every class full.
+    assert(cache.CachedBytes() <= options.capacity * 16 * (64 * 65 / 2));
+  }
+  CheckDisjoint(blocks);
+  for (const Block& block : blocks) cache.Free(block);
+  cache.Flush();
+  assert(cache.CachedBytes() == 0);
+  assert(LivePages(shared) == 0);
+}
+
+// Threads allocate from their own caches and free each other's blocks.
+static void ThreadsTest() {
+  SharedAllocator<FirstFit> shared;
+  constexpr size_t kThreads = 4;
+  std::vector<std::vector<Block>> kept(kThreads);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t]() {
+      ThreadCache<FirstFit> cache(shared);
+      std::default_random_engine engine(static_cast<unsigned>(t));
+      std::vector<Block> blocks;
+      for (size_t i = 0; i < 10'000; ++i) {
+        if (blocks.size() > 100) {
+          size_t j = engine() % blocks.size();
+          cache.Free(blocks[j]);
+          blocks[j] = blocks.back();
+          blocks.pop_back();
+        }
+        blocks.push_back(cache.Alloc(1 + engine() % 1500));
+      }
+      kept[t] = std::move(blocks);
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  std::vector<Block> all;
+  for (const std::vector<Block>& blocks : kept) {
+    all.insert(all.end(), blocks.begin(), blocks.end());
+  }
+  CheckDisjoint(all);
+  // Free them all from one thread's cache, which then holds other threads'
+  // blocks.
+  {
+    ThreadCache<FirstFit> cache(shared);
+    for (const Block& block : all) cache.Free(block);
+  }
+  assert(LivePages(shared) == 0);
+}
+
+int main() {
+  SingleThreadTest();
+  RandomizedTest();
+  ThreadsTest();
+}
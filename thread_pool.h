@@ -0,0 +1,205 @@
+/* A small fork-join thread pool with work stealing.
+ *
+ * `Fork2(f, g)` runs `f` and `g`, possibly in parallel, and returns when both
+ * are done.  The calling thread pushes `g` onto its own deque and runs `f`.
+ * Idle threads steal from the front of other threads' deques (where the
+ * oldest, and so typically biggest, tasks are), while each thread pops its own
+ * deque from the back.  A thread waiting for a stolen task runs other tasks
+ * instead of blocking, so nested `Fork2` calls can't deadlock.
+ *
+ * Threads that don't belong to the pool can call `Fork2` too: they share an
+ * extra deque.
+ */
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+ public:
+  // Creates a pool with `num_threads` threads, counting the caller of `Fork2`
+  // as one of them.  So `ThreadPool(1)` runs everything in the caller.
+  explicit ThreadPool(size_t num_threads = DefaultNumThreads())
+      :_queues(std::max(num_threads, size_t(1))) {
+    for (size_t i = 1; i < _queues.size(); ++i) {
+      _threads.emplace_back([this, i]() { WorkerLoop(i); });
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(_sleep_mutex);
+      _stop = true;
+    }
+    _wake.notify_all();
+    for (std::thread& thread : _threads) {
+      thread.join();
+    }
+  }
+
+  static size_t DefaultNumThreads() {
+    return std::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+  }
+
+  size_t NumThreads() const { return _queues.size(); }
+
+  // Runs `f()` and `g()`, possibly in parallel.
+  template <class F, class G>
+  void Fork2(F&& f, G&& g) {
+    if (_queues.size() == 1) {
+      f();
+      g();
+      return;
+    }
+    Task task{std::function<void()>(std::forward<G>(g))};
+    size_t self = QueueIndex();
+    Push(self, &task);
+    f();
+    while (!task.done.load(std::memory_order_acquire)) {
+      if (Task* other = PopOrSteal(self)) {
+        Run(other);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+ private:
+  struct Task {
+    explicit Task(std::function<void()> f) :fun(std::move(f)) {}
+    std::function<void()> fun;
+    std::atomic<bool> done{false};
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task*> tasks;
+  };
+
+  // Returns the index of the calling thread's queue: its own if it's one of our
+  // workers, else the shared queue 0.
+  size_t QueueIndex() const {
+    if (WorkerPool() == this) {
+      return WorkerIndex();
+    }
+    return 0;
+  }
+
+  static const ThreadPool*& WorkerPool() {
+    static thread_local const ThreadPool* pool = nullptr;
+    return pool;
+  }
+  static size_t& WorkerIndex() {
+    static thread_local size_t index = 0;
+    return index;
+  }
+
+  void Push(size_t queue, Task* task) {
+    {
+      std::lock_guard<std::mutex> lock(_queues[queue].mutex);
+      _queues[queue].tasks.push_back(task);
+    }
+    // Sequentially consistent, so that either we see the worker going to sleep
+    // or it sees the new task.
+    _pending.fetch_add(1);
+    if (_sleeping.load() > 0) {
+      std::lock_guard<std::mutex> lock(_sleep_mutex);
+      _wake.notify_one();
+    }
+  }
+
+  // Pops the newest task from our own queue, or else steals the oldest task
+  // from some other queue.  Returns null if there's nothing to do.
+  Task* PopOrSteal(size_t self) {
+    if (_pending.load(std::memory_order_acquire) == 0) {
+      return nullptr;
+    }
+    {
+      Queue& queue = _queues[self];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        Task* task = queue.tasks.back();
+        queue.tasks.pop_back();
+        _pending.fetch_sub(1, std::memory_order_relaxed);
+        return task;
+      }
+    }
+    for (size_t i = 1; i < _queues.size(); ++i) {
+      Queue& queue = _queues[(self + i) % _queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        Task* task = queue.tasks.front();
+        queue.tasks.pop_front();
+        _pending.fetch_sub(1, std::memory_order_relaxed);
+        return task;
+      }
+    }
+    return nullptr;
+  }
+
+  static void Run(Task* task) {
+    task->fun();
+    task->done.store(true, std::memory_order_release);
+  }
+
+  void WorkerLoop(size_t index) {
+    WorkerPool() = this;
+    WorkerIndex() = index;
+    while (true) {
+      if (Task* task = PopOrSteal(index)) {
+        Run(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(_sleep_mutex);
+      if (_stop) {
+        return;
+      }
+      _sleeping.fetch_add(1);
+      _wake.wait(lock, [this]() { return _stop || _pending.load() > 0; });
+      _sleeping.fetch_sub(1);
+    }
+  }
+
+  std::vector<Queue> _queues;
+  std::vector<std::thread> _threads;
+  // The number of tasks in all the queues.
+  std::atomic<size_t> _pending{0};
+  // The number of workers waiting on `_wake`.
+  std::atomic<size_t> _sleeping{0};
+  std::mutex _sleep_mutex;
+  std::condition_variable _wake;
+  bool _stop = false;
+};
+
+// Sorts `[begin, end)` with `pool`, using merge sort.  Like `std::stable_sort`,
+// equal elements keep their order.
+template <class It, class Compare = std::less<>>
+void ParallelSort(ThreadPool& pool, It begin, It end, Compare compare = {},
+                  size_t grain = 1 << 14) {
+  auto size = std::distance(begin, end);
+  if (size <= static_cast<decltype(size)>(grain) || pool.NumThreads() == 1) {
+    std::stable_sort(begin, end, compare);
+    return;
+  }
+  It middle = std::next(begin, size / 2);
+  pool.Fork2([&]() { ParallelSort(pool, begin, middle, compare, grain); },
+             [&]() { ParallelSort(pool, middle, end, compare, grain); });
+  std::inplace_merge(begin, middle, end, compare);
+}
+
+#endif  // THREAD_POOL_H_
@@ -0,0 +1,70 @@
+#include "thread_pool.h"
+
+#include <random>
+#include <vector>
+
+static size_t Fib(ThreadPool& pool, size_t n) {
+  if (n < 2) {
+    return n;
+  }
+  if (n < 10) {
+    return Fib(pool, n - 1) + Fib(pool, n - 2);
+  }
+  size_t a, b;
+  pool.Fork2([&]() { a = Fib(pool, n - 1); }, [&]() { b = Fib(pool, n - 2); });
+  return a + b;
+}
+
+static void ForkTest() {
+  for (size_t num_threads : {1u, 2u, 4u, 8u}) {
+    ThreadPool pool(num_threads);
+    assert(pool.NumThreads() == num_threads);
+    assert(Fib(pool, 25) == 75025);
+  }
+}
+
+// Threads that aren't in the pool can share it.
+static void ExternalCallersTest() {
+  ThreadPool pool(3);
+  std::vector<std::thread> threads;
+  std::vector<size_t> results(4);
+  for (size_t i = 0; i < results.size(); ++i) {
+    threads.emplace_back([&pool, &results, i]() {
+      results[i] = Fib(pool, 20 + i);
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  assert(results[0] == 6765);
+  assert(results[1] == 10946);
+  assert(results[2] == 17711);
+  assert(results[3] == 28657);
+}
+
+static void ParallelSortTest() {
+  std::random_device device;
+  std::default_random_engine engine{device()};
+  std::uniform_int_distribution<size_t> distribution(0, 1000);
+  ThreadPool pool(4);
+  for (size_t size : {0u, 1u, 100u, 100'000u}) {
+    // Sort pairs by their first element, to check stability.
+    std::vector<std::pair<size_t, size_t>> v;
+    for (size_t i = 0; i < size; ++i) {
+      v.emplace_back(distribution(engine), i);
+    }
+    std::vector<std::pair<size_t, size_t>> expect = v;
+    auto compare = [](const auto& a, const auto& b) {
+      return a.first < b.first;
+    };
+    std::stable_sort(expect.begin(), expect.end(), compare);
+    ParallelSort(pool, v.begin(), v.end(), compare, 1000);
+    assert(v == expect);
+  }
+}
+
+int main() {
+  ForkTest();
+  ExternalCallersTest();
+  ParallelSortTest();
+}
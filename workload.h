@@ -0,0 +1,255 @@
+/* Fast generation of random workloads: block sizes and lifetimes, drawn in
+ * batches.
+ *
+ * Drawing samples one at a time from the `std::` distributions costs more
+ * than an O(log n) allocator operation, so here everything is done a batch
+ * at a time with loops that the compiler can vectorize:
+ *
+ *  - `CounterRng` is counter based (the wyrand mixing function applied to a
+ *    seeded counter), so the i'th number of a stream doesn't depend on the
+ *    ones before it, and a batch has no loop-carried dependence.
+ *  - `FastLog` computes the logarithm with a polynomial and no branches, for
+ *    inverse-CDF sampling of exponential distributions.
+ *  - `AliasTable` samples an empirical distribution in O(1) with integer
+ *    arithmetic only (Vose's alias method).
+ *
+ * `WorkloadStream` puts them together to produce `Request`s.
+ */
+
+#ifndef WORKLOAD_H_
+#define WORKLOAD_H_
+
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <vector>
+
+// A counter-based random number generator: `(*this)(i)` is the i'th number of
+// the stream, computed from `i` alone.
+class CounterRng {
+ public:
+  explicit CounterRng(uint64_t seed) :_seed(Mix(seed, kIncrement)) {}
+
+  uint64_t operator()(uint64_t counter) const {
+    uint64_t state = _seed + counter * kIncrement;
+    return Mix(state, state ^ kXor);
+  }
+
+  // Fills `out` with the numbers for `first_counter`, `first_counter + 1`, ...
+  void Fill(uint64_t first_counter, std::span<uint64_t> out) const {
+    for (size_t i = 0; i < out.size(); ++i) {
+      out[i] = (*this)(first_counter + i);
+    }
+  }
+
+ private:
+  // wyrand's constants and mixing function.
+  static constexpr uint64_t kIncrement = 0xa0761d6478bd642f;
+  static constexpr uint64_t kXor = 0xe7037ed1a0b428db;
+  static uint64_t Mix(uint64_t a, uint64_t b) {
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    return static_cast<uint64_t>(product >> 64) ^ static_cast<uint64_t>(product);
+  }
+
+  uint64_t _seed;
+};
+
+// Maps the high 52 of 64 random bits to a double uniform in (0, 1), never 0
+// or 1.  This works on the bits of the double (instead of converting an
+// integer), since without AVX-512 there's no vector instruction for that.
+inline double UnitInterval(uint64_t bits) {
+  // In [1, 2).
+  double x = std::bit_cast<double>((bits >> 12) | 0x3ff0'0000'0000'0000);
+  return (x - 1) + 0x1p-53;
+}
+
+// The natural log of `x`, which must be positive, normal and finite.  The
+// relative error is below 1e-10.
+inline double FastLog(double x) {
+  // Everything is done on the bits, so that loops calling this have no
+  // branches and no integer conversions (which need AVX-512), and vectorize
+  // with AVX2.  Plain x86-64 lacks 64-bit integer comparisons, so there the
+  // loops stay scalar.
+  uint64_t bits = std::bit_cast<uint64_t>(x);
+  uint64_t mantissa = bits & 0x000f'ffff'ffff'ffff;
+  // Whether the mantissa is above sqrt(2), in which case we use half of it
+  // (and one more for the exponent), so it is in [sqrt(1/2), sqrt(2)).
+  uint64_t big = mantissa > 0x0006'a09e'667f'3bcd ? 1 : 0;
+  double m = std::bit_cast<double>(mantissa | ((0x3ff - big) << 52));
+  // The biased exponent, converted to a double by putting it in the mantissa
+  // of 2^52.
+  double exponent = std::bit_cast<double>(((bits >> 52) + big) |
+                                          0x4330'0000'0000'0000) -
+                    (0x1p52 + 1023);
+  // log(m) = 2 atanh(s), where s = (m - 1) / (m + 1) is at most 0.172.
+  double s = (m - 1) / (m + 1);
+  double s2 = s * s;
+  double series = 1 + s2 * (1.0 / 3 + s2 * (1.0 / 5 + s2 * (1.0 / 7 +
+                  s2 * (1.0 / 9 + s2 * (1.0 / 11 + s2 * (1.0 / 13))))));
+  return exponent * 0.6931471805599453 + 2 * s * series;
+}
+
+// Fills `out` with exponentially distributed samples with mean `mean`, using
+// `random` for the randomness (one number per sample).
+inline void FillExponential(std::span<const uint64_t> random, double mean,
+                            std::span<double> out) {
+  assert(random.size() == out.size());
+  for (size_t i = 0; i < out.size(); ++i) {
+    out[i] = -mean * FastLog(UnitInterval(random[i]));
+  }
+}
+
+// A mixture of two exponential distributions: with probability `p_small` the
+// mean is `small_mean`, and otherwise it is `large_mean`.
+struct Hyperexponential {
+  double p_small;
+  double small_mean;
+  double large_mean;
+  double Mean() const {
+    return p_small * small_mean + (1 - p_small) * large_mean;
+  }
+};
+
+// Like `FillExponential`.  Each sample uses one random number: the low 11
+// bits pick the branch (so `p_small` is rounded to a multiple of 1/2048) and
+// the high 52 bits the exponential.
+inline void FillHyperexponential(std::span<const uint64_t> random,
+                                 Hyperexponential h, std::span<double> out) {
+  assert(random.size() == out.size());
+  // The branch is small iff the low 11 bits (which `UnitInterval` ignores)
+  // are below this.
+  double threshold = h.p_small * 2048;
+  for (size_t i = 0; i < out.size(); ++i) {
+    double low = static_cast<double>(random[i] & 2047);
+    double mean = low < threshold ? h.small_mean : h.large_mean;
+    out[i] = -mean * FastLog(UnitInterval(random[i]));
+  }
+}
+
+// Samples from the discrete distribution with the given (nonnegative, not all
+// zero) weights, in O(1) per sample.
+class AliasTable {
+ public:
+  explicit AliasTable(std::span<const double> weights)
+      :_threshold(weights.size()), _alias(weights.size()) {
+    size_t n = weights.size();
+    assert(n > 0 && n < (size_t(1) << 32));
+    double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+    // Vose's method: scale so the average is 1, then pair each small column
+    // with a large one that tops it up.
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small, large;
+    for (size_t i = 0; i < n; ++i) {
+      scaled[i] = weights[i] * static_cast<double>(n) / total;
+      (scaled[i] < 1 ? small : large).push_back(static_cast<uint32_t>(i));
+    }
+    while (!small.empty() && !large.empty()) {
+      uint32_t s = small.back(), l = large.back();
+      small.pop_back();
+      SetColumn(s, scaled[s], l);
+      scaled[l] -= 1 - scaled[s];
+      if (scaled[l] < 1) {
+        large.pop_back();
+        small.push_back(l);
+      }
+    }
+    // What's left is 1 up to rounding.
+    for (uint32_t i : small) SetColumn(i, 1, i);
+    for (uint32_t i : large) SetColumn(i, 1, i);
+  }
+
+  size_t Size() const { return _alias.size(); }
+
+  // Maps 64 random bits to a sample: the high half picks a column, and the
+  // low half picks between the column and its alias.
+  uint32_t Sample(uint64_t bits) const {
+    uint64_t column = ((bits >> 32) * _alias.size()) >> 32;
+    uint32_t coin = static_cast<uint32_t>(bits);
+    return coin < _threshold[column] ? static_cast<uint32_t>(column)
+                                     : _alias[column];
+  }
+
+  void Fill(std::span<const uint64_t> random, std::span<uint32_t> out) const {
+    assert(random.size() == out.size());
+    for (size_t i = 0; i < out.size(); ++i) {
+      out[i] = Sample(random[i]);
+    }
+  }
+
+ private:
+  // Column `i` keeps itself with probability `p`, else it's `alias`.
+  void SetColumn(uint32_t i, double p, uint32_t alias) {
+    _threshold[i] = p >= 1 ? UINT32_MAX : static_cast<uint32_t>(p * 0x1p32);
+    _alias[i] = alias;
+  }
+
+  std::vector<uint32_t> _threshold;
+  std::vector<uint32_t> _alias;
+};
+
+// One allocation: how big it is, and how many allocations later it is freed.
+struct Request {
+  size_t size;
+  double lifetime;
+};
+
+// An endless stream of requests with hyperexponential sizes (rounded up, so
+// at least 1) and exponential lifetimes, generated `kBatch` at a time.  Sizes
+// and lifetimes come from separate counter streams of the same generator, so
+// the stream is the same whatever the batch size, and `Seek` is cheap.
+class WorkloadStream {
+ public:
+  static constexpr size_t kBatch = 4096;
+
+  WorkloadStream(Hyperexponential sizes, double mean_lifetime, uint64_t seed)
+      :_rng(seed), _sizes(sizes), _mean_lifetime(mean_lifetime) {}
+
+  Request Next() {
+    if (_next == kBatch) Refill();
+    Request result{_size_batch[_next], _lifetime_batch[_next]};
+    ++_next;
+    return result;
+  }
+
+  // The number of requests returned so far.
+  uint64_t Position() const { return _counter - kBatch + _next; }
+
+  // Skips (backwards or forwards) to just after `position` requests, in
+  // O(kBatch) time, as if `Next` had been called that many times.
+  void Seek(uint64_t position) {
+    _counter = position / kBatch * kBatch;
+    Refill();
+    _next = position % kBatch;
+  }
+
+ private:
+  void Refill() {
+    // Counters `2k` are for sizes, `2k + 1` for lifetimes.
+    for (size_t i = 0; i < kBatch; ++i) {
+      _random[i] = _rng(2 * (_counter + i));
+    }
+    FillHyperexponential(_random, _sizes, _samples);
+    for (size_t i = 0; i < kBatch; ++i) {
+      _size_batch[i] = static_cast<size_t>(_samples[i]) + 1;
+      _random[i] = _rng(2 * (_counter + i) + 1);
+    }
+    FillExponential(_random, _mean_lifetime, _lifetime_batch);
+    _counter += kBatch;
+    _next = 0;
+  }
+
+  CounterRng _rng;
+  Hyperexponential _sizes;
+  double _mean_lifetime;
+  uint64_t _counter = 0;
+  size_t _next = kBatch;
+  std::vector<uint64_t> _random = std::vector<uint64_t>(kBatch);
+  std::vector<double> _samples = std::vector<double>(kBatch);
+  std::vector<size_t> _size_batch = std::vector<size_t>(kBatch);
+  std::vector<double> _lifetime_batch = std::vector<double>(kBatch);
+};
+
+#endif  // WORKLOAD_H_
@@ -0,0 +1,161 @@
+// Benchmarks for `workload.h`: samples per second, compared with the `std::`
+// distributions, and events per second fed into `FirstFit`.  Run with
+// `make bench`.
+
+#include "first_fit.h"
+#include "workload.h"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <queue>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Calls `fun` and prints the rate, where `fun` does `ops` operations.
+template <class Fun>
+void Time(const char* name, size_t ops, Fun fun) {
+  auto start = std::chrono::steady_clock::now();
+  fun();
+  auto end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+  std::printf("%-44s %10zu ops %8.1f M/s\n", name, ops,
+              static_cast<double>(ops) / seconds / 1e6);
+}
+
+// Keeps the compiler from optimizing away a result.
+volatile double sink;
+
+void SamplingBench(size_t n) {
+  Hyperexponential h{0.9, 100, 10'000};
+  {
+    std::default_random_engine engine(1);
+    std::exponential_distribution<double> exponential(0.01);
+    Time("std::exponential_distribution", n, [&]() {
+      double sum = 0;
+      for (size_t i = 0; i < n; ++i) sum += exponential(engine);
+      sink = sum;
+    });
+  }
+  {
+    std::default_random_engine engine(1);
+    std::bernoulli_distribution small(h.p_small);
+    std::exponential_distribution<double> small_size(1 / h.small_mean);
+    std::exponential_distribution<double> large_size(1 / h.large_mean);
+    Time("std:: hyperexponential", n, [&]() {
+      double sum = 0;
+      for (size_t i = 0; i < n; ++i) {
+        sum += small(engine) ? small_size(engine) : large_size(engine);
+      }
+      sink = sum;
+    });
+  }
+  CounterRng rng(1);
+  std::vector<uint64_t> random(WorkloadStream::kBatch);
+  std::vector<double> samples(WorkloadStream::kBatch);
+  Time("FillExponential", n, [&]() {
+    double sum = 0;
+    for (size_t i = 0; i < n; i += random.size()) {
+      rng.Fill(i, random);
+      FillExponential(random, 100, samples);
+      sum += samples[0];
+    }
+    sink = sum;
+  });
+  Time("FillHyperexponential", n, [&]() {
+    double sum = 0;
+    for (size_t i = 0; i < n; i += random.size()) {
+      rng.Fill(i, random);
+      FillHyperexponential(random, h, samples);
+      sum += samples[0];
+    }
+    sink = sum;
+  });
+  {
+    std::vector<double> weights(1000);
+    for (size_t i = 0; i < weights.size(); ++i) {
+      weights[i] = 1.0 / static_cast<double>(i + 1);
+    }
+    std::default_random_engine engine(1);
+    std::discrete_distribution<uint32_t> discrete(weights.begin(),
+                                                  weights.end());
+    Time("std::discrete_distribution, 1000 weights", n, [&]() {
+      double sum = 0;
+      for (size_t i = 0; i < n; ++i) sum += discrete(engine);
+      sink = sum;
+    });
+    AliasTable table(weights);
+    std::vector<uint32_t> indexes(WorkloadStream::kBatch);
+    Time("AliasTable::Fill, 1000 weights", n, [&]() {
+      double sum = 0;
+      for (size_t i = 0; i < n; i += random.size()) {
+        rng.Fill(i, random);
+        table.Fill(random, indexes);
+        sum += indexes[0];
+      }
+      sink = sum;
+    });
+  }
+}
+
+// Feeds `n` allocations (and their frees) into `FirstFit`, with requests
+// from `next()`.
+template <class Next>
+void FeedFirstFit(size_t n, Next next) {
+  FirstFit ff;
+  using Death = std::pair<double, Block>;
+  auto later = [](const Death& a, const Death& b) { return a.first > b.first; };
+  std::priority_queue<Death, std::vector<Death>, decltype(later)> deaths(later);
+  for (size_t i = 0; i < n; ++i) {
+    double now = static_cast<double>(i);
+    while (!deaths.empty() && deaths.top().first <= now) {
+      ff.Free(deaths.top().second);
+      deaths.pop();
+    }
+    Request r = next();
+    deaths.push({now + r.lifetime, ff.Alloc(r.size)});
+  }
+  sink = static_cast<double>(ff.get_high_water());
+}
+
+void EventsBench(size_t n) {
+  Hyperexponential h{0.9, 100, 10'000};
+  constexpr double kMeanLifetime = 1'000;
+  {
+    WorkloadStream stream(h, kMeanLifetime, 1);
+    Time("WorkloadStream requests", n, [&]() {
+      double sum = 0;
+      for (size_t i = 0; i < n; ++i) sum += stream.Next().lifetime;
+      sink = sum;
+    });
+  }
+  {
+    std::default_random_engine engine(1);
+    std::bernoulli_distribution small(h.p_small);
+    std::exponential_distribution<double> small_size(1 / h.small_mean);
+    std::exponential_distribution<double> large_size(1 / h.large_mean);
+    std::exponential_distribution<double> lifetime(1 / kMeanLifetime);
+    Time("FirstFit events, std:: distributions", n, [&]() {
+      FeedFirstFit(n, [&]() {
+        double size = small(engine) ? small_size(engine) : large_size(engine);
+        return Request{static_cast<size_t>(size) + 1, lifetime(engine)};
+      });
+    });
+  }
+  {
+    WorkloadStream stream(h, kMeanLifetime, 1);
+    Time("FirstFit events, WorkloadStream", n, [&]() {
+      FeedFirstFit(n, [&]() { return stream.Next(); });
+    });
+  }
+}
+
+}  // namespace
+
+int main() {
+  SamplingBench(10'000'000);
+  EventsBench(1'000'000);
+}
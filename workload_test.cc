@@ -0,0 +1,102 @@
+#include "workload.h"
+
+#include <cmath>
+#include <vector>
+
+static void CounterRngTest() {
+  CounterRng rng(1);
+  // Filling in pieces gives the same numbers as filling all at once.
+  std::vector<uint64_t> all(100), pieces(100);
+  rng.Fill(5, all);
+  rng.Fill(5, std::span(pieces).first(30));
+  rng.Fill(35, std::span(pieces).subspan(30));
+  assert(all == pieces);
+  assert(rng(5) == all[0]);
+  assert(CounterRng(2)(5) != all[0]);
+  // Roughly half the bits are set.
+  size_t ones = 0;
+  for (uint64_t x : all) ones += static_cast<size_t>(std::popcount(x));
+  assert(ones > 3000 && ones < 3400);
+}
+
+static void FastLogTest() {
+  for (double x : {1e-300, 1e-17, 0x1p-54, 0.1, 0.5, 0.70710678, 0.999999, 1.0,
+                   1.0000001, 1.5, 2.0, 3.0, 1e10, 1e300}) {
+    double expected = std::log(x);
+    assert(std::abs(FastLog(x) - expected) <= 1e-10 * std::abs(expected) ||
+           std::abs(FastLog(x) - expected) < 1e-15);
+  }
+  CounterRng rng(3);
+  for (uint64_t i = 0; i < 100'000; ++i) {
+    double u = UnitInterval(rng(i));
+    assert(u > 0 && u < 1);
+    assert(std::abs(FastLog(u) - std::log(u)) <= 1e-10 * -std::log(u) + 1e-16);
+  }
+}
+
+static double Mean(const std::vector<double>& samples) {
+  double sum = 0;
+  for (double x : samples) sum += x;
+  return sum / static_cast<double>(samples.size());
+}
+
+static void DistributionTest() {
+  constexpr size_t kSamples = 1'000'000;
+  CounterRng rng(4);
+  std::vector<uint64_t> random(kSamples);
+  rng.Fill(0, random);
+  std::vector<double> samples(kSamples);
+  FillExponential(random, 10, samples);
+  assert(std::abs(Mean(samples) - 10) < 0.1);
+  Hyperexponential h{0.75, 1, 100};
+  FillHyperexponential(random, h, samples);
+  assert(std::abs(Mean(samples) - h.Mean()) < 0.01 * h.Mean());
+  size_t small = 0;
+  for (double x : samples) small += x < 10;
+  // P(small branch and < 10) + P(large branch and < 10).
+  double expected = 0.75 * (1 - std::exp(-10.0)) + 0.25 * (1 - std::exp(-0.1));
+  assert(std::abs(static_cast<double>(small) / kSamples - expected) < 0.005);
+}
+
+static void AliasTableTest() {
+  std::vector<double> weights = {1, 0, 3, 0.5, 10, 2.5};
+  AliasTable table(weights);
+  assert(table.Size() == weights.size());
+  constexpr size_t kSamples = 1'000'000;
+  std::vector<uint64_t> random(kSamples);
+  CounterRng(5).Fill(0, random);
+  std::vector<uint32_t> samples(kSamples);
+  table.Fill(random, samples);
+  std::vector<size_t> counts(weights.size());
+  for (uint32_t s : samples) ++counts[s];
+  assert(counts[1] == 0);
+  for (size_t i = 0; i < weights.size(); ++i) {
+    double expected = weights[i] / 17;
+    assert(std::abs(static_cast<double>(counts[i]) / kSamples - expected) <
+           0.003);
+  }
+}
+
+static void WorkloadStreamTest() {
+  Hyperexponential h{0.9, 100, 10'000};
+  WorkloadStream a(h, 1000, 7), b(h, 1000, 7);
+  double size_sum = 0, lifetime_sum = 0;
+  constexpr size_t kRequests = 3 * WorkloadStream::kBatch + 5;
+  for (size_t i = 0; i < kRequests; ++i) {
+    Request r = a.Next(), s = b.Next();
+    assert(r.size == s.size && r.lifetime == s.lifetime);
+    assert(r.size >= 1 && r.lifetime > 0);
+    size_sum += static_cast<double>(r.size);
+    lifetime_sum += r.lifetime;
+  }
+  assert(std::abs(size_sum / kRequests - h.Mean()) < 0.1 * h.Mean());
+  assert(std::abs(lifetime_sum / kRequests - 1000) < 50);
+}
+
+int main() {
+  CounterRngTest();
+  FastLogTest();
+  DistributionTest();
+  AliasTableTest();
+  WorkloadStreamTest();
+}